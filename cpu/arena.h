@@ -0,0 +1,111 @@
+/* arena.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#pragma once
+
+#include "engine.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace hqx
+{
+
+// Bump allocator for scratch memory. The block is sized for the largest
+// request so far and handed out again after every reset, so once the first
+// frame has been processed no more heap allocations are made.
+struct arena
+{
+    // Sub-allocations start on a cache line
+    enum { alignment = 64 };
+
+    uint8_t* block = nullptr;
+    uint8_t* memory = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+
+    // Number of times the block was allocated from the heap
+    uint64_t allocations = 0;
+
+    // The block is backed by huge pages, see allocate_huge
+    bool huge_pages = false;
+
+    arena() {}
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+    ~arena() { release(); }
+
+    void release()
+    {
+        if (huge_pages)
+            free_huge(block, capacity);
+        else
+            delete[] block;
+        block = memory = nullptr;
+        capacity = used = 0;
+    }
+
+    // The block is allocated with the new kind of pages on the next reset
+    void use_huge_pages(bool enable)
+    {
+        if (enable == huge_pages)
+            return;
+        release();
+        huge_pages = enable;
+    }
+
+    static size_t align(size_t size) { return (size + alignment - 1) & ~(size_t)(alignment - 1); }
+
+    // Makes sure size bytes are available and releases all sub-allocations,
+    // returns false when the block could not be grown
+    bool reset(size_t size)
+    {
+        used = 0;
+        if (size <= capacity)
+            return true;
+
+        page_kind kind;
+        uint8_t* grown = huge_pages ? (uint8_t*)allocate_huge(size, &kind)
+                                    : new (std::nothrow) uint8_t[size + alignment - 1];
+        if (!grown)
+            return false;
+
+        release();
+        block = grown;
+        memory = (uint8_t*)align((uintptr_t)grown);
+        capacity = huge_pages ? huge_size(size) : size;
+        allocations++;
+        return true;
+    }
+
+    template <typename T>
+    T* allocate(size_t count)
+    {
+        T* ptr = (T*)(memory + used);
+        used += align(count * sizeof(T));
+        return ptr;
+    }
+};
+
+// Stands in for an arena to add up the size of the sub-allocations, so the
+// same code can be used to size the arena and to allocate from it
+struct arena_layout
+{
+    size_t size = 0;
+
+    template <typename T>
+    T* allocate(size_t count)
+    {
+        size += arena::align(count * sizeof(T));
+        return nullptr;
+    }
+};
+
+}
@@ -0,0 +1,295 @@
+/* batch.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+// Upscales a tree of PNG assets into an output directory. With a cache
+// directory the output of every source is kept, so a rebuild only upscales
+// the sources whose pixels changed. Sources with an index map sidecar next to
+// them skip the classification, -i writes the sidecars that are missing.
+
+#include "cache.h"
+#include "hqx.h"
+
+#include <dirent.h>
+#include <png.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct job
+{
+    std::string input, output;
+};
+
+struct options
+{
+    int scale = 2;
+    std::string output_dir, cache_dir;
+    int threads = 0;
+    bool sidecars = false; // write the missing index map sidecars
+};
+
+struct counters
+{
+    std::atomic<unsigned> upscaled{0}, cached{0}, failed{0}, indexed{0};
+};
+
+static bool is_png(const std::string& name)
+{
+    return name.size() > 4 && strcasecmp(name.c_str() + name.size() - 4, ".png") == 0;
+}
+
+// Adds the PNG files below dir, the outputs keep the path relative to it
+static void add_directory(const std::string& dir, const std::string& relative, const options& opts,
+                          std::vector<job>& jobs)
+{
+    DIR* handle = opendir(dir.c_str());
+    if (!handle)
+        return;
+
+    while (dirent* entry = readdir(handle))
+    {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+
+        const std::string path = dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+            add_directory(path, relative + name + "/", opts, jobs);
+        else if (S_ISREG(st.st_mode) && is_png(name))
+            jobs.push_back({ path, opts.output_dir + "/" + relative + name });
+    }
+    closedir(handle);
+}
+
+static bool load_png(const std::string& path, std::vector<uint8_t>& pixels, int& width, int& height)
+{
+    png_image image = {};
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, path.c_str()))
+        return false;
+
+    image.format = PNG_FORMAT_RGBA;
+    pixels.resize(PNG_IMAGE_SIZE(image));
+    if (!png_image_finish_read(&image, nullptr, pixels.data(), 0, nullptr))
+    {
+        png_image_free(&image);
+        return false;
+    }
+
+    width = image.width;
+    height = image.height;
+    return true;
+}
+
+static bool encode_png(const std::vector<uint8_t>& pixels, int width, int height, std::vector<uint8_t>& encoded)
+{
+    png_image image = {};
+    image.version = PNG_IMAGE_VERSION;
+    image.width = width;
+    image.height = height;
+    image.format = PNG_FORMAT_RGBA;
+
+    png_alloc_size_t size = 0;
+    if (!png_image_write_get_memory_size(image, size, 0, pixels.data(), 0, nullptr))
+        return false;
+
+    encoded.resize(size);
+    if (!png_image_write_to_memory(&image, encoded.data(), &size, 0, pixels.data(), 0, nullptr))
+        return false;
+
+    encoded.resize(size);
+    return true;
+}
+
+static bool read_file(const std::string& path, std::vector<uint8_t>& data)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    data.clear();
+    uint8_t buffer[65536];
+    for (size_t size; (size = fread(buffer, 1, sizeof(buffer), file)) > 0;)
+        data.insert(data.end(), buffer, buffer + size);
+    fclose(file);
+    return true;
+}
+
+// Upscales with the index map sidecar next to the source when it's at least
+// as new as the source, or writes one when asked to
+static hqx_status upscale(hqx_context* ctx, const job& j, const struct stat& st, const options& opts,
+                          const std::vector<uint8_t>& pixels, int width, int height, std::vector<uint8_t>& upscaled,
+                          counters& count)
+{
+    const int scale = hqx_get_scale(ctx);
+    const std::string sidecar = j.input.substr(0, j.input.size() - 4) + ".hqxidx";
+
+    struct stat sidecar_st;
+    std::vector<uint8_t> index;
+    if (stat(sidecar.c_str(), &sidecar_st) == 0 && sidecar_st.st_mtime >= st.st_mtime && read_file(sidecar, index) &&
+        hqx_upscale_indexed(ctx, pixels.data(), width * 4, upscaled.data(), width * scale * 4, width, height,
+                            HQX_FORMAT_RGBA8888, index.data(), index.size()) == HQX_OK)
+    {
+        count.indexed++;
+        return HQX_OK;
+    }
+
+    size_t size;
+    index.resize(hqx_index_bound(width, height));
+    if (opts.sidecars && hqx_index_save(ctx, pixels.data(), width * 4, width, height, HQX_FORMAT_RGBA8888,
+                                        index.data(), index.size(), &size) == HQX_OK)
+        write_file(sidecar, index.data(), size);
+
+    return hqx_upscale(ctx, pixels.data(), width * 4, upscaled.data(), width * scale * 4, width, height,
+                       HQX_FORMAT_RGBA8888);
+}
+
+static bool process(hqx_context* ctx, const job& j, const options& opts, const output_cache* cache,
+                    counters& count)
+{
+    const uint64_t fingerprint = hqx_get_fingerprint(ctx);
+    const std::string output_dir = j.output.substr(0, j.output.rfind('/'));
+    if (!make_directories(output_dir))
+        return false;
+
+    // Unchanged sources are served without decoding them
+    struct stat st;
+    hash128 key;
+    if (stat(j.input.c_str(), &st) < 0)
+        return false;
+    if (cache && cache->lookup_source(j.input, st, fingerprint, key) && cache->fetch(key, j.output))
+    {
+        count.cached++;
+        return true;
+    }
+
+    std::vector<uint8_t> pixels;
+    int width, height;
+    if (!load_png(j.input, pixels, width, height))
+        return false;
+
+    // The file was touched or moved but the pixels may be the same
+    if (cache)
+    {
+        key = output_key(pixels.data(), pixels.size(), width, height, fingerprint);
+        if (cache->fetch(key, j.output))
+        {
+            cache->store_source(j.input, st, fingerprint, key);
+            count.cached++;
+            return true;
+        }
+    }
+
+    const int scale = hqx_get_scale(ctx);
+    std::vector<uint8_t> upscaled((size_t)width * scale * height * scale * 4);
+    std::vector<uint8_t> encoded;
+    if (upscale(ctx, j, st, opts, pixels, width, height, upscaled, count) != HQX_OK ||
+        !encode_png(upscaled, width * scale, height * scale, encoded) ||
+        !write_file(j.output, encoded.data(), encoded.size()))
+        return false;
+
+    if (cache)
+    {
+        cache->store(key, encoded.data(), encoded.size());
+        cache->store_source(j.input, st, fingerprint, key);
+    }
+    count.upscaled++;
+    return true;
+}
+
+int main(int argc, const char* argv[])
+{
+    options opts;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            opts.output_dir = argv[++i];
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            opts.cache_dir = argv[++i];
+        else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+            opts.scale = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            opts.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-i") == 0)
+            opts.sidecars = true;
+        else if (argv[i][0] != '-')
+            inputs.push_back(argv[i]);
+        else
+            inputs.clear(), i = argc;
+    }
+
+    if (inputs.empty() || opts.output_dir.empty())
+    {
+        printf("Usage: %s -o <output dir> [-c <cache dir>] [-x scale] [-j threads] [-i] <PNG files or dirs>...\n",
+               argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<job> jobs;
+    for (const std::string& input : inputs)
+    {
+        struct stat st;
+        if (stat(input.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+            add_directory(input, "", opts, jobs);
+        else
+            jobs.push_back({ input, opts.output_dir + "/" + input.substr(input.rfind('/') + 1) });
+    }
+
+    output_cache cache;
+    if (!opts.cache_dir.empty() && !cache.open(opts.cache_dir))
+    {
+        printf("Failed to create the cache in %s\n", opts.cache_dir.c_str());
+        return EXIT_FAILURE;
+    }
+
+    if (opts.threads <= 0)
+        opts.threads = std::max(1u, std::thread::hardware_concurrency());
+    opts.threads = std::min<int>(opts.threads, std::max<size_t>(jobs.size(), 1));
+
+    // Every worker takes the next file until there are none left
+    counters count;
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        hqx_context* ctx = hqx_create(opts.scale);
+        for (size_t i = next++; ctx && i < jobs.size(); i = next++)
+        {
+            if (!process(ctx, jobs[i], opts, opts.cache_dir.empty() ? nullptr : &cache, count))
+            {
+                printf("Failed to upscale %s\n", jobs[i].input.c_str());
+                count.failed++;
+            }
+        }
+        hqx_destroy(ctx);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 1; i < opts.threads; i++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("%zu files: %u upscaled (%u with a sidecar), %u from the cache, %u failed in %.3f s\n", jobs.size(),
+           count.upscaled.load(), count.indexed.load(), count.cached.load(), count.failed.load(), elapsed.count());
+    return count.failed || count.upscaled + count.cached < jobs.size() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+/* cache.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+bool make_directories(const std::string& path)
+{
+    for (size_t i = 1; i <= path.size(); i++)
+    {
+        if (i < path.size() && path[i] != '/')
+            continue;
+
+        std::string dir = path.substr(0, i);
+        if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+            return false;
+    }
+    return true;
+}
+
+bool write_file(const std::string& path, const void* data, size_t size)
+{
+    // Unique among the threads and processes sharing the cache
+    static std::atomic<unsigned> counter(0);
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".tmp%d.%u", (int)getpid(), counter++);
+    const std::string temp = path + suffix;
+
+    FILE* file = fopen(temp.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = fwrite(data, 1, size, file) == size;
+    ok &= fclose(file) == 0;
+    if (ok && rename(temp.c_str(), path.c_str()) == 0)
+        return true;
+
+    unlink(temp.c_str());
+    return false;
+}
+
+hash128 output_key(const void* pixels, size_t size, int width, int height, uint64_t fingerprint)
+{
+    return hash_bytes(pixels, size, fingerprint ^ ((uint64_t)width << 32 | (uint32_t)height));
+}
+
+bool output_cache::open(const std::string& path)
+{
+    dir = path;
+    return make_directories(dir + "/objects") && make_directories(dir + "/sources");
+}
+
+std::string output_cache::object_path(const hash128& key) const
+{
+    // Two levels keep the directories small
+    const std::string hex = key.hex();
+    return dir + "/objects/" + hex.substr(0, 2) + "/" + hex.substr(2) + ".png";
+}
+
+std::string output_cache::source_path(const std::string& path, uint64_t fingerprint) const
+{
+    char* real = realpath(path.c_str(), nullptr);
+    const std::string absolute = real ? real : path;
+    free(real);
+    return dir + "/sources/" + hash_bytes(absolute.data(), absolute.size(), fingerprint).hex();
+}
+
+bool output_cache::lookup_source(const std::string& path, const struct stat& st, uint64_t fingerprint,
+                                 hash128& key) const
+{
+    FILE* file = fopen(source_path(path, fingerprint).c_str(), "r");
+    if (!file)
+        return false;
+
+    unsigned long long size, seconds, nanoseconds, hi, lo;
+    bool ok = fscanf(file, "%llu %llu %llu %16llx%16llx", &size, &seconds, &nanoseconds, &hi, &lo) == 5;
+    fclose(file);
+
+    if (!ok || size != (unsigned long long)st.st_size || seconds != (unsigned long long)st.st_mtim.tv_sec ||
+        nanoseconds != (unsigned long long)st.st_mtim.tv_nsec)
+        return false;
+
+    key.hi = hi;
+    key.lo = lo;
+    return true;
+}
+
+void output_cache::store_source(const std::string& path, const struct stat& st, uint64_t fingerprint,
+                                const hash128& key) const
+{
+    char text[128];
+    int length = snprintf(text, sizeof(text), "%llu %llu %llu %s\n", (unsigned long long)st.st_size,
+                          (unsigned long long)st.st_mtim.tv_sec, (unsigned long long)st.st_mtim.tv_nsec,
+                          key.hex().c_str());
+    write_file(source_path(path, fingerprint), text, length);
+}
+
+bool output_cache::fetch(const hash128& key, const std::string& output) const
+{
+    int fd = ::open(object_path(key).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    bool ok = write_file(output, data, st.st_size);
+    munmap(data, st.st_size);
+    return ok;
+}
+
+void output_cache::store(const hash128& key, const void* data, size_t size) const
+{
+    const std::string path = object_path(key);
+    make_directories(path.substr(0, path.rfind('/')));
+    write_file(path, data, size);
+}
@@ -0,0 +1,52 @@
+/* cache.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#pragma once
+
+#include "hash.h"
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <string>
+
+// Output of earlier runs stored on disk. Objects are keyed by the source
+// pixels and the fingerprint of the context that upscaled them, so a change
+// to the look-up tables or thresholds can never serve stale output. Besides
+// that every source file remembers the key of its pixels along with its size
+// and modification time, so unchanged files don't even have to be decoded.
+struct output_cache
+{
+    std::string dir;
+
+    // Creates the directories of the cache
+    bool open(const std::string& path);
+
+    // The key of a source file from an earlier run, when it hasn't changed
+    bool lookup_source(const std::string& path, const struct stat& st, uint64_t fingerprint, hash128& key) const;
+    void store_source(const std::string& path, const struct stat& st, uint64_t fingerprint, const hash128& key) const;
+
+    // Writes the stored output to a file by mapping it into memory, returns
+    // false when there's no such object
+    bool fetch(const hash128& key, const std::string& output) const;
+    void store(const hash128& key, const void* data, size_t size) const;
+
+private:
+    std::string object_path(const hash128& key) const;
+    std::string source_path(const std::string& path, uint64_t fingerprint) const;
+};
+
+// The key of a frame of pixels upscaled by a context with this fingerprint
+hash128 output_key(const void* pixels, size_t size, int width, int height, uint64_t fingerprint);
+
+// Writes a whole file through a temporary one, so readers never see half of it
+bool write_file(const std::string& path, const void* data, size_t size);
+
+// mkdir -p
+bool make_directories(const std::string& path);
@@ -0,0 +1,81 @@
+/* hash.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// 128-bit hash of a block of memory, made of four independent lanes of
+// multiply and rotate like xxHash so it runs at memory speed
+struct hash128
+{
+    uint64_t lo, hi;
+
+    bool operator==(const hash128& other) const { return lo == other.lo && hi == other.hi; }
+
+    std::string hex() const
+    {
+        char text[33];
+        snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)hi, (unsigned long long)lo);
+        return text;
+    }
+};
+
+namespace hash_detail
+{
+
+static const uint64_t prime1 = 0x9E3779B185EBCA87ull;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t prime3 = 0x165667B19E3779F9ull;
+
+inline uint64_t rotl(uint64_t x, int r) { return x << r | x >> (64 - r); }
+
+inline uint64_t round(uint64_t acc, uint64_t word) { return rotl(acc + word * prime2, 31) * prime1; }
+
+inline uint64_t avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    return h ^ h >> 32;
+}
+
+}
+
+inline hash128 hash_bytes(const void* data, size_t size, uint64_t seed)
+{
+    using namespace hash_detail;
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t acc[4] = { seed + prime1 + prime2, seed + prime2, seed, seed - prime1 };
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            uint64_t word;
+            memcpy(&word, bytes + i + lane * 8, 8);
+            acc[lane] = round(acc[lane], word);
+        }
+    }
+
+    // The tail goes into the lanes one byte at a time
+    for (int lane = 0; i < size; i++, lane = (lane + 1) & 3)
+        acc[lane] = round(acc[lane], bytes[i]);
+
+    hash128 h;
+    h.lo = avalanche(rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18) + size);
+    h.hi = avalanche(acc[0] * prime3 ^ rotl(acc[1], 23) ^ acc[2] * prime1 ^ rotl(acc[3], 41) ^ size);
+    return h;
+}
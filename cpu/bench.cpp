@@ -0,0 +1,489 @@
+/* bench.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "engine.h"
+#include "blend.h"
+#include "hqx.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+
+static const int width = 640, height = 480;
+
+// Pixel art: rectangles in a small palette on a flat background
+static std::vector<uint32_t> low_colour_image(std::mt19937& rng)
+{
+    uint32_t palette[16];
+    for (uint32_t& colour : palette)
+        colour = rng() | 0xFF000000;
+
+    std::vector<uint32_t> image(width * height, palette[0]);
+    for (int i = 0; i < 60; i++)
+    {
+        int x0 = rng() % width, y0 = rng() % height;
+        int x1 = std::min(width, x0 + 1 + (int)(rng() % 160)), y1 = std::min(height, y0 + 1 + (int)(rng() % 120));
+        uint32_t colour = palette[rng() % 16];
+        for (int y = y0; y < y1; y++)
+            std::fill(image.begin() + y * width + x0, image.begin() + y * width + x1, colour);
+    }
+    return image;
+}
+
+// Every pixel a different colour, the worst case for equality checks
+static std::vector<uint32_t> noise_image(std::mt19937& rng)
+{
+    std::vector<uint32_t> image(width * height);
+    for (uint32_t& pixel : image)
+        pixel = rng() | 0xFF000000;
+    return image;
+}
+
+// Returns the best time of a number of runs in milliseconds
+static double measure(const std::function<void()>& run)
+{
+    double best = 1e9;
+    for (int i = 0; i < 20; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+// The blend in linear light with the sRGB curves in floating point. Returns
+// the largest difference of a colour channel from output, or 256 when alpha,
+// which is blended as it is, differs at all.
+static int linear_blend_error(const hqx::lut& table, const hqx::image& src, const uint16_t* index,
+                              const uint32_t* output)
+{
+    double to_linear[256];
+    for (int i = 0; i < 256; i++)
+    {
+        double c = i / 255.0;
+        to_linear[i] = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+    }
+
+    const int scale = table.scale;
+    int error = 0;
+    for (int y = 0; y < src.height; y++)
+    {
+        const uint32_t* row[3] = { src.row(std::max(y - 1, 0)), src.row(y), src.row(std::min(y + 1, src.height - 1)) };
+        for (int x = 0; x < src.width; x++)
+        {
+            const int column[3] = { std::max(x - 1, 0), x, std::min(x + 1, src.width - 1) };
+            const uint32_t* weights = table.weights + index[y * src.width + x] * scale * scale;
+            for (int sy = 0; sy < scale; sy++)
+            {
+                for (int sx = 0; sx < scale; sx++)
+                {
+                    const int qy = hqx::quadrant(sy, scale), qx = hqx::quadrant(sx, scale);
+                    const uint32_t p[4] = { row[1][x], row[qy][column[qx]], row[1][column[qx]], row[qy][x] };
+                    const uint32_t w = weights[sy * scale + sx];
+                    const uint32_t out = output[(y * scale + sy) * src.width * scale + x * scale + sx];
+
+                    uint32_t alpha = 8;
+                    double channels[3] = {};
+                    for (int i = 0; i < 4; i++)
+                    {
+                        const uint32_t weight = w >> 8 * i & 0xFF;
+                        alpha += (p[i] >> 24) * weight;
+                        for (int c = 0; c < 3; c++)
+                            channels[c] += to_linear[p[i] >> 8 * c & 0xFF] * weight / 16.0;
+                    }
+                    if (alpha >> 4 != out >> 24)
+                        return 256;
+
+                    for (int c = 0; c < 3; c++)
+                    {
+                        const double l = channels[c];
+                        const double e = l <= 0.0031308 ? l * 12.92 : 1.055 * std::pow(l, 1 / 2.4) - 0.055;
+                        error = std::max(error, std::abs((int)std::lround(e * 255.0) - (int)(out >> 8 * c & 0xFF)));
+                    }
+                }
+            }
+        }
+    }
+    return error;
+}
+
+// Upscales frames of the same size in every mode of the library. Only the
+// first frame may allocate, after that the allocation count of the context
+// has to stay the same. Returns the number of modes that allocated again.
+static int check_allocations(const std::vector<uint32_t>& pixels)
+{
+    const int scale = 2;
+    std::vector<uint32_t> output(width * scale * height * scale);
+    std::vector<uint16_t> pixels565(width * height), output565(output.size());
+    std::vector<uint8_t> yuv(output.size() * 3 / 2);
+    const hqx_yuv_planes planes = {
+        { yuv.data(), yuv.data() + output.size(), yuv.data() + output.size() * 5 / 4 },
+        { width * scale, width * scale / 2, width * scale / 2 }
+    };
+
+    const uint32_t* src = pixels.data();
+    uint32_t* dst = output.data();
+    const ptrdiff_t src_stride = width * 4, dst_stride = width * scale * 4;
+    const struct
+    {
+        const char* name;
+        std::function<hqx_status(hqx_context*)> upscale;
+    } modes[] = {
+        { "upscale", [&](hqx_context* ctx) {
+            return hqx_upscale(ctx, src, src_stride, dst, dst_stride, width, height, HQX_FORMAT_XRGB8888);
+        } },
+        { "upscale RGB565", [&](hqx_context* ctx) {
+            return hqx_upscale(ctx, pixels565.data(), width * 2, output565.data(), width * scale * 2, width, height,
+                               HQX_FORMAT_RGB565);
+        } },
+        { "upscale to YUV", [&](hqx_context* ctx) {
+            return hqx_upscale_to_yuv(ctx, src, src_stride, width, height, HQX_FORMAT_XRGB8888, &planes, HQX_YUV_I420);
+        } },
+        { "video", [&](hqx_context* ctx) {
+            return hqx_upscale_video(ctx, src, src_stride, dst, dst_stride, width, height, HQX_FORMAT_XRGB8888,
+                                     nullptr);
+        } },
+        { "progressive", [&](hqx_context* ctx) {
+            return hqx_upscale_progressive(ctx, src, src_stride, dst, dst_stride, width, height,
+                                           HQX_FORMAT_XRGB8888, 1000, nullptr);
+        } }
+    };
+
+    int failures = 0;
+    for (const auto& mode : modes)
+    {
+        hqx_context* ctx = hqx_create(scale);
+        hqx_status status = mode.upscale(ctx);
+        const uint64_t allocations = hqx_get_allocation_count(ctx);
+        for (int i = 0; i < 10 && status == HQX_OK; i++)
+            status = mode.upscale(ctx);
+
+        if (status != HQX_OK || hqx_get_allocation_count(ctx) != allocations)
+        {
+            printf("%s: allocated from the heap after the first frame\n", mode.name);
+            failures++;
+        }
+        hqx_destroy(ctx);
+    }
+    return failures;
+}
+
+static void report(const char* content, const char* name, double ms)
+{
+    printf("%-12s %-20s %8.3f ms %10.1f Mpix/s\n", content, name, ms, width * height / ms / 1000.0);
+}
+
+int main(int argc, const char* argv[])
+{
+    std::mt19937 rng(1);
+    const struct
+    {
+        const char* name;
+        std::vector<uint32_t> pixels;
+        hqx::order channels;
+    } images[] = {
+        { "low-colour", low_colour_image(rng), hqx::order_rgba },
+        { "noise", noise_image(rng), hqx::order_rgba },
+        { "yuv noise", noise_image(rng), hqx::order_yuv }
+    };
+
+    typedef void (*classifier)(const hqx::image&, int, int, uint16_t*, uint32_t*);
+    const struct
+    {
+        const char* name;
+        classifier classify;
+        bool avx2;
+    } classifiers[] = {
+        { "reference", [](const hqx::image& src, int y0, int y1, uint16_t* index, uint32_t*) {
+            hqx::classify_reference(src, y0, y1, index);
+        }, false },
+        { "bit-sliced", hqx::classify_bitsliced, false },
+        { "swar", hqx::classify_swar, false },
+        { "swar equal-first", hqx::classify_swar_equal_first, false },
+#if defined(HQX_HAVE_AVX2)
+        { "avx2", hqx::classify_avx2, true },
+        { "avx2 equal-first", hqx::classify_avx2_equal_first, true }
+#endif
+    };
+
+    if (!hqx::cpu_has_avx2())
+        printf("AVX2 is not supported, only the portable classifiers are measured\n");
+
+    int failures = check_allocations(images[0].pixels);
+    std::vector<uint16_t> expected(width * height), index(width * height);
+    std::vector<uint32_t> window(hqx::window_size(width));
+    for (const auto& image : images)
+    {
+        const hqx::image src = { image.pixels.data(), width, width, height, image.channels };
+        hqx::classify_reference(src, 0, height, expected.data());
+
+        for (const auto& c : classifiers)
+        {
+            if (c.avx2 && !hqx::cpu_has_avx2())
+                continue;
+
+            double ms = measure([&] { c.classify(src, 0, height, index.data(), window.data()); });
+            report(image.name, c.name, ms);
+
+            if (index != expected)
+            {
+                printf("%s: index map differs from the reference\n", c.name);
+                failures++;
+            }
+        }
+
+        // Every width up to 200 in bands of 7 rows, which covers the partial
+        // words and vectors at the end of a row and the edges of a band
+        for (const auto& c : classifiers)
+        {
+            if (c.avx2 && !hqx::cpu_has_avx2())
+                continue;
+
+            const int rows = 19, band = 7;
+            std::vector<uint16_t> narrow(200 * rows), narrow_expected(narrow.size());
+            for (int w = 1; w <= 200; w++)
+            {
+                const hqx::image part = { image.pixels.data(), width, w, rows, image.channels };
+                hqx::classify_reference(part, 0, rows, narrow_expected.data());
+                for (int y0 = 0; y0 < rows; y0 += band)
+                    c.classify(part, y0, std::min(y0 + band, rows), &narrow[y0 * w], window.data());
+
+                if (!std::equal(narrow.begin(), narrow.begin() + w * rows, narrow_expected.begin()))
+                {
+                    printf("%s: index map of a %d pixel wide band differs from the reference\n", c.name, w);
+                    failures++;
+                    break;
+                }
+            }
+        }
+
+        // The video mode compares every frame with the last one, here the
+        // last frame differs in every eighth pixel
+        std::vector<uint32_t> last(image.pixels);
+        for (size_t i = 0; i < last.size(); i += 8)
+            last[i] ^= 1;
+
+        std::vector<uint8_t> changed(width), expected_changed(width);
+        double compare_ms = measure([&] {
+            for (int y = 0; y < height; y++)
+                hqx::compare_row(&image.pixels[y * width], &last[y * width], width, changed.data());
+        });
+        report(image.name, "compare rows", compare_ms);
+
+        hqx::compare_row_reference(&image.pixels[(height - 1) * width], &last[(height - 1) * width], width,
+                                   expected_changed.data());
+        if (changed != expected_changed)
+        {
+            printf("compare rows: changed pixels differ from the reference\n");
+            failures++;
+        }
+
+        // The same image with 16-bit channels, the thresholds are rescaled
+        // exactly so it gives the same index map
+        if (image.channels == hqx::order_rgba)
+        {
+            std::vector<uint16_t> channels(width * height * 4);
+            for (size_t i = 0; i < channels.size(); i++)
+                channels[i] = (image.pixels[i / 4] >> 8 * (i % 4) & 0xFF) * 257;
+            const hqx::wide_image wide = { channels.data(), width, width, height };
+
+            typedef void (*wide_classifier)(const hqx::wide_image&, int, int, uint16_t*, uint32_t*);
+            const struct
+            {
+                const char* name;
+                wide_classifier classify;
+                bool avx2;
+            } wide_classifiers[] = {
+                { "wide reference", [](const hqx::wide_image& src, int y0, int y1, uint16_t* index, uint32_t*) {
+                    hqx::classify_wide_reference(src, y0, y1, index);
+                }, false },
+                { "wide swar", hqx::classify_wide_swar, false },
+#if defined(HQX_HAVE_AVX2)
+                { "wide avx2", hqx::classify_wide_avx2, true }
+#endif
+            };
+
+            for (const auto& c : wide_classifiers)
+            {
+                if (c.avx2 && !hqx::cpu_has_avx2())
+                    continue;
+
+                double ms = measure([&] { c.classify(wide, 0, height, index.data(), window.data()); });
+                report(image.name, c.name, ms);
+
+                if (index != expected)
+                {
+                    printf("%s: index map differs from the 8-bit reference\n", c.name);
+                    failures++;
+                }
+            }
+
+            const struct
+            {
+                const char* name;
+                hqx::blend_kernel kernel;
+                bool supported;
+            } wide_kernels[] = {
+                { "scalar", hqx::kernel_scalar, true },
+                { "swar", hqx::kernel_swar, true },
+                { "avx2", hqx::kernel_avx2, hqx::cpu_has_avx2() },
+                { "avx512", hqx::kernel_avx512, hqx::cpu_has_avx512() }
+            };
+
+            for (int scale = 2; scale <= 4; scale++)
+            {
+                std::vector<uint16_t> output(channels.size() * scale * scale), scalar(output.size());
+                for (const auto& k : wide_kernels)
+                {
+                    if (!k.supported)
+                        continue;
+
+                    char name[32];
+                    snprintf(name, sizeof(name), "wide blend %dx %s", scale, k.name);
+                    double ms = measure([&] {
+                        hqx::blend_wide_with(k.kernel, hqx::get_lut(scale), wide, 0, height, expected.data(),
+                                             output.data(), width * scale);
+                    });
+                    report(image.name, name, ms);
+
+                    if (k.kernel == hqx::kernel_scalar)
+                        scalar = output;
+                    else if (output != scalar)
+                    {
+                        printf("wide blend %s: output differs from the scalar blend\n", k.name);
+                        failures++;
+                    }
+                }
+            }
+        }
+
+        for (int scale = 2; scale <= 4; scale++)
+        {
+            const hqx::lut& table = hqx::get_lut(scale);
+            std::vector<uint32_t> output(width * scale * height * scale);
+
+            // The scalar look-ups against the vector kernels with gathers
+            const struct
+            {
+                const char* name;
+                hqx::blend_kernel kernel;
+                bool supported;
+            } kernels[] = {
+                { "scalar", hqx::kernel_scalar, true },
+                { "swar", hqx::kernel_swar, true },
+                { "avx2", hqx::kernel_avx2, hqx::cpu_has_avx2() },
+                { "avx512", hqx::kernel_avx512, hqx::cpu_has_avx512() }
+            };
+
+            std::vector<uint32_t> scalar(output.size());
+            for (const auto& k : kernels)
+            {
+                if (!k.supported)
+                    continue;
+
+                char name[32];
+                snprintf(name, sizeof(name), "blend %dx %s", scale, k.name);
+                double ms = measure([&] {
+                    hqx::blend_columns_with(k.kernel, table, src, 0, height, 0, width, expected.data(), output.data(),
+                                            width * scale, false);
+                });
+                report(image.name, name, ms);
+
+                if (k.kernel == hqx::kernel_scalar)
+                    scalar = output;
+                else if (output != scalar)
+                {
+                    printf("blend %s: output differs from the scalar blend\n", k.name);
+                    failures++;
+                }
+            }
+
+            // Streaming stores skip reading the output lines before they're
+            // overwritten, which pays off once the output leaves the cache
+            char name[32];
+            snprintf(name, sizeof(name), "blend %dx streaming", scale);
+            double ms = measure([&] {
+                hqx::blend(table, src, 0, height, expected.data(), output.data(), width * scale, true);
+            });
+            report(image.name, name, ms);
+
+            if (output != scalar)
+            {
+                printf("blend %dx streaming: output differs from the scalar blend\n", scale);
+                failures++;
+            }
+
+            // The blend in linear light against the scalar blend on the
+            // encoded values, YUV isn't converted. The 12-bit tables may be
+            // one step off the exact curves.
+            if (image.channels != hqx::order_yuv)
+            {
+                snprintf(name, sizeof(name), "blend %dx linear", scale);
+                ms = measure([&] {
+                    hqx::blend_columns_with(hqx::kernel_linear, table, src, 0, height, 0, width, expected.data(),
+                                            output.data(), width * scale, false);
+                });
+                report(image.name, name, ms);
+
+                const int error = linear_blend_error(table, src, expected.data(), output.data());
+                if (error > 1)
+                {
+                    printf("blend linear: output is %d steps off the exact curves\n", error);
+                    failures++;
+                }
+            }
+
+            // The whole upscale with each strategy, the two passes go
+            // through bands of 16 rows like libhqx
+            std::vector<uint32_t> two_pass(output.size());
+            ms = measure([&] {
+                for (int y0 = 0; y0 < height; y0 += 16)
+                {
+                    hqx::classify(src, y0, y0 + 16, index.data(), window.data());
+                    hqx::blend(table, src, y0, y0 + 16, index.data(), &two_pass[y0 * scale * width * scale],
+                               width * scale);
+                }
+            });
+            snprintf(name, sizeof(name), "two-pass %dx", scale);
+            report(image.name, name, ms);
+
+            ms = measure([&] {
+                hqx::upscale_single_pass(table, src, 0, height, 0, width, output.data(), width * scale, false);
+            });
+            snprintf(name, sizeof(name), "single pass %dx", scale);
+            report(image.name, name, ms);
+            if (output != two_pass)
+            {
+                printf("%s: single pass %dx differs from the two passes\n", image.name, scale);
+                failures++;
+            }
+
+            ms = measure([&] {
+                hqx::upscale_fused(table, src, 0, height, 0, width, window.data(), output.data(), width * scale,
+                                   false);
+            });
+            snprintf(name, sizeof(name), "fused %dx", scale);
+            report(image.name, name, ms);
+            if (output != two_pass)
+            {
+                printf("%s: fused %dx differs from the two passes\n", image.name, scale);
+                failures++;
+            }
+        }
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
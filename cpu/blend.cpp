@@ -0,0 +1,407 @@
+/* blend.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "engine.h"
+#include "blend.h"
+#include "classify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HQX_HAVE_STREAM
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace hqx
+{
+
+// Weighted average of four pixels, the weights in w add up to 16. All four
+// channels are interpolated two at a time in the 16-bit halves of a word.
+static inline uint32_t interpolate(uint32_t w, uint32_t p1, uint32_t p2, uint32_t p3, uint32_t p4)
+{
+    const uint32_t mask = 0x00FF00FF;
+    uint32_t w1 = w & 0xFF, w2 = w >> 8 & 0xFF, w3 = w >> 16 & 0xFF, w4 = w >> 24;
+
+    uint32_t rb = (p1 & mask) * w1 + (p2 & mask) * w2 + (p3 & mask) * w3 + (p4 & mask) * w4;
+    uint32_t ga = (p1 >> 8 & mask) * w1 + (p2 >> 8 & mask) * w2 + (p3 >> 8 & mask) * w3 + (p4 >> 8 & mask) * w4;
+
+    // Round to nearest like the conversion to an 8-bit render target
+    rb = (rb + 0x00080008) >> 4 & mask;
+    ga = (ga + 0x00080008) >> 4 & mask;
+    return rb | ga << 8;
+}
+
+// Converts sRGB channels to linear light in 12 bits and back. The sums of the
+// weighted channels still fit in 16 bits, and every channel converts back to
+// itself so a pixel blended with its own colour stays the same.
+struct srgb_tables
+{
+    uint16_t to_linear[256];
+    uint8_t to_srgb[4096];
+
+    srgb_tables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            double c = i / 255.0;
+            c = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+            to_linear[i] = (uint16_t)std::lround(c * 4095.0);
+        }
+        for (int i = 0; i < 4096; i++)
+        {
+            double c = i / 4095.0;
+            c = c <= 0.0031308 ? c * 12.92 : 1.055 * std::pow(c, 1 / 2.4) - 0.055;
+            to_srgb[i] = (uint8_t)std::lround(c * 255.0);
+        }
+    }
+};
+
+static const srgb_tables& get_srgb_tables()
+{
+    static const srgb_tables tables;
+    return tables;
+}
+
+// interpolate() in linear light, alpha is interpolated as it is
+static inline uint32_t interpolate_linear(const srgb_tables& t, uint32_t w, uint32_t p1, uint32_t p2, uint32_t p3,
+                                          uint32_t p4)
+{
+    uint32_t w1 = w & 0xFF, w2 = w >> 8 & 0xFF, w3 = w >> 16 & 0xFF, w4 = w >> 24;
+
+    uint32_t result = ((p1 >> 24) * w1 + (p2 >> 24) * w2 + (p3 >> 24) * w3 + (p4 >> 24) * w4 + 8) >> 4 << 24;
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+        uint32_t sum = t.to_linear[p1 >> shift & 0xFF] * w1 + t.to_linear[p2 >> shift & 0xFF] * w2 +
+                       t.to_linear[p3 >> shift & 0xFF] * w3 + t.to_linear[p4 >> shift & 0xFF] * w4;
+        result |= (uint32_t)t.to_srgb[(sum + 8) >> 4] << shift;
+    }
+    return result;
+}
+
+// interpolate() for pixels of four 16-bit channels, two at a time in the
+// 32-bit halves of a 64-bit word
+static inline uint64_t interpolate_wide(uint32_t w, uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4)
+{
+    const uint64_t mask = 0x0000FFFF0000FFFFull;
+    uint64_t w1 = w & 0xFF, w2 = w >> 8 & 0xFF, w3 = w >> 16 & 0xFF, w4 = w >> 24;
+
+    uint64_t low = (p1 & mask) * w1 + (p2 & mask) * w2 + (p3 & mask) * w3 + (p4 & mask) * w4;
+    uint64_t high = (p1 >> 16 & mask) * w1 + (p2 >> 16 & mask) * w2 + (p3 >> 16 & mask) * w3 + (p4 >> 16 & mask) * w4;
+
+    low = (low + 0x0000000800000008ull) >> 4 & mask;
+    high = (high + 0x0000000800000008ull) >> 4 & mask;
+    return low | high << 16;
+}
+
+static inline uint64_t wide_pixel(const uint16_t* row, int x)
+{
+    uint64_t pixel;
+    memcpy(&pixel, row + 4 * x, sizeof(pixel));
+    return pixel;
+}
+
+// Upscales the pixel x of the middle row into SCALE rows of SCALE pixels
+template <bool LINEAR>
+static inline void blend_pixel(int scale, const uint32_t* weights, const uint32_t* const row[3], const int column[3],
+                               int x, uint32_t* out, ptrdiff_t out_stride)
+{
+    const srgb_tables* tables = LINEAR ? &get_srgb_tables() : nullptr;
+
+    for (int sy = 0; sy < scale; sy++, out += out_stride)
+    {
+        int qy = quadrant(sy, scale);
+
+        for (int sx = 0; sx < scale; sx++)
+        {
+            int qx = quadrant(sx, scale);
+
+            uint32_t p1 = row[1][x];
+            uint32_t p2 = row[qy][column[qx]];
+            uint32_t p3 = row[1][column[qx]];
+            uint32_t p4 = row[qy][x];
+            out[sx] = LINEAR ? interpolate_linear(*tables, weights[sy * scale + sx], p1, p2, p3, p4)
+                             : interpolate(weights[sy * scale + sx], p1, p2, p3, p4);
+        }
+    }
+}
+
+// blend_pixel for pixels of four 16-bit channels
+static inline void blend_wide_pixel(int scale, const uint32_t* weights, const uint16_t* const row[3],
+                                    const int column[3], int x, uint16_t* out, ptrdiff_t out_stride)
+{
+    for (int sy = 0; sy < scale; sy++, out += 4 * out_stride)
+    {
+        int qy = quadrant(sy, scale);
+
+        for (int sx = 0; sx < scale; sx++)
+        {
+            int qx = quadrant(sx, scale);
+
+            uint64_t p1 = wide_pixel(row[1], x);
+            uint64_t p2 = wide_pixel(row[qy], column[qx]);
+            uint64_t p3 = wide_pixel(row[1], column[qx]);
+            uint64_t p4 = wide_pixel(row[qy], x);
+            uint64_t value = interpolate_wide(weights[sy * scale + sx], p1, p2, p3, p4);
+            memcpy(out + 4 * sx, &value, sizeof(value));
+        }
+    }
+}
+
+// Copies count pixels, the cache lines that lie entirely in dst are written
+// with non-temporal stores. The partly covered lines at either end are stored
+// normally, so no line is written with both kinds of stores by this and the
+// neighbouring copies.
+static inline void stream_row(uint32_t* dst, const uint32_t* src, int count)
+{
+#if defined(HQX_HAVE_STREAM)
+    const int line = 16;
+    int i = 0;
+    for (; i < count && ((uintptr_t)(dst + i) & 63); i++)
+        dst[i] = src[i];
+    for (; i + line <= count; i += line)
+    {
+        for (int j = 0; j < line; j += 4)
+            _mm_stream_si128((__m128i*)(dst + i + j), _mm_loadu_si128((const __m128i*)(src + i + j)));
+    }
+    for (; i < count; i++)
+        dst[i] = src[i];
+#else
+    memcpy(dst, src, count * sizeof(uint32_t));
+#endif
+}
+
+// Blends a span of a row with a vector kernel, returns x when there's none
+static inline int blend_span(blend_kernel kernel, const lut& table, const uint32_t* const row[3],
+                             const uint16_t* index, int x, int x1, int width, uint32_t* out, ptrdiff_t out_stride)
+{
+#if defined(HQX_HAVE_AVX2)
+    if (kernel == kernel_avx512)
+        return blend_span_avx512(table, row, index, x, x1, width, out, out_stride);
+    if (kernel == kernel_avx2)
+        return blend_span_avx2(table, row, index, x, x1, width, out, out_stride);
+#endif
+    if (kernel == kernel_swar)
+        return blend_span_swar(table, row, index, x, x1, width, out, out_stride);
+    return x;
+}
+
+static inline int blend_span_wide(blend_kernel kernel, const lut& table, const uint16_t* const row[3],
+                                  const uint16_t* index, int x, int x1, int width, uint16_t* out, ptrdiff_t out_stride)
+{
+#if defined(HQX_HAVE_AVX2)
+    if (kernel == kernel_avx512)
+        return blend_span_wide_avx512(table, row, index, x, x1, width, out, out_stride);
+    if (kernel == kernel_avx2)
+        return blend_span_wide_avx2(table, row, index, x, x1, width, out, out_stride);
+#endif
+    if (kernel == kernel_swar)
+        return blend_span_wide_swar(table, row, index, x, x1, width, out, out_stride);
+    return x;
+}
+
+// Blends the columns [x0, x1) of the rows [y0, y1) with their index map,
+// which holds rows of width entries. Without an index map every pixel is
+// classified right before it's blended. The streamed output isn't fenced.
+static void blend_rows(blend_kernel kernel, const lut& table, const image& src, int y0, int y1, int x0, int x1,
+                       const uint16_t* index, uint32_t* dst, ptrdiff_t dst_stride, bool stream)
+{
+    const int scale = table.scale;
+    const int width = src.width;
+
+    // The output of this many source pixels is at least 8 cache lines wide
+    // and all SCALE rows of it stay in the L1 cache
+    const int chunk = 32;
+    uint32_t staging[4 * chunk * 4];
+    const bool linear = kernel == kernel_linear;
+
+    for (int y = y0; y < y1; y++)
+    {
+        const uint32_t* row[3] = {
+            src.row(std::max(y - 1, 0)),
+            src.row(y),
+            src.row(std::min(y + 1, src.height - 1))
+        };
+        const uint16_t* row_index = index ? index + (y - y0) * width : nullptr;
+
+        // Blends the pixels [x, end) to out, the vector kernels take the
+        // pixels they can and the rest are blended one at a time
+        auto blend_run = [&](int x, int end, uint32_t* out, ptrdiff_t out_stride) {
+            for (const int start = x; x < end;)
+            {
+                const int next = row_index && x > 0 ? blend_span(kernel, table, row, row_index, x, end, width,
+                                                                 out + (x - start) * scale, out_stride) : x;
+                if (next > x)
+                {
+                    x = next;
+                    continue;
+                }
+
+                const int column[3] = { std::max(x - 1, 0), x, std::min(x + 1, width - 1) };
+                const int entry = row_index ? row_index[x] : classify_pixel(row, column[0], x, column[2], src.channels);
+                const uint32_t* weights = table.weights + entry * scale * scale;
+                if (linear)
+                    blend_pixel<true>(scale, weights, row, column, x, out + (x - start) * scale, out_stride);
+                else
+                    blend_pixel<false>(scale, weights, row, column, x, out + (x - start) * scale, out_stride);
+                x++;
+            }
+        };
+
+        uint32_t* out = dst + (y - y0) * scale * dst_stride;
+        if (!stream)
+        {
+            blend_run(x0, x1, out, dst_stride);
+            continue;
+        }
+
+        // The first chunk is cut short so the others start on a cache line
+        // of the first output row, where the pixels allow it
+        int first = chunk;
+        for (int n = 1; n < chunk && ((uintptr_t)out & 63); n++)
+        {
+            if (!((uintptr_t)(out + n * scale) & 63))
+            {
+                first = n;
+                break;
+            }
+        }
+
+        for (int c0 = x0, c1; c0 < x1; c0 = c1)
+        {
+            c1 = std::min(c0 + (c0 == x0 ? first : chunk), x1);
+            blend_run(c0, c1, staging, chunk * scale);
+            for (int sy = 0; sy < scale; sy++)
+                stream_row(out + sy * dst_stride + (c0 - x0) * scale, staging + sy * chunk * scale, (c1 - c0) * scale);
+        }
+    }
+}
+
+// Later loads of the output must see the streamed stores
+static inline void fence(bool stream)
+{
+#if defined(HQX_HAVE_STREAM)
+    if (stream)
+        _mm_sfence();
+#endif
+}
+
+blend_kernel best_blend_kernel()
+{
+    static const blend_kernel kernel = cpu_has_avx512() ? kernel_avx512 : cpu_has_avx2() ? kernel_avx2 : kernel_scalar;
+    return kernel;
+}
+
+void blend_columns_with(blend_kernel kernel, const lut& table, const image& src, int y0, int y1, int x0, int x1,
+                        const uint16_t* index, uint32_t* dst, ptrdiff_t dst_stride, bool stream)
+{
+    blend_rows(kernel, table, src, y0, y1, x0, x1, index, dst, dst_stride, stream);
+    fence(stream);
+}
+
+void blend_columns(const lut& table, const image& src, int y0, int y1, int x0, int x1, const uint16_t* index,
+                   uint32_t* dst, ptrdiff_t dst_stride, bool stream)
+{
+    blend_columns_with(best_blend_kernel(), table, src, y0, y1, x0, x1, index, dst, dst_stride, stream);
+}
+
+void blend_wide_with(blend_kernel kernel, const lut& table, const wide_image& src, int y0, int y1,
+                     const uint16_t* index, uint16_t* dst, ptrdiff_t dst_stride)
+{
+    const int scale = table.scale;
+    const int width = src.width;
+
+    for (int y = y0; y < y1; y++)
+    {
+        const uint16_t* row[3] = {
+            src.row(std::max(y - 1, 0)),
+            src.row(y),
+            src.row(std::min(y + 1, src.height - 1))
+        };
+        const uint16_t* row_index = index + (y - y0) * width;
+        uint16_t* out = dst + (y - y0) * scale * dst_stride * 4;
+
+        for (int x = 0; x < width;)
+        {
+            const int next = x > 0 ? blend_span_wide(kernel, table, row, row_index, x, width, width,
+                                                     out + 4 * x * scale, dst_stride) : x;
+            if (next > x)
+            {
+                x = next;
+                continue;
+            }
+
+            const int column[3] = { std::max(x - 1, 0), x, std::min(x + 1, width - 1) };
+            blend_wide_pixel(scale, table.weights + row_index[x] * scale * scale, row, column, x,
+                             out + 4 * x * scale, dst_stride);
+            x++;
+        }
+    }
+}
+
+void blend_wide(const lut& table, const wide_image& src, int y0, int y1, const uint16_t* index, uint16_t* dst,
+                ptrdiff_t dst_stride)
+{
+    blend_wide_with(best_blend_kernel(), table, src, y0, y1, index, dst, dst_stride);
+}
+
+void upscale_single_pass(const lut& table, const image& src, int y0, int y1, int x0, int x1, uint32_t* dst,
+                         ptrdiff_t dst_stride, bool stream)
+{
+    blend_rows(kernel_scalar, table, src, y0, y1, x0, x1, nullptr, dst, dst_stride, stream);
+    fence(stream);
+}
+
+void upscale_fused(const lut& table, const image& src, int y0, int y1, int x0, int x1, uint32_t* window,
+                   uint32_t* dst, ptrdiff_t dst_stride, bool stream)
+{
+    const int scale = table.scale;
+    uint16_t index[fused_rows * (fused_columns + 2)];
+
+    for (int r0 = y0; r0 < y1; r0 += fused_rows)
+    {
+        const int r1 = std::min(r0 + fused_rows, y1);
+        for (int c0 = x0; c0 < x1; c0 += fused_columns)
+        {
+            // The tile is classified with a column on either side, like
+            // whole rows would be
+            const int c1 = std::min(c0 + fused_columns, x1);
+            const int left = std::max(c0 - 1, 0), right = std::min(c1 + 1, src.width);
+            image tile = src;
+            tile.pixels += left;
+            tile.width = right - left;
+
+            classify(tile, r0, r1, index, window);
+            blend_rows(best_blend_kernel(), table, tile, r0, r1, c0 - left, c1 - left, index,
+                       dst + (r0 - y0) * scale * dst_stride + (c0 - x0) * scale, dst_stride, stream);
+        }
+    }
+    fence(stream);
+}
+
+size_t llc_size()
+{
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+    const int levels[] = { _SC_LEVEL3_CACHE_SIZE, _SC_LEVEL2_CACHE_SIZE };
+    for (int level : levels)
+    {
+        long size = sysconf(level);
+        if (size > 0)
+            return size;
+    }
+#endif
+    return 8 << 20;
+}
+
+}
@@ -0,0 +1,256 @@
+/* blend.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#pragma once
+
+#include "engine.h"
+
+#include <algorithm>
+
+// The vector blend kernel is written against a backend of simd.h, so like
+// the backends everything here is local to the source file that includes it
+namespace hqx
+{
+
+namespace
+{
+
+// The quadrant of a subpixel along one axis: 0 and 2 for the first and last
+// half, 1 for the middle row and column of hq3x which have no quadrant
+inline int quadrant(int subpixel, int scale)
+{
+    return 1 + (2 * subpixel + 1 > scale) - (2 * subpixel + 1 < scale);
+}
+
+// The vector kernels blend groups of LANES source pixels into SCALE vectors
+// per output row, vector v holds the subpixels LANES * v to LANES * (v + 1)
+// of the group. For every lane this stores the pixel in the group, the
+// column of its subpixel and whether the neighbour of that subpixel is the
+// pixel to the left or the right.
+template <int LANES>
+struct span_lanes
+{
+    int32_t pixel[4][LANES];
+    int32_t subpixel[4][LANES];
+    int32_t left[4][LANES];
+    int32_t right[4][LANES];
+
+    explicit span_lanes(int scale)
+    {
+        for (int v = 0; v < scale; v++)
+        {
+            for (int lane = 0; lane < LANES; lane++)
+            {
+                const int output = v * LANES + lane, column = output % scale;
+                pixel[v][lane] = output / scale;
+                subpixel[v][lane] = column;
+                left[v][lane] = quadrant(column, scale) == 0 ? -1 : 0;
+                right[v][lane] = quadrant(column, scale) == 2 ? -1 : 0;
+            }
+        }
+    }
+};
+
+template <int LANES>
+const span_lanes<LANES>& get_span_lanes(int scale)
+{
+    static const span_lanes<LANES> lanes[3] = { span_lanes<LANES>(2), span_lanes<LANES>(3), span_lanes<LANES>(4) };
+    return lanes[scale - 2];
+}
+
+// The lanes of the wide kernels, where every pixel of four 16-bit channels
+// takes two 32-bit lanes. Groups of LANES / 2 source pixels are blended into
+// SCALE vectors of LANES / 2 output pixels per output row. For every lane
+// this stores the 32-bit word of the group that the lane is taken from, the
+// pixel in the group whose index entry it uses and, like span_lanes, the
+// column of the subpixel and the side of its neighbour.
+template <int LANES>
+struct wide_span_lanes
+{
+    int32_t word[4][LANES];
+    int32_t pixel[4][LANES];
+    int32_t subpixel[4][LANES];
+    int32_t left[4][LANES];
+    int32_t right[4][LANES];
+
+    explicit wide_span_lanes(int scale)
+    {
+        for (int v = 0; v < scale; v++)
+        {
+            for (int lane = 0; lane < LANES; lane++)
+            {
+                const int output = v * LANES / 2 + lane / 2, column = output % scale;
+                pixel[v][lane] = output / scale;
+                word[v][lane] = 2 * pixel[v][lane] + lane % 2;
+                subpixel[v][lane] = column;
+                left[v][lane] = quadrant(column, scale) == 0 ? -1 : 0;
+                right[v][lane] = quadrant(column, scale) == 2 ? -1 : 0;
+            }
+        }
+    }
+};
+
+template <int LANES>
+const wide_span_lanes<LANES>& get_wide_span_lanes(int scale)
+{
+    static const wide_span_lanes<LANES> lanes[3] = { wide_span_lanes<LANES>(2), wide_span_lanes<LANES>(3),
+                                                     wide_span_lanes<LANES>(4) };
+    return lanes[scale - 2];
+}
+
+// Blends a vector of subpixels with the weights in w, the channels are
+// interpolated in 16-bit lanes like interpolate() so the rounding is the same
+template <class S>
+typename S::vec interpolate_lanes(typename S::vec w, const typename S::vec p[4])
+{
+    typedef typename S::vec vec;
+    const vec mask = S::set1(0x00FF00FF);
+    vec rb = S::zero(), ga = S::zero();
+    for (int k = 0; k < 4; k++)
+    {
+        vec wk = S::spread_byte(w, k);
+        rb = S::add16(rb, S::mullo16(S::bit_and(p[k], mask), wk));
+        ga = S::add16(ga, S::mullo16(S::bit_and(S::srl32(p[k], 8), mask), wk));
+    }
+
+    // The sums are at most 16 * 255, so after rounding every 16-bit lane
+    // holds one channel
+    const vec half = S::set1(0x00080008);
+    rb = S::srl16(S::add16(rb, half), 4);
+    ga = S::srl16(S::add16(ga, half), 4);
+    return S::bit_or(rb, S::sll16(ga, 8));
+}
+
+// Picks the pixel of every lane from the pixels around it: the one left of
+// it, the pixel itself or the one right of it
+template <class S>
+typename S::vec neighbours(const typename S::vec around[3], typename S::vec pixel, typename S::mask left,
+                           typename S::mask right)
+{
+    typename S::vec p = S::permute(around[1], pixel);
+    p = S::select(p, S::permute(around[0], pixel), left);
+    return S::select(p, S::permute(around[2], pixel), right);
+}
+
+// The vector kernel declared in engine.h as blend_span_avx2 and the others
+template <class S>
+int blend_span_lanes(const lut& table, const uint32_t* const row[3], const uint16_t* index, int x, int x1,
+                     int width, uint32_t* out, ptrdiff_t out_stride)
+{
+    typedef typename S::vec vec;
+    const int scale = table.scale;
+    const span_lanes<S::lanes>& lanes = get_span_lanes<S::lanes>(scale);
+    const vec area = S::set1(scale * scale);
+
+    const int start = x;
+    for (; x + S::lanes <= x1 && x + S::lanes < width; x += S::lanes)
+    {
+        // The source rows from one pixel left to one pixel right of the group
+        vec around[3][3];
+        for (int r = 0; r < 3; r++)
+            for (int d = 0; d < 3; d++)
+                around[r][d] = S::load(row[r] + x - 1 + d);
+        const vec first = S::mullo32(S::load_u16(index + x), area);
+
+        // Every vector holds consecutive subpixels of an output row
+        for (int v = 0; v < scale; v++)
+        {
+            const vec pixel = S::load(lanes.pixel[v]);
+            const typename S::mask left = S::to_mask(S::load(lanes.left[v]));
+            const typename S::mask right = S::to_mask(S::load(lanes.right[v]));
+            const vec entry = S::add32(S::permute(first, pixel), S::load(lanes.subpixel[v]));
+
+            vec p[4];
+            p[0] = S::permute(around[1][1], pixel);
+            p[2] = neighbours<S>(around[1], pixel, left, right);
+            for (int sy = 0; sy < scale; sy++)
+            {
+                const int qy = quadrant(sy, scale);
+                p[1] = neighbours<S>(around[qy], pixel, left, right);
+                p[3] = S::permute(around[qy][1], pixel);
+
+                vec w = S::gather(table.weights, S::add32(entry, S::set1(sy * scale)));
+                S::store(out + sy * out_stride + (x - start) * scale + v * S::lanes, interpolate_lanes<S>(w, p));
+            }
+        }
+    }
+    return x;
+}
+
+// interpolate_lanes for pixels of 16-bit channels, where each 32-bit lane
+// holds two channels and their sums need 21 bits each
+template <class S>
+typename S::vec interpolate_wide_lanes(typename S::vec w, const typename S::vec p[4])
+{
+    typedef typename S::vec vec;
+    const vec low = S::set1(0xFFFF), byte = S::set1(0xFF);
+    vec lo = S::zero(), hi = S::zero();
+    for (int k = 0; k < 4; k++)
+    {
+        vec wk = S::bit_and(S::srl32(w, 8 * k), byte);
+        lo = S::add32(lo, S::mullo32(S::bit_and(p[k], low), wk));
+        hi = S::add32(hi, S::mullo32(S::srl32(p[k], 16), wk));
+    }
+
+    const vec half = S::set1(8);
+    lo = S::srl32(S::add32(lo, half), 4);
+    hi = S::srl32(S::add32(hi, half), 4);
+    return S::bit_or(lo, S::sll32(hi, 16));
+}
+
+// The vector kernel declared in engine.h as blend_span_wide_avx2 and the
+// others. The index entries of a group are loaded as a full vector, so the
+// group stops a vector of pixels before the end of the row.
+template <class S>
+int blend_span_wide_lanes(const lut& table, const uint16_t* const row[3], const uint16_t* index, int x, int x1,
+                          int width, uint16_t* out, ptrdiff_t out_stride)
+{
+    typedef typename S::vec vec;
+    enum { pixels = S::lanes / 2 };
+    const int scale = table.scale;
+    const wide_span_lanes<S::lanes>& lanes = get_wide_span_lanes<S::lanes>(scale);
+    const vec area = S::set1(scale * scale);
+
+    const int start = x;
+    for (; x + pixels <= x1 && x + S::lanes < width; x += pixels)
+    {
+        vec around[3][3];
+        for (int r = 0; r < 3; r++)
+            for (int d = 0; d < 3; d++)
+                around[r][d] = S::load(row[r] + 4 * (x - 1 + d));
+        const vec first = S::mullo32(S::load_u16(index + x), area);
+
+        for (int v = 0; v < scale; v++)
+        {
+            const vec word = S::load(lanes.word[v]);
+            const typename S::mask left = S::to_mask(S::load(lanes.left[v]));
+            const typename S::mask right = S::to_mask(S::load(lanes.right[v]));
+            const vec entry = S::add32(S::permute(first, S::load(lanes.pixel[v])), S::load(lanes.subpixel[v]));
+
+            vec p[4];
+            p[0] = S::permute(around[1][1], word);
+            p[2] = neighbours<S>(around[1], word, left, right);
+            for (int sy = 0; sy < scale; sy++)
+            {
+                const int qy = quadrant(sy, scale);
+                p[1] = neighbours<S>(around[qy], word, left, right);
+                p[3] = S::permute(around[qy][1], word);
+
+                vec w = S::gather(table.weights, S::add32(entry, S::set1(sy * scale)));
+                S::store(out + 4 * (sy * out_stride + (x - start) * scale + v * pixels),
+                         interpolate_wide_lanes<S>(w, p));
+            }
+        }
+    }
+    return x;
+}
+
+}
+
+}
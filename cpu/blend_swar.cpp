@@ -0,0 +1,29 @@
+/* blend_swar.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "engine.h"
+#include "blend.h"
+#include "simd.h"
+
+namespace hqx
+{
+
+int blend_span_swar(const lut& table, const uint32_t* const row[3], const uint16_t* index, int x, int x1,
+                    int width, uint32_t* out, ptrdiff_t out_stride)
+{
+    return blend_span_lanes<vec_swar>(table, row, index, x, x1, width, out, out_stride);
+}
+
+int blend_span_wide_swar(const lut& table, const uint16_t* const row[3], const uint16_t* index, int x, int x1,
+                         int width, uint16_t* out, ptrdiff_t out_stride)
+{
+    return blend_span_wide_lanes<vec_swar>(table, row, index, x, x1, width, out, out_stride);
+}
+
+}
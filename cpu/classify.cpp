@@ -0,0 +1,143 @@
+/* classify.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "engine.h"
+#include "classify.h"
+
+#include <algorithm>
+
+#if defined(_MSC_VER) && defined(HQX_HAVE_AVX2)
+#include <intrin.h>
+#endif
+
+namespace hqx
+{
+
+// Three padded rows, or two planes of them for 16-bit channels
+size_t window_size(int width)
+{
+    return 6 * (width + 2 * row_padding);
+}
+
+void classify_reference(const image& src, int y0, int y1, uint16_t* index)
+{
+    const int width = src.width;
+    const order channels = src.channels;
+
+    for (int y = y0; y < y1; y++)
+    {
+        const uint32_t* row[3] = {
+            src.row(std::max(y - 1, 0)),
+            src.row(y),
+            src.row(std::min(y + 1, src.height - 1))
+        };
+
+        for (int x = 0; x < width; x++)
+            index[(y - y0) * width + x] = classify_pixel(row, std::max(x - 1, 0), x, std::min(x + 1, width - 1), channels);
+    }
+}
+
+bool cpu_has_avx2()
+{
+#if !defined(HQX_HAVE_AVX2)
+    return false;
+#elif defined(_MSC_VER)
+    // The AVX2 kernels also use the BMI1 and POPCNT instructions
+    int info[4];
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0 && (info[1] & (1 << 3)) != 0;
+    __cpuidex(info, 1, 0);
+    bool osxsave = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 23)) != 0;
+    return avx2 && osxsave && (_xgetbv(0) & 6) == 6;
+#else
+    // The AVX2 kernels also use the BMI1 and POPCNT instructions
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("popcnt");
+#endif
+}
+
+bool cpu_has_avx512()
+{
+#if !defined(HQX_HAVE_AVX2)
+    return false;
+#elif defined(_MSC_VER)
+    // The blend kernel needs AVX-512F and the 16-bit instructions of BW, and
+    // the operating system must save the ZMM registers
+    int info[4];
+    __cpuidex(info, 7, 0);
+    bool avx512 = (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+    __cpuidex(info, 1, 0);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    return avx512 && osxsave && (_xgetbv(0) & 0xE6) == 0xE6;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+}
+
+void classify(const image& src, int y0, int y1, uint16_t* index, uint32_t* window)
+{
+#if defined(HQX_HAVE_AVX2)
+    static const bool avx2 = cpu_has_avx2();
+    if (avx2)
+        return classify_avx2_equal_first(src, y0, y1, index, window);
+#endif
+    classify_bitsliced(src, y0, y1, index, window);
+}
+
+void classify_wide_reference(const wide_image& src, int y0, int y1, uint16_t* index)
+{
+    const int width = src.width;
+
+    for (int y = y0; y < y1; y++)
+    {
+        const uint16_t* row[3] = {
+            src.row(std::max(y - 1, 0)),
+            src.row(y),
+            src.row(std::min(y + 1, src.height - 1))
+        };
+
+        for (int x = 0; x < width; x++)
+            index[(y - y0) * width + x] = classify_wide_pixel(row, std::max(x - 1, 0), x, std::min(x + 1, width - 1));
+    }
+}
+
+void classify_wide(const wide_image& src, int y0, int y1, uint16_t* index, uint32_t* window)
+{
+#if defined(HQX_HAVE_AVX2)
+    static const bool avx2 = cpu_has_avx2();
+    if (avx2)
+        return classify_wide_avx2(src, y0, y1, index, window);
+#endif
+    classify_wide_reference(src, y0, y1, index);
+    (void)window;
+}
+
+int compare_row_reference(const uint32_t* row, const uint32_t* last, int width, uint8_t* changed)
+{
+    int count = 0;
+    for (int x = 0; x < width; x++)
+    {
+        changed[x] = row[x] != last[x];
+        count += changed[x];
+    }
+    return count;
+}
+
+int compare_row(const uint32_t* row, const uint32_t* last, int width, uint8_t* changed)
+{
+#if defined(HQX_HAVE_AVX2)
+    static const bool avx2 = cpu_has_avx2();
+    if (avx2)
+        return compare_row_avx2(row, last, width, changed);
+#endif
+    return compare_row_reference(row, last, width, changed);
+}
+
+}
@@ -0,0 +1,132 @@
+/* classify.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#pragma once
+
+#include "engine.h"
+
+#include <cstdint>
+
+namespace hqx
+{
+
+// The YUV matrix and thresholds of pass1.cg scaled by 1000 so the comparison
+// can be done exactly in integers. Only the difference of two colours is
+// needed, which means the offset of U and V cancels out.
+enum
+{
+    threshold_y = 48 * 1000,
+    threshold_u = 7 * 1000,
+    threshold_v = 6 * 1000
+};
+
+// The AVX2 classifiers keep three source rows with this much padding on both
+// sides, which leaves room to read the neighbours of a full vector at the end
+static const int row_padding = 1 + 8;
+
+// Weights that give the same comparisons for limited range YUV, where a step
+// of Y is 255/219 and a step of U or V 255/224 of a step in pass1.cg. They
+// are rounded so the thresholds fall between the same integer differences.
+enum
+{
+    limited_y = 1164,
+    limited_uv = 1139
+};
+
+// Alpha is not part of the comparison
+static const uint32_t rgb_mask = 0x00FFFFFF;
+
+inline bool diff(uint32_t c1, uint32_t c2, order channels)
+{
+    int low = (int)(c1 & 0xFF) - (int)(c2 & 0xFF);
+    int g = (int)(c1 >> 8 & 0xFF) - (int)(c2 >> 8 & 0xFF);
+    int high = (int)(c1 >> 16 & 0xFF) - (int)(c2 >> 16 & 0xFF);
+
+    int y, u, v;
+    if (channels == order_yuv)
+    {
+        y = limited_y * low;
+        u = limited_uv * g;
+        v = limited_uv * high;
+    }
+    else
+    {
+        int r = channels == order_rgba ? low : high;
+        int b = channels == order_rgba ? high : low;
+
+        y = 299 * r + 587 * g + 114 * b;
+        u = -169 * r - 331 * g + 500 * b;
+        v = 500 * r - 419 * g - 81 * b;
+    }
+    return y > threshold_y || y < -threshold_y ||
+           u > threshold_u || u < -threshold_u ||
+           v > threshold_v || v < -threshold_v;
+}
+
+// The 12-bit index of the pixel x in the middle of three rows, left and right
+// are the columns next to it
+inline uint16_t classify_pixel(const uint32_t* const row[3], int left, int x, int right, order channels)
+{
+    uint32_t w1 = row[0][left], w2 = row[0][x], w3 = row[0][right];
+    uint32_t w4 = row[1][left], w5 = row[1][x], w6 = row[1][right];
+    uint32_t w7 = row[2][left], w8 = row[2][x], w9 = row[2][right];
+
+    int pattern = diff(w5, w1, channels) << 0 | diff(w5, w2, channels) << 1 |
+                  diff(w5, w3, channels) << 2 | diff(w5, w4, channels) << 3 |
+                  diff(w5, w6, channels) << 4 | diff(w5, w7, channels) << 5 |
+                  diff(w5, w8, channels) << 6 | diff(w5, w9, channels) << 7;
+    int cross = diff(w4, w2, channels) << 0 | diff(w2, w6, channels) << 1 |
+                diff(w8, w4, channels) << 2 | diff(w6, w8, channels) << 3;
+
+    return (uint16_t)(pattern | cross << 8);
+}
+
+// The thresholds for 16-bit channels. 65535 is 257 times 255, so a channel
+// expanded from 8 bits by repeating its byte is 257 times larger and so are
+// the Y, U and V differences. The comparisons of such an image are exactly
+// those of the 8-bit original.
+enum
+{
+    wide_threshold_y = threshold_y * 257,
+    wide_threshold_u = threshold_u * 257,
+    wide_threshold_v = threshold_v * 257
+};
+
+// The differences of 16-bit channels fit in 32 bits after the conversion,
+// at most 1000 * 65535
+inline bool diff_wide(const uint16_t* c1, const uint16_t* c2)
+{
+    int r = (int)c1[0] - (int)c2[0];
+    int g = (int)c1[1] - (int)c2[1];
+    int b = (int)c1[2] - (int)c2[2];
+
+    int y = 299 * r + 587 * g + 114 * b;
+    int u = -169 * r - 331 * g + 500 * b;
+    int v = 500 * r - 419 * g - 81 * b;
+    return y > wide_threshold_y || y < -wide_threshold_y ||
+           u > wide_threshold_u || u < -wide_threshold_u ||
+           v > wide_threshold_v || v < -wide_threshold_v;
+}
+
+// classify_pixel for rows of pixels with four 16-bit channels
+inline uint16_t classify_wide_pixel(const uint16_t* const row[3], int left, int x, int right)
+{
+    const uint16_t* w1 = row[0] + 4 * left, *w2 = row[0] + 4 * x, *w3 = row[0] + 4 * right;
+    const uint16_t* w4 = row[1] + 4 * left, *w5 = row[1] + 4 * x, *w6 = row[1] + 4 * right;
+    const uint16_t* w7 = row[2] + 4 * left, *w8 = row[2] + 4 * x, *w9 = row[2] + 4 * right;
+
+    int pattern = diff_wide(w5, w1) << 0 | diff_wide(w5, w2) << 1 | diff_wide(w5, w3) << 2 |
+                  diff_wide(w5, w4) << 3 | diff_wide(w5, w6) << 4 | diff_wide(w5, w7) << 5 |
+                  diff_wide(w5, w8) << 6 | diff_wide(w5, w9) << 7;
+    int cross = diff_wide(w4, w2) << 0 | diff_wide(w2, w6) << 1 | diff_wide(w8, w4) << 2 | diff_wide(w6, w8) << 3;
+
+    return (uint16_t)(pattern | cross << 8);
+}
+
+}
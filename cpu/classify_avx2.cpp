@@ -0,0 +1,35 @@
+/* classify_avx2.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "classify_simd.h"
+
+namespace hqx
+{
+
+void classify_avx2(const image& src, int y0, int y1, uint16_t* index, uint32_t* window)
+{
+    classify_lanes<vec_avx2>(src, y0, y1, index, window);
+}
+
+void classify_avx2_equal_first(const image& src, int y0, int y1, uint16_t* index, uint32_t* window)
+{
+    classify_lanes_equal_first<vec_avx2>(src, y0, y1, index, window);
+}
+
+void classify_wide_avx2(const wide_image& src, int y0, int y1, uint16_t* index, uint32_t* window)
+{
+    classify_wide_lanes<vec_avx2>(src, y0, y1, index, window);
+}
+
+int compare_row_avx2(const uint32_t* row, const uint32_t* last, int width, uint8_t* changed)
+{
+    return compare_row_lanes<vec_avx2>(row, last, width, changed);
+}
+
+}
@@ -0,0 +1,151 @@
+/* classify_bitsliced.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "engine.h"
+#include "classify.h"
+
+#include <algorithm>
+
+// The twelve comparisons of a pixel are made between neighbours that are
+// next to each other horizontally, vertically or diagonally, and every such
+// pair is shared by the pixels around it. The pairs are compared once and
+// stored as bitplanes, one bit per pixel in words of 64 pixels, from which
+// the bits of the index are taken with shifts. Only four comparisons are
+// made per pixel instead of twelve.
+namespace hqx
+{
+
+// The comparisons of a pair of rows a and b. Bit i is the comparison of the
+// padded pixels a[i] and b[i], a[i] and b[i + 1] and a[i + 1] and b[i]. The
+// padded row repeats the edge pixels, so padded pixel i is source pixel i - 1.
+struct row_pair
+{
+    uint64_t* vertical;
+    uint64_t* down_right;
+    uint64_t* down_left;
+};
+
+// Equal pixels are common in pixel art and don't need the YUV difference
+static inline uint64_t diff_bit(uint32_t c1, uint32_t c2, order channels)
+{
+    return ((c1 ^ c2) & rgb_mask) && diff(c1, c2, channels);
+}
+
+static inline uint32_t padded(const uint32_t* row, int width, int i)
+{
+    return row[std::min(std::max(i - 1, 0), width - 1)];
+}
+
+static void compare_horizontal(const uint32_t* row, int width, order channels, int words, uint64_t* plane)
+{
+    std::fill(plane, plane + words, 0);
+    for (int i = 0; i <= width; i++)
+        plane[i / 64] |= diff_bit(padded(row, width, i), padded(row, width, i + 1), channels) << i % 64;
+}
+
+static void compare_rows(const uint32_t* a, const uint32_t* b, int width, order channels, int words,
+                         const row_pair& pair)
+{
+    std::fill(pair.vertical, pair.vertical + words, 0);
+    std::fill(pair.down_right, pair.down_right + words, 0);
+    std::fill(pair.down_left, pair.down_left + words, 0);
+    for (int i = 0; i <= width + 1; i++)
+    {
+        const uint32_t above = padded(a, width, i), below = padded(b, width, i);
+        pair.vertical[i / 64] |= diff_bit(above, below, channels) << i % 64;
+        pair.down_right[i / 64] |= diff_bit(above, padded(b, width, i + 1), channels) << i % 64;
+        pair.down_left[i / 64] |= diff_bit(padded(a, width, i + 1), below, channels) << i % 64;
+    }
+}
+
+// The 64 bits of a plane for the source pixels from 64 * k, where the pixel
+// itself is at offset 1 and its left neighbour at offset 0
+static inline uint64_t bits(const uint64_t* plane, int k, int offset)
+{
+    return offset ? plane[k] >> 1 | plane[k + 1] << 63 : plane[k];
+}
+
+// Byte j of spread[b] is bit j of b
+struct spread_table
+{
+    uint64_t spread[256];
+
+    spread_table()
+    {
+        for (int b = 0; b < 256; b++)
+        {
+            spread[b] = 0;
+            for (int j = 0; j < 8; j++)
+                spread[b] |= (uint64_t)(b >> j & 1) << 8 * j;
+        }
+    }
+};
+
+void classify_bitsliced(const image& src, int y0, int y1, uint16_t* index, uint32_t* window)
+{
+    static const spread_table table;
+    const int width = src.width;
+    const order channels = src.channels;
+
+    // The planes of the padded row and a spare word for bits(), the arena
+    // aligns the window so it holds 64-bit words
+    const int words = (width + 2) / 64 + 2;
+    uint64_t* planes = (uint64_t*)window;
+    uint64_t* horizontal = planes;
+    row_pair top = { planes + words, planes + 2 * words, planes + 3 * words };
+    row_pair bottom = { planes + 4 * words, planes + 5 * words, planes + 6 * words };
+
+    for (int y = y0; y < y1; y++)
+    {
+        const int up = std::max(y - 1, 0), down = std::min(y + 1, src.height - 1);
+
+        // The pair below the last row is the pair above this one
+        if (y == y0 || up == y)
+            compare_rows(src.row(up), src.row(y), width, channels, words, top);
+        else
+            std::swap(top, bottom);
+        compare_rows(src.row(y), src.row(down), width, channels, words, bottom);
+        compare_horizontal(src.row(y), width, channels, words, horizontal);
+
+        uint16_t* out = index + (y - y0) * width;
+        for (int k = 0; k * 64 < width; k++)
+        {
+            // The pattern bits compare w5 with w1, w2, w3, w4, w6, w7, w8 and
+            // w9, the cross bits w4 with w2, w2 with w6, w8 with w4 and w6
+            // with w8, see classify_reference
+            const uint64_t pattern[8] = {
+                bits(top.down_right, k, 0), bits(top.vertical, k, 1), bits(top.down_left, k, 1),
+                bits(horizontal, k, 0), bits(horizontal, k, 1),
+                bits(bottom.down_left, k, 0), bits(bottom.vertical, k, 1), bits(bottom.down_right, k, 1)
+            };
+            const uint64_t cross[4] = {
+                bits(top.down_left, k, 0), bits(top.down_right, k, 1),
+                bits(bottom.down_right, k, 0), bits(bottom.down_left, k, 1)
+            };
+
+            // Transposes eight pixels at a time, byte j of low and high
+            // holds the pattern and the cross of pixel j
+            const int count = std::min(64, width - k * 64);
+            for (int group = 0; group * 8 < count; group++)
+            {
+                uint64_t low = 0, high = 0;
+                for (int b = 0; b < 8; b++)
+                    low |= table.spread[pattern[b] >> group * 8 & 0xFF] << b;
+                for (int b = 0; b < 4; b++)
+                    high |= table.spread[cross[b] >> group * 8 & 0xFF] << b;
+
+                uint16_t* pixel = out + k * 64 + group * 8;
+                for (int j = 0; j < std::min(8, count - group * 8); j++)
+                    pixel[j] = (uint16_t)((low >> 8 * j & 0xFF) | (high >> 8 * j & 0xFF) << 8);
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,445 @@
+/* classify_simd.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#pragma once
+
+#include "engine.h"
+#include "classify.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstring>
+
+// The vector classifiers and the row comparison written against a backend
+// of simd.h. Everything here is local to the source file that includes it,
+// see simd.h.
+namespace hqx
+{
+
+namespace
+{
+
+// Copies a source row with its edge pixels repeated, so the neighbours of
+// the first and last pixel can be loaded without checking bounds
+inline void pad_row(const uint32_t* src, int width, uint32_t* dst)
+{
+    dst[0] = src[0];
+    memcpy(dst + 1, src, width * sizeof(uint32_t));
+    for (uint32_t* edge = dst + 1 + width; edge < dst + width + 2 * row_padding; edge++)
+        *edge = src[width - 1];
+}
+
+// Keeps the three padded rows around the current row in the scratch memory,
+// the row for source row r is stored in slot r % 3
+struct row_window
+{
+    uint32_t* rows;
+    ptrdiff_t pitch;
+
+    row_window(uint32_t* window, int width) : rows(window), pitch(width + 2 * row_padding) {}
+
+    uint32_t* slot(int row) { return rows + (row % 3) * pitch; }
+
+    // Points w at the top-left neighbour of the first pixel in each row
+    void advance(const image& src, int y, int y0, const uint32_t* w[3])
+    {
+        int up = std::max(y - 1, 0), down = std::min(y + 1, src.height - 1);
+
+        if (y == y0)
+        {
+            pad_row(src.row(up), src.width, slot(up));
+            pad_row(src.row(y), src.width, slot(y));
+        }
+        if (down != y)
+            pad_row(src.row(down), src.width, slot(down));
+
+        w[0] = slot(up);
+        w[1] = slot(y);
+        w[2] = slot(down);
+    }
+};
+
+// Two signed 16-bit coefficients for madd16
+template <class S>
+typename S::vec coefficients(int lo, int hi)
+{
+    return S::set1((int)((uint32_t)(hi & 0xFFFF) << 16 | (uint32_t)(lo & 0xFFFF)));
+}
+
+// The YUV weights of classify.h as pairs of 16-bit coefficients for the
+// red and blue, green and alpha channels in the order they are in memory
+template <class S>
+struct yuv_weights
+{
+    typename S::vec y_rb, y_ga, u_rb, u_ga, v_rb, v_ga;
+
+    yuv_weights(order channels)
+    {
+        if (channels == order_yuv)
+        {
+            y_rb = coefficients<S>(limited_y, 0);
+            u_rb = coefficients<S>(0, 0);
+            v_rb = coefficients<S>(0, limited_uv);
+            y_ga = coefficients<S>(0, 0);
+            u_ga = coefficients<S>(limited_uv, 0);
+            v_ga = coefficients<S>(0, 0);
+            return;
+        }
+
+        bool rgba = channels == order_rgba;
+        y_rb = rgba ? coefficients<S>(299, 114) : coefficients<S>(114, 299);
+        u_rb = rgba ? coefficients<S>(-169, 500) : coefficients<S>(500, -169);
+        v_rb = rgba ? coefficients<S>(500, -81) : coefficients<S>(-81, 500);
+        y_ga = coefficients<S>(587, 0);
+        u_ga = coefficients<S>(-331, 0);
+        v_ga = coefficients<S>(-419, 0);
+    }
+};
+
+// The difference test of classify.h for a vector of pairs of pixels,
+// returns all bits set in the lanes where the colours are different
+template <class S>
+typename S::vec diff_lanes(typename S::vec c1, typename S::vec c2, const yuv_weights<S>& yuv)
+{
+    typedef typename S::vec vec;
+    const vec mask = S::set1(0x00FF00FF);
+
+    // Red and blue, green and alpha as signed 16-bit differences
+    vec rb = S::sub16(S::bit_and(c1, mask), S::bit_and(c2, mask));
+    vec ga = S::sub16(S::bit_and(S::srl32(c1, 8), mask), S::bit_and(S::srl32(c2, 8), mask));
+
+    vec y = S::add32(S::madd16(rb, yuv.y_rb), S::madd16(ga, yuv.y_ga));
+    vec u = S::add32(S::madd16(rb, yuv.u_rb), S::madd16(ga, yuv.u_ga));
+    vec v = S::add32(S::madd16(rb, yuv.v_rb), S::madd16(ga, yuv.v_ga));
+
+    vec res = S::cmpgt32(S::abs32(y), S::set1(threshold_y));
+    res = S::bit_or(res, S::cmpgt32(S::abs32(u), S::set1(threshold_u)));
+    res = S::bit_or(res, S::cmpgt32(S::abs32(v), S::set1(threshold_v)));
+    return res;
+}
+
+// The twelve comparisons of pass1.cg, the pixel pairs are numbered like the
+// neighbourhood (1-9) and the bit is the one they set in the index
+struct comparison
+{
+    int c1, c2, bit;
+};
+
+const comparison comparisons[12] = {
+    { 5, 1, 0 }, { 5, 2, 1 }, { 5, 3, 2 }, { 5, 4, 3 },
+    { 5, 6, 4 }, { 5, 7, 5 }, { 5, 8, 6 }, { 5, 9, 7 },
+    { 4, 2, 8 }, { 2, 6, 9 }, { 8, 4, 10 }, { 6, 8, 11 }
+};
+
+// Loads the neighbourhoods of a vector of pixels, n[0] holds w1 and n[8]
+// holds w9. Alpha is cleared so the pixels can be compared directly.
+template <class S>
+void load_window(const uint32_t* w[3], int x, typename S::vec n[9])
+{
+    static_assert(S::lanes < row_padding, "the padded rows are too short for a vector");
+
+    const typename S::vec rgb = S::set1(rgb_mask);
+    for (int i = 0; i < 9; i++)
+        n[i] = S::bit_and(S::load(w[i / 3] + x + i % 3), rgb);
+}
+
+// Computes the YUV difference for all twelve comparisons of every pixel
+template <class S>
+void classify_row(const uint32_t* w[3], int width, uint16_t* index, const yuv_weights<S>& yuv)
+{
+    typedef typename S::vec vec;
+    for (int x = 0; x < width; x += S::lanes)
+    {
+        vec n[9];
+        load_window<S>(w, x, n);
+
+        vec idx = S::zero();
+        for (const comparison& c : comparisons)
+        {
+            vec res = diff_lanes<S>(n[c.c1 - 1], n[c.c2 - 1], yuv);
+            idx = S::bit_or(idx, S::bit_and(res, S::set1(1 << c.bit)));
+        }
+        S::store_u16(index + x, idx, std::min(width - x, (int)S::lanes));
+    }
+}
+
+template <class S>
+void classify_lanes(const image& src, int y0, int y1, uint16_t* index, uint32_t* window)
+{
+    row_window rows(window, src.width);
+    yuv_weights<S> yuv(src.channels);
+    const uint32_t* w[3];
+
+    for (int y = y0; y < y1; y++)
+    {
+        rows.advance(src, y, y0, w);
+        classify_row<S>(w, src.width, index + (y - y0) * src.width, yuv);
+    }
+}
+
+// The pairs that are not bit-identical are collected here, so the YUV
+// comparison always runs on full vectors no matter how they are scattered
+// across the row. Each entry stores the two colours and the bit it sets in
+// the index map as (x << 4 | bit).
+template <class S>
+struct pair_queue
+{
+    enum { capacity = 1024 };
+
+    alignas(64) uint32_t c1[capacity + S::lanes];
+    alignas(64) uint32_t c2[capacity + S::lanes];
+    alignas(64) uint32_t target[capacity + S::lanes];
+    int count = 0;
+
+    void push(typename S::vec a, typename S::vec b, typename S::vec t, int selected)
+    {
+        S::compress_store(c1 + count, a, selected);
+        S::compress_store(c2 + count, b, selected);
+        S::compress_store(target + count, t, selected);
+        count += count_bits(selected);
+    }
+
+    void flush(uint16_t* index, const yuv_weights<S>& yuv)
+    {
+        for (int i = 0; i < count; i += S::lanes)
+        {
+            int mask = S::movemask(diff_lanes<S>(S::load(c1 + i), S::load(c2 + i), yuv));
+            if (count - i < S::lanes)
+                mask &= (1 << (count - i)) - 1;
+
+            while (mask)
+            {
+                uint32_t t = target[i + lowest_bit(mask)];
+                index[t >> 4] |= 1 << (t & 15);
+                mask &= mask - 1;
+            }
+        }
+        count = 0;
+    }
+};
+
+// Compares the raw pixels first and only queues the pairs that differ for
+// the YUV comparison, returns the number of queued pairs
+template <class S>
+int classify_row_equal_first(const uint32_t* w[3], int width, uint16_t* index, pair_queue<S>& queue,
+                             const yuv_weights<S>& yuv)
+{
+    typedef typename S::vec vec;
+    int32_t lane_x[S::lanes];
+    for (int lane = 0; lane < S::lanes; lane++)
+        lane_x[lane] = lane << 4;
+    const vec lanes = S::load(lane_x);
+    const int all = (1 << S::lanes) - 1;
+    int queued = 0;
+
+    memset(index, 0, width * sizeof(uint16_t));
+    for (int x = 0; x < width; x += S::lanes)
+    {
+        vec n[9];
+        load_window<S>(w, x, n);
+
+        // When all neighbours are identical to w5 every comparison is
+        // false, which is the common case for flat areas in pixel art
+        vec changed = S::zero();
+        for (int i = 0; i < 9; i++)
+            changed = S::bit_or(changed, S::bit_xor(n[i], n[4]));
+        if (S::is_zero(changed))
+            continue;
+
+        int valid = width - x < S::lanes ? (1 << (width - x)) - 1 : all;
+        vec target = S::add32(S::set1(x << 4), lanes);
+
+        for (const comparison& c : comparisons)
+        {
+            vec c1 = n[c.c1 - 1], c2 = n[c.c2 - 1];
+            int mask = ~S::movemask(S::cmpeq32(c1, c2)) & valid;
+            if (mask)
+            {
+                queue.push(c1, c2, S::bit_or(target, S::set1(c.bit)), mask);
+                queued += count_bits(mask);
+            }
+        }
+
+        if (queue.count > pair_queue<S>::capacity - 12 * S::lanes)
+            queue.flush(index, yuv);
+    }
+    queue.flush(index, yuv);
+    return queued;
+}
+
+template <class S>
+void classify_lanes_equal_first(const image& src, int y0, int y1, uint16_t* index, uint32_t* window)
+{
+    row_window rows(window, src.width);
+    yuv_weights<S> yuv(src.channels);
+    const uint32_t* w[3];
+    pair_queue<S> queue;
+
+    // Queueing only pays off when few pairs differ, on photographic content
+    // it is faster to compare everything. Rows are switched to the direct
+    // comparison when an eighth of the pairs differ and every eighth row
+    // checks whether that is still the case.
+    const int width = src.width;
+    bool direct = false;
+    for (int y = y0; y < y1; y++)
+    {
+        uint16_t* row = index + (y - y0) * width;
+        rows.advance(src, y, y0, w);
+
+        if (direct && (y - y0) % 8 != 0)
+            classify_row<S>(w, width, row, yuv);
+        else
+            direct = classify_row_equal_first<S>(w, width, row, queue, yuv) > 12 * width / 8;
+    }
+}
+
+// Keeps the three rows of a wide image around the current row like
+// row_window, padded the same way and split into two planes: one with the
+// red and green channel of every pixel in a 32-bit word and one with the
+// blue channel. Alpha isn't compared.
+struct wide_row_window
+{
+    uint32_t* rows;
+    ptrdiff_t pitch;
+
+    wide_row_window(uint32_t* window, int width) : rows(window), pitch(width + 2 * row_padding) {}
+
+    // The red and green plane of a row, the blue plane follows it
+    uint32_t* slot(int row) { return rows + (row % 3) * 2 * pitch; }
+
+    void pad(const uint16_t* src, int width, uint32_t* rg)
+    {
+        uint32_t* b = rg + pitch;
+        for (int i = 0; i < pitch; i++)
+        {
+            const uint16_t* pixel = src + 4 * std::min(std::max(i - 1, 0), width - 1);
+            rg[i] = pixel[0] | (uint32_t)pixel[1] << 16;
+            b[i] = pixel[2];
+        }
+    }
+
+    void advance(const wide_image& src, int y, int y0, const uint32_t* w[3])
+    {
+        int up = std::max(y - 1, 0), down = std::min(y + 1, src.height - 1);
+
+        if (y == y0)
+        {
+            pad(src.row(up), src.width, slot(up));
+            pad(src.row(y), src.width, slot(y));
+        }
+        if (down != y)
+            pad(src.row(down), src.width, slot(down));
+
+        w[0] = slot(up);
+        w[1] = slot(y);
+        w[2] = slot(down);
+    }
+};
+
+// diff_wide for a vector of pairs of pixels, with every channel in a 32-bit
+// lane. The weights don't fit the 16-bit products of madd16 together with
+// 17-bit differences.
+template <class S>
+typename S::vec diff_wide_lanes(typename S::vec rg1, typename S::vec b1, typename S::vec rg2, typename S::vec b2)
+{
+    typedef typename S::vec vec;
+    const vec low = S::set1(0xFFFF);
+
+    vec r = S::sub32(S::bit_and(rg1, low), S::bit_and(rg2, low));
+    vec g = S::sub32(S::srl32(rg1, 16), S::srl32(rg2, 16));
+    vec b = S::sub32(b1, b2);
+
+    vec y = S::add32(S::add32(S::mullo32(r, S::set1(299)), S::mullo32(g, S::set1(587))),
+                     S::mullo32(b, S::set1(114)));
+    vec u = S::add32(S::add32(S::mullo32(r, S::set1(-169)), S::mullo32(g, S::set1(-331))),
+                     S::mullo32(b, S::set1(500)));
+    vec v = S::add32(S::add32(S::mullo32(r, S::set1(500)), S::mullo32(g, S::set1(-419))),
+                     S::mullo32(b, S::set1(-81)));
+
+    vec res = S::cmpgt32(S::abs32(y), S::set1(wide_threshold_y));
+    res = S::bit_or(res, S::cmpgt32(S::abs32(u), S::set1(wide_threshold_u)));
+    res = S::bit_or(res, S::cmpgt32(S::abs32(v), S::set1(wide_threshold_v)));
+    return res;
+}
+
+template <class S>
+void classify_wide_lanes(const wide_image& src, int y0, int y1, uint16_t* index, uint32_t* window)
+{
+    static_assert(S::lanes < row_padding, "the padded rows are too short for a vector");
+    typedef typename S::vec vec;
+
+    wide_row_window rows(window, src.width);
+    const int width = src.width;
+    const uint32_t* w[3];
+
+    for (int y = y0; y < y1; y++)
+    {
+        rows.advance(src, y, y0, w);
+        uint16_t* row = index + (y - y0) * width;
+        for (int x = 0; x < width; x += S::lanes)
+        {
+            vec rg[9], b[9];
+            for (int i = 0; i < 9; i++)
+            {
+                const uint32_t* plane = w[i / 3] + x + i % 3;
+                rg[i] = S::load(plane);
+                b[i] = S::load(plane + rows.pitch);
+            }
+
+            // Flat areas where all neighbours are identical to w5
+            vec changed = S::zero();
+            for (int i = 0; i < 9; i++)
+                changed = S::bit_or(changed, S::bit_or(S::bit_xor(rg[i], rg[4]), S::bit_xor(b[i], b[4])));
+
+            vec idx = S::zero();
+            if (!S::is_zero(changed))
+            {
+                for (const comparison& c : comparisons)
+                {
+                    vec res = diff_wide_lanes<S>(rg[c.c1 - 1], b[c.c1 - 1], rg[c.c2 - 1], b[c.c2 - 1]);
+                    idx = S::bit_or(idx, S::bit_and(res, S::set1(1 << c.bit)));
+                }
+            }
+            S::store_u16(row + x, idx, std::min(width - x, (int)S::lanes));
+        }
+    }
+}
+
+// Byte j of spread[b] is bit j of b
+struct byte_table
+{
+    uint8_t spread[256][8];
+
+    byte_table()
+    {
+        for (int b = 0; b < 256; b++)
+            for (int j = 0; j < 8; j++)
+                spread[b][j] = (uint8_t)(b >> j & 1);
+    }
+};
+
+template <class S>
+int compare_row_lanes(const uint32_t* row, const uint32_t* last, int width, uint8_t* changed)
+{
+    static const byte_table bytes;
+    const int all = (1 << S::lanes) - 1;
+    int count = 0, x = 0;
+    for (; x + S::lanes <= width; x += S::lanes)
+    {
+        int mask = ~S::movemask(S::cmpeq32(S::load(row + x), S::load(last + x))) & all;
+        for (int lane = 0; lane < S::lanes; lane += 8)
+            memcpy(changed + x + lane, bytes.spread[mask >> lane & 0xFF], 8);
+        count += count_bits(mask);
+    }
+    return count + compare_row_reference(row + x, last + x, width - x, changed + x);
+}
+
+}
+
+}
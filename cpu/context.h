@@ -0,0 +1,148 @@
+/* context.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#pragma once
+
+#include "hqx.h"
+#include "engine.h"
+#include "arena.h"
+
+#include <vector>
+
+// What the progressive mode remembers of the last frame, see progressive.cpp
+struct progressive_state
+{
+    int width = 0, height = 0;
+    hqx_format format = HQX_FORMAT_RGBA8888;
+    void* dst = nullptr;
+    ptrdiff_t dst_stride = 0;
+    bool linear_light = false;
+    std::vector<uint64_t> hashes;
+    std::vector<uint8_t> refined;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> scores;
+};
+
+// The last frame of the video mode, see video.cpp
+struct video_state
+{
+    int width = 0, height = 0;
+    hqx_format format = HQX_FORMAT_RGBA8888;
+    void* dst = nullptr;
+    ptrdiff_t dst_stride = 0;
+    bool linear_light = false;
+    std::vector<uint32_t> frame;  // 32-bit source
+    std::vector<uint16_t> index;
+    std::vector<uint8_t> changed; // pixels that differ from the frame before
+};
+
+struct hqx_context
+{
+    const hqx::lut* table;
+    hqx::arena scratch;
+    hqx_traversal traversal = HQX_TRAVERSAL_ROWS;
+    int tile_size = 128;
+    hqx_stores stores = HQX_STORES_AUTO;
+    hqx_strategy strategy = HQX_STRATEGY_TWO_PASS;
+    bool linear_light = false;
+    progressive_state progressive;
+    video_state video;
+
+    // Times the buffers of the video and progressive state were allocated,
+    // added to the arena's count by hqx_get_allocation_count
+    uint64_t state_allocations = 0;
+};
+
+namespace hqx
+{
+
+int pixel_size(hqx_format format);
+
+// Frames of 16-bit channels are only upscaled by hqx_upscale_rows and what's
+// built on it, the other modes work on 32-bit pixels and reject them
+inline bool wide_format(hqx_format format)
+{
+    return format == HQX_FORMAT_RGBA16161616;
+}
+
+// The blend kernel for pixels in the given order, which is the linear blend
+// when the context has linear light on and the pixels are RGB
+inline blend_kernel context_kernel(const hqx_context* ctx, order channels)
+{
+    return ctx->linear_light && channels != order_yuv ? kernel_linear : best_blend_kernel();
+}
+
+// Sizes a buffer of the state kept from frame to frame and fills it with
+// value. Like the arena it only allocates when the buffer has to grow, which
+// is counted. Throws std::bad_alloc.
+template <typename T>
+void assign_state(hqx_context* ctx, std::vector<T>& buffer, size_t size, T value)
+{
+    if (size > buffer.capacity())
+        ctx->state_allocations++;
+    buffer.assign(size, value);
+}
+
+// RGB565 to XRGB8888 and back
+void expand_rgb565(const uint16_t* src, int width, uint32_t* dst);
+void pack_rgb565(const uint32_t* src, int width, uint16_t* dst);
+
+struct source;
+
+// Reads the runs of an index map sidecar in order, see index.cpp
+struct index_decoder
+{
+    const uint8_t* data;
+    const uint8_t* end;
+    uint16_t value;
+    uint64_t remaining; // entries left in the current run
+
+    // Decodes the next count entries, returns false when the data runs out
+    bool read(uint16_t* index, size_t count);
+};
+
+// Converts source row y into width 32-bit pixels
+typedef void (*row_reader)(const source& src, int y, uint32_t* row, int width);
+
+// Receives the output rows [y0, y1) of a band, which are width pixels wide
+typedef void (*band_writer)(void* user, int y0, int y1, const uint32_t* output, ptrdiff_t stride, int width);
+
+// Source of upscale_bands, either 32-bit pixels that are read in place or a
+// reader that converts the rows of every band into scratch memory. With an
+// index decoder the index map of every band is decoded instead of classified,
+// which needs the frame to be upscaled from the first row on.
+struct source
+{
+    const void* pixels;
+    ptrdiff_t stride; // in bytes
+    order channels;
+    row_reader read;
+    const void* user;
+    index_decoder* index;
+};
+
+// The rows [top, bottom) of the source as 32-bit pixels, read into pixels when
+// the source has a reader
+image read_rows(const source& src, int width, int top, int bottom, uint32_t* pixels);
+
+// Upscales the source rows [y0, y1) one band at a time, the arguments must
+// have been checked. The output is blended straight into dst, which holds
+// 32-bit pixels, or when dst is null into scratch memory that is passed to
+// write for every band.
+hqx_status upscale_bands(hqx_context* ctx, const source& src, int width, int height, int y0, int y1,
+                         uint32_t* dst, ptrdiff_t dst_stride, band_writer write, void* user);
+
+// upscale_bands with the output written in one of the pixel formats
+hqx_status upscale_packed(hqx_context* ctx, const source& src, int width, int height, int y0, int y1,
+                          void* dst, ptrdiff_t dst_stride, hqx_format format);
+
+// The source of a frame in one of the pixel formats
+source packed_source(const void* pixels, ptrdiff_t stride, hqx_format format);
+
+}
@@ -0,0 +1,192 @@
+/* client.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "client.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <new>
+
+struct hqx_client
+{
+    int socket;
+    hqx_daemon_attach attach;
+    hqx_daemon_layout layout;
+    uint8_t* memory;
+};
+
+static int connect_daemon(const char* path)
+{
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path ? path : HQX_DAEMON_SOCKET, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_message(int socket, const hqx_daemon_message& msg, int fd = -1)
+{
+    iovec iov = { (void*)&msg, sizeof(msg) };
+    msghdr hdr = {};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    if (fd >= 0)
+    {
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+    return sendmsg(socket, &hdr, MSG_NOSIGNAL) == sizeof(msg);
+}
+
+static bool receive_message(int socket, hqx_daemon_message& msg)
+{
+    return recv(socket, &msg, sizeof(msg), 0) == sizeof(msg);
+}
+
+hqx_client* hqx_client_connect(const char* path, int scale, hqx_format format,
+                               int max_width, int max_height, int slots)
+{
+    if (slots <= 0 || max_width <= 0 || max_height <= 0 || slots > HQX_DAEMON_MAX_SLOTS ||
+        max_width > HQX_DAEMON_MAX_SIZE || max_height > HQX_DAEMON_MAX_SIZE)
+        return nullptr;
+
+    hqx_daemon_attach attach = {};
+    attach.version = HQX_DAEMON_PROTOCOL_VERSION;
+    attach.scale = scale;
+    attach.format = format;
+    attach.max_width = max_width;
+    attach.max_height = max_height;
+    attach.slots = slots;
+
+    hqx_daemon_layout layout = hqx_daemon_get_layout(&attach, format == HQX_FORMAT_RGB565 ? 2 : 4);
+    attach.size = layout.slot_size * slots;
+
+    // The daemon only maps memory that can't be shrunk underneath it
+    int memfd = memfd_create("hqx-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0)
+        return nullptr;
+    if (ftruncate(memfd, attach.size) < 0 || fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0)
+    {
+        close(memfd);
+        return nullptr;
+    }
+
+    void* memory = mmap(nullptr, attach.size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    int socket = connect_daemon(path);
+
+    hqx_daemon_message msg = {};
+    msg.type = HQX_DAEMON_ATTACH;
+    msg.u.attach = attach;
+    bool attached = memory != MAP_FAILED && socket >= 0 && send_message(socket, msg, memfd) &&
+                    receive_message(socket, msg) && msg.type == HQX_DAEMON_ATTACHED;
+    close(memfd);
+
+    hqx_client* client = attached ? new (std::nothrow) hqx_client : nullptr;
+    if (!client)
+    {
+        if (memory != MAP_FAILED)
+            munmap(memory, attach.size);
+        if (socket >= 0)
+            close(socket);
+        return nullptr;
+    }
+
+    client->socket = socket;
+    client->attach = attach;
+    client->layout = layout;
+    client->memory = (uint8_t*)memory;
+    return client;
+}
+
+void hqx_client_close(hqx_client* client)
+{
+    if (!client)
+        return;
+
+    munmap(client->memory, client->attach.size);
+    close(client->socket);
+    delete client;
+}
+
+void* hqx_client_input(hqx_client* client, int slot, ptrdiff_t* stride)
+{
+    if (stride)
+        *stride = (ptrdiff_t)client->layout.input_stride;
+    return client->memory + slot * client->layout.slot_size;
+}
+
+const void* hqx_client_output(hqx_client* client, int slot, ptrdiff_t* stride)
+{
+    if (stride)
+        *stride = (ptrdiff_t)client->layout.output_stride;
+    return client->memory + slot * client->layout.slot_size + client->layout.output_offset;
+}
+
+hqx_status hqx_client_submit(hqx_client* client, int slot, int width, int height, uint64_t frame)
+{
+    hqx_daemon_message msg = {};
+    msg.type = HQX_DAEMON_SUBMIT;
+    msg.u.submit.slot = slot;
+    msg.u.submit.width = width;
+    msg.u.submit.height = height;
+    msg.u.submit.frame = frame;
+    return send_message(client->socket, msg) ? HQX_OK : HQX_ERROR_INVALID_ARGUMENT;
+}
+
+hqx_status hqx_client_wait(hqx_client* client, struct hqx_daemon_done* done)
+{
+    hqx_daemon_message msg;
+    if (!receive_message(client->socket, msg))
+        return HQX_ERROR_INVALID_ARGUMENT;
+    if (msg.type == HQX_DAEMON_ERROR)
+        return (hqx_status)msg.u.error;
+    if (msg.type != HQX_DAEMON_DONE)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    if (done)
+        *done = msg.u.done;
+    return (hqx_status)msg.u.done.status;
+}
+
+hqx_status hqx_client_stats(const char* path, struct hqx_daemon_stats* stats)
+{
+    int socket = connect_daemon(path);
+    if (socket < 0)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    hqx_daemon_message msg = {};
+    msg.type = HQX_DAEMON_STATS;
+    bool ok = send_message(socket, msg) && receive_message(socket, msg) && msg.type == HQX_DAEMON_STATS_REPLY;
+    close(socket);
+
+    if (!ok)
+        return HQX_ERROR_INVALID_ARGUMENT;
+    *stats = msg.u.stats;
+    return HQX_OK;
+}
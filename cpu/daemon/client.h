@@ -0,0 +1,52 @@
+/* client.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+/* Client side of the hqx-daemon protocol. The frames live in shared memory,
+ * a frame is written into the input of a slot, submitted, and read from the
+ * output of the same slot when hqx_client_wait returns it. */
+
+#ifndef HQX_CLIENT_H
+#define HQX_CLIENT_H
+
+#include "protocol.h"
+#include "hqx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct hqx_client hqx_client;
+
+/* Connects to the daemon and shares a buffer of the given number of slots
+ * with it, returns NULL on failure or when the size or slots exceed the limits in
+ * protocol.h. path may be NULL for the default socket. */
+hqx_client* hqx_client_connect(const char* path, int scale, hqx_format format,
+                               int max_width, int max_height, int slots);
+
+void hqx_client_close(hqx_client* client);
+
+/* The frames of a slot, strides are in bytes */
+void* hqx_client_input(hqx_client* client, int slot, ptrdiff_t* stride);
+const void* hqx_client_output(hqx_client* client, int slot, ptrdiff_t* stride);
+
+/* Queues the input of a slot, frame is returned by hqx_client_wait. A slot
+ * that is still queued gets an error from hqx_client_wait instead. */
+hqx_status hqx_client_submit(hqx_client* client, int slot, int width, int height, uint64_t frame);
+
+/* Blocks until a submitted frame is done */
+hqx_status hqx_client_wait(hqx_client* client, struct hqx_daemon_done* done);
+
+/* Fetches the daemon's metrics over a connection of its own */
+hqx_status hqx_client_stats(const char* path, struct hqx_daemon_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,135 @@
+/* client_tool.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+// Streams synthetic frames through hqx-daemon and checks them against
+// libhqx, or prints the daemon's metrics with --stats.
+
+#include "client.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static const int width = 320, height = 240;
+
+static int print_stats(const char* path)
+{
+    hqx_daemon_stats stats;
+    if (hqx_client_stats(path, &stats) != HQX_OK)
+    {
+        printf("Failed to reach the daemon\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("clients:     %u\n", stats.clients);
+    printf("workers:     %u\n", stats.workers);
+    printf("queue depth: %u\n", stats.queue_depth);
+    printf("in flight:   %u\n", stats.in_flight);
+    printf("frames:      %llu\n", (unsigned long long)stats.frames);
+    printf("latency:     p50 <= %u us, p99 <= %u us, max %u us\n",
+           stats.latency_p50_us, stats.latency_p99_us, stats.latency_max_us);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, const char* argv[])
+{
+    const char* path = nullptr;
+    int scale = 2, frames = 100, slots = 2;
+    bool stats = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            path = argv[++i];
+        else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+            scale = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)
+            slots = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--stats") == 0)
+            stats = true;
+        else
+        {
+            printf("Usage: %s [-s socket] [-x scale] [-n frames] [-k slots] [--stats]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (stats)
+        return print_stats(path);
+
+    hqx_client* client = hqx_client_connect(path, scale, HQX_FORMAT_XRGB8888, width, height, slots);
+    if (!client)
+    {
+        printf("Failed to attach to the daemon\n");
+        return EXIT_FAILURE;
+    }
+
+    hqx_context* ctx = hqx_create(scale);
+    std::vector<uint32_t> expected(width * scale * height * scale);
+    std::mt19937 rng(1);
+
+    // Keeps every slot busy, a slot is refilled as soon as its frame is back
+    int submitted = 0, failed = 0;
+    double queue_us = 0, upscale_us = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (; submitted < slots && submitted < frames; submitted++)
+    {
+        ptrdiff_t stride;
+        uint32_t* input = (uint32_t*)hqx_client_input(client, submitted, &stride);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                input[y * stride / 4 + x] = ((x / 9) ^ (y / 5) ^ submitted) % 3 ? 0x00C08040 : rng();
+        hqx_client_submit(client, submitted, width, height, submitted);
+    }
+
+    for (int done_count = 0; done_count < frames; done_count++)
+    {
+        hqx_daemon_done done;
+        if (hqx_client_wait(client, &done) != HQX_OK)
+        {
+            failed++;
+            break;
+        }
+        queue_us += done.queue_us;
+        upscale_us += done.upscale_us;
+
+        // Every eighth frame is checked, the others only stream
+        ptrdiff_t in_stride, out_stride;
+        const uint32_t* input = (const uint32_t*)hqx_client_input(client, done.slot, &in_stride);
+        const uint8_t* output = (const uint8_t*)hqx_client_output(client, done.slot, &out_stride);
+        if (done.frame % 8 == 0)
+        {
+            hqx_upscale(ctx, input, in_stride, expected.data(), width * scale * 4, width, height, HQX_FORMAT_XRGB8888);
+            for (int y = 0; y < height * scale; y++)
+            {
+                if (memcmp(output + y * out_stride, &expected[y * width * scale], width * scale * 4) != 0)
+                {
+                    printf("Frame %llu differs from libhqx\n", (unsigned long long)done.frame);
+                    failed++;
+                    break;
+                }
+            }
+        }
+
+        if (submitted < frames)
+            hqx_client_submit(client, done.slot, width, height, submitted++);
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    printf("%d frames of %dx%d at %dx in %d slots: %.3f ms/frame, queued %.0f us, upscaled %.0f us on average\n",
+           frames, width, height, scale, slots, elapsed.count() / frames, queue_us / frames, upscale_us / frames);
+
+    hqx_destroy(ctx);
+    hqx_client_close(client);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
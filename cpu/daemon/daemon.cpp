@@ -0,0 +1,484 @@
+/* daemon.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+// hqx-daemon upscales the frames of all emulator instances on a host with a
+// single pool of worker threads, see protocol.h for the protocol.
+
+#include "protocol.h"
+#include "hqx.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock clock_type;
+
+struct frame;
+
+struct client
+{
+    int socket;
+    std::mutex send_lock;
+
+    // Shared memory, set up by the attach message
+    hqx_daemon_attach attach = {};
+    hqx_daemon_layout layout = {};
+    uint8_t* memory = nullptr;
+
+    // Frames waiting for a worker, the slots that are waiting or being
+    // upscaled and whether the client is in the round robin, all protected by
+    // the scheduler's lock. A slot can only be submitted again once it's done,
+    // so a client has at most one frame per slot outstanding.
+    std::deque<frame> pending;
+    std::vector<bool> busy;
+    bool scheduled = false;
+    bool closed = false;
+
+    client(int fd) : socket(fd) {}
+    ~client()
+    {
+        if (memory)
+            munmap(memory, attach.size);
+        close(socket);
+    }
+
+    // Never blocks: a client that doesn't read its replies would hold up the
+    // worker or the poll loop that sends them. When the socket buffer is full
+    // the connection is shut down, which the poll loop sees as a disconnect.
+    void send(const hqx_daemon_message& msg)
+    {
+        std::lock_guard<std::mutex> guard(send_lock);
+        if (::send(socket, &msg, sizeof(msg), MSG_NOSIGNAL | MSG_DONTWAIT) != sizeof(msg))
+            shutdown(socket, SHUT_RDWR);
+    }
+};
+
+struct frame
+{
+    std::shared_ptr<client> owner;
+    hqx_daemon_submit submit;
+    clock_type::time_point received;
+};
+
+// Latencies in power of two buckets of microseconds
+struct latency_histogram
+{
+    std::atomic<uint64_t> buckets[32];
+    std::atomic<uint32_t> max;
+
+    latency_histogram() : max(0)
+    {
+        for (std::atomic<uint64_t>& bucket : buckets)
+            bucket = 0;
+    }
+
+    void add(uint32_t us)
+    {
+        int bucket = 0;
+        while (bucket < 31 && (1u << bucket) < us)
+            bucket++;
+        buckets[bucket]++;
+
+        uint32_t prev = max;
+        while (us > prev && !max.compare_exchange_weak(prev, us))
+            ;
+    }
+
+    // Upper bound of the bucket that holds the given fraction of the frames
+    uint32_t percentile(double fraction) const
+    {
+        uint64_t total = 0;
+        for (const std::atomic<uint64_t>& bucket : buckets)
+            total += bucket;
+
+        uint64_t count = 0;
+        for (int i = 0; i < 32; i++)
+        {
+            count += buckets[i];
+            if (total && count >= total * fraction)
+                return 1u << i;
+        }
+        return 0;
+    }
+};
+
+// Hands out frames one client at a time, so a client that submits many
+// frames can't starve the others
+struct scheduler
+{
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<std::shared_ptr<client>> clients;
+    uint32_t queue_depth = 0;
+    bool stopping = false;
+
+    // Returns false when the slot is still waiting or being upscaled
+    bool submit(frame f)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        client& c = *f.owner;
+        if (c.closed)
+            return true;
+        if (c.busy[f.submit.slot])
+            return false;
+        c.busy[f.submit.slot] = true;
+
+        if (!c.scheduled)
+        {
+            clients.push_back(f.owner);
+            c.scheduled = true;
+        }
+        c.pending.push_back(std::move(f));
+        queue_depth++;
+        ready.notify_one();
+        return true;
+    }
+
+    // Frees the slot of an upscaled frame for the next submit
+    void finish(const frame& f)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        f.owner->busy[f.submit.slot] = false;
+    }
+
+    bool next(frame& f)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        ready.wait(guard, [this] { return stopping || !clients.empty(); });
+        if (stopping)
+            return false;
+
+        std::shared_ptr<client> c = clients.front();
+        clients.pop_front();
+        f = std::move(c->pending.front());
+        c->pending.pop_front();
+        queue_depth--;
+
+        if (c->pending.empty())
+            c->scheduled = false;
+        else
+            clients.push_back(c);
+        return true;
+    }
+
+    // Drops the frames of a client that disconnected
+    void remove(const std::shared_ptr<client>& c)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        c->closed = true;
+        queue_depth -= (uint32_t)c->pending.size();
+        c->pending.clear();
+        for (auto it = clients.begin(); it != clients.end(); ++it)
+        {
+            if (*it == c)
+            {
+                clients.erase(it);
+                break;
+            }
+        }
+        c->scheduled = false;
+    }
+
+    void stop()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        ready.notify_all();
+    }
+};
+
+static scheduler frames;
+static latency_histogram latency;
+static std::atomic<uint32_t> in_flight(0);
+static std::atomic<uint64_t> completed(0);
+static std::atomic<uint32_t> client_count(0);
+static unsigned worker_count;
+static volatile sig_atomic_t running = 1;
+
+static int pixel_size(int32_t format)
+{
+    return format == HQX_FORMAT_RGB565 ? 2 : 4;
+}
+
+static uint32_t microseconds(clock_type::duration d)
+{
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+static void worker()
+{
+    // The contexts only hold scratch memory, the look-up tables are shared by all threads
+    hqx_context* contexts[5] = {};
+    for (int scale = 2; scale <= 4; scale++)
+        contexts[scale] = hqx_create(scale);
+
+    frame f;
+    while (frames.next(f))
+    {
+        in_flight++;
+        client& c = *f.owner;
+        clock_type::time_point start = clock_type::now();
+
+        const uint8_t* slot = c.memory + f.submit.slot * c.layout.slot_size;
+        hqx_status status = hqx_upscale(contexts[c.attach.scale],
+                                        slot, c.layout.input_stride,
+                                        (uint8_t*)slot + c.layout.output_offset, c.layout.output_stride,
+                                        f.submit.width, f.submit.height, (hqx_format)c.attach.format);
+
+        clock_type::time_point end = clock_type::now();
+        hqx_daemon_message msg = {};
+        msg.type = HQX_DAEMON_DONE;
+        msg.u.done.slot = f.submit.slot;
+        msg.u.done.status = status;
+        msg.u.done.frame = f.submit.frame;
+        msg.u.done.queue_us = microseconds(start - f.received);
+        msg.u.done.upscale_us = microseconds(end - start);
+
+        // Counted before the reply, so the client never sees stale metrics
+        latency.add(microseconds(end - f.received));
+        completed++;
+        in_flight--;
+        frames.finish(f);
+        c.send(msg);
+        f = frame();
+    }
+
+    for (hqx_context* ctx : contexts)
+        hqx_destroy(ctx);
+}
+
+static void reply_error(client& c, int32_t status)
+{
+    hqx_daemon_message msg = {};
+    msg.type = HQX_DAEMON_ERROR;
+    msg.u.error = status;
+    c.send(msg);
+}
+
+static bool attach(client& c, const hqx_daemon_attach& a, int fd)
+{
+    if (c.memory || fd < 0 || a.version != HQX_DAEMON_PROTOCOL_VERSION ||
+        a.scale < 2 || a.scale > 4 || a.format < HQX_FORMAT_RGBA8888 || a.format > HQX_FORMAT_RGB565 ||
+        a.max_width <= 0 || a.max_height <= 0 || a.max_width > HQX_DAEMON_MAX_SIZE ||
+        a.max_height > HQX_DAEMON_MAX_SIZE || a.slots == 0 || a.slots > HQX_DAEMON_MAX_SLOTS)
+        return false;
+
+    // Divided rather than multiplied, so a huge size can't wrap around
+    hqx_daemon_layout layout = hqx_daemon_get_layout(&a, pixel_size(a.format));
+    if (a.slots > a.size / layout.slot_size)
+        return false;
+
+    // A memfd that could shrink while it's mapped would crash the daemon,
+    // fcntl fails on anything that isn't a memfd
+    struct stat st;
+    const int seals = fcntl(fd, F_GET_SEALS);
+    if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < a.size || seals < 0 || !(seals & F_SEAL_SHRINK))
+        return false;
+
+    void* memory = mmap(nullptr, a.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+        return false;
+
+    c.attach = a;
+    c.layout = layout;
+    c.busy.assign(a.slots, false);
+    c.memory = (uint8_t*)memory;
+    client_count++;
+    return true;
+}
+
+// Reads one message, returns false when the client disconnected
+static bool receive(const std::shared_ptr<client>& c)
+{
+    hqx_daemon_message msg = {};
+    char control[CMSG_SPACE(sizeof(int))];
+    iovec iov = { &msg, sizeof(msg) };
+    msghdr hdr = {};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    ssize_t size = recvmsg(c->socket, &hdr, MSG_CMSG_CLOEXEC);
+    if (size <= 0)
+        return false;
+
+    int fd = -1;
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+    if ((size_t)size != sizeof(msg))
+        msg.type = 0;
+
+    switch (msg.type)
+    {
+    case HQX_DAEMON_ATTACH:
+        if (attach(*c, msg.u.attach, fd))
+        {
+            msg.type = HQX_DAEMON_ATTACHED;
+            c->send(msg);
+        }
+        else
+        {
+            reply_error(*c, HQX_ERROR_INVALID_ARGUMENT);
+        }
+        break;
+
+    case HQX_DAEMON_SUBMIT:
+        if (!c->memory || msg.u.submit.slot >= c->attach.slots ||
+            msg.u.submit.width <= 0 || msg.u.submit.width > c->attach.max_width ||
+            msg.u.submit.height <= 0 || msg.u.submit.height > c->attach.max_height)
+        {
+            reply_error(*c, HQX_ERROR_INVALID_ARGUMENT);
+            break;
+        }
+        if (!frames.submit(frame { c, msg.u.submit, clock_type::now() }))
+            reply_error(*c, HQX_ERROR_INVALID_ARGUMENT);
+        break;
+
+    case HQX_DAEMON_STATS:
+    {
+        hqx_daemon_stats& stats = msg.u.stats;
+        msg.type = HQX_DAEMON_STATS_REPLY;
+        {
+            std::lock_guard<std::mutex> guard(frames.lock);
+            stats.queue_depth = frames.queue_depth;
+        }
+        stats.clients = client_count;
+        stats.in_flight = in_flight;
+        stats.workers = worker_count;
+        stats.frames = completed;
+        stats.latency_p50_us = latency.percentile(0.5);
+        stats.latency_p99_us = latency.percentile(0.99);
+        stats.latency_max_us = latency.max;
+        c->send(msg);
+        break;
+    }
+
+    default:
+        reply_error(*c, HQX_ERROR_INVALID_ARGUMENT);
+        break;
+    }
+
+    if (fd >= 0)
+        close(fd);
+    return true;
+}
+
+static void handle_signal(int)
+{
+    running = 0;
+}
+
+int main(int argc, const char* argv[])
+{
+    const char* path = HQX_DAEMON_SOCKET;
+    worker_count = std::thread::hardware_concurrency();
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            worker_count = atoi(argv[++i]);
+        }
+        else
+        {
+            printf("Usage: %s [-s socket] [-j worker threads]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    worker_count = std::max(worker_count, 1u);
+
+    int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 64) < 0)
+    {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < worker_count; i++)
+        workers.emplace_back(worker);
+    printf("hqx-daemon listening on %s with %u workers\n", path, worker_count);
+
+    // The first entry is the listening socket, the others belong to the clients
+    std::vector<pollfd> fds(1, pollfd { listener, POLLIN, 0 });
+    std::vector<std::shared_ptr<client>> clients(1);
+
+    while (running)
+    {
+        if (poll(fds.data(), fds.size(), 500) < 0)
+            continue;
+
+        for (size_t i = fds.size() - 1; i > 0; i--)
+        {
+            if (!fds[i].revents)
+                continue;
+
+            if (!(fds[i].revents & POLLIN) || !receive(clients[i]))
+            {
+                if (clients[i]->memory)
+                    client_count--;
+                frames.remove(clients[i]);
+                clients.erase(clients.begin() + i);
+                fds.erase(fds.begin() + i);
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0)
+            {
+                fds.push_back(pollfd { fd, POLLIN, 0 });
+                clients.push_back(std::make_shared<client>(fd));
+            }
+        }
+    }
+
+    frames.stop();
+    for (std::thread& thread : workers)
+        thread.join();
+
+    for (size_t i = 1; i < clients.size(); i++)
+        frames.remove(clients[i]);
+    close(listener);
+    unlink(path);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,117 @@
+/* protocol.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+/* Messages exchanged with hqx-daemon over a SOCK_SEQPACKET Unix socket.
+ *
+ * A client creates a memfd sealed with F_SEAL_SHRINK, sends it along with an attach message and waits
+ * for the attached reply. The memfd is divided into slots that each hold an
+ * input and an output frame, see hqx_daemon_layout. The client writes a
+ * frame into the input of a slot and sends a submit message, the daemon
+ * upscales it straight into the output of that slot and replies with a done
+ * message. Frames are never copied through the socket.
+ *
+ * A slot can't be submitted again until its done message was sent, the daemon
+ * replies with an error instead. The daemon never waits for a client to read
+ * its replies, it disconnects a client whose socket buffer is full.
+ *
+ * A stats message can be sent on any connection, attached or not. */
+
+#ifndef HQX_DAEMON_PROTOCOL_H
+#define HQX_DAEMON_PROTOCOL_H
+
+#include <stdint.h>
+
+#define HQX_DAEMON_PROTOCOL_VERSION 1
+#define HQX_DAEMON_SOCKET "/tmp/hqx-daemon.sock"
+
+/* Limits of an attach, which keep the layout below 2^64 bytes */
+#define HQX_DAEMON_MAX_SIZE 65536  /* max_width and max_height */
+#define HQX_DAEMON_MAX_SLOTS 256
+
+enum hqx_daemon_message_type
+{
+    HQX_DAEMON_ATTACH = 1,  /* client: memfd passed as SCM_RIGHTS */
+    HQX_DAEMON_ATTACHED,    /* daemon: reply to attach */
+    HQX_DAEMON_SUBMIT,      /* client: upscale the input of a slot */
+    HQX_DAEMON_DONE,        /* daemon: the output of a slot is ready */
+    HQX_DAEMON_STATS,       /* client: request the daemon's metrics */
+    HQX_DAEMON_STATS_REPLY, /* daemon: reply to stats */
+    HQX_DAEMON_ERROR        /* daemon: the previous message was rejected */
+};
+
+struct hqx_daemon_attach
+{
+    uint32_t version;
+    int32_t scale;
+    int32_t format; /* hqx_format */
+    int32_t max_width, max_height;
+    uint32_t slots;
+    uint64_t size;  /* size of the memfd */
+};
+
+struct hqx_daemon_submit
+{
+    uint32_t slot;
+    int32_t width, height;
+    uint64_t frame;  /* chosen by the client and returned in the done message */
+};
+
+struct hqx_daemon_done
+{
+    uint32_t slot;
+    int32_t status;  /* hqx_status */
+    uint64_t frame;
+    uint32_t queue_us, upscale_us;
+};
+
+struct hqx_daemon_stats
+{
+    uint32_t clients;      /* clients with shared memory attached */
+    uint32_t queue_depth;  /* frames waiting for a worker */
+    uint32_t in_flight;    /* frames being upscaled */
+    uint32_t workers;
+    uint64_t frames;       /* frames upscaled since the daemon started */
+    uint32_t latency_p50_us, latency_p99_us, latency_max_us; /* submit to done */
+};
+
+struct hqx_daemon_message
+{
+    uint32_t type;
+    union
+    {
+        struct hqx_daemon_attach attach;
+        struct hqx_daemon_submit submit;
+        struct hqx_daemon_done done;
+        struct hqx_daemon_stats stats;
+        int32_t error;  /* hqx_status */
+    } u;
+};
+
+/* Position of the frames in the memfd, slots start on a page boundary. The
+ * attach has to be within the limits above or the sizes overflow. */
+struct hqx_daemon_layout
+{
+    uint64_t input_stride, output_stride;
+    uint64_t output_offset, slot_size;
+};
+
+static inline struct hqx_daemon_layout hqx_daemon_get_layout(const struct hqx_daemon_attach* attach, uint32_t pixel_size)
+{
+    struct hqx_daemon_layout layout;
+    uint64_t input_size;
+
+    layout.input_stride = (uint64_t)attach->max_width * pixel_size;
+    layout.output_stride = layout.input_stride * attach->scale;
+    input_size = layout.input_stride * attach->max_height;
+    layout.output_offset = (input_size + 4095) & ~(uint64_t)4095;
+    layout.slot_size = (layout.output_offset + layout.output_stride * attach->max_height * attach->scale + 4095) & ~(uint64_t)4095;
+    return layout;
+}
+
+#endif
@@ -0,0 +1,210 @@
+/* engine.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// CPU implementation of the two passes in the cg directory. Images are made
+// of 32-bit pixels and all strides are in pixels.
+namespace hqx
+{
+
+// The look-up texture of one scale, see lut.cpp
+struct lut
+{
+    int scale;
+
+    // SCALE*SCALE entries for every 12-bit index, ordered like the texels of
+    // a single column in the look-up texture. Each entry packs the weights of
+    // p1-p4 in its four bytes and the weights always add up to 16.
+    const uint32_t* weights;
+    size_t size;
+};
+
+const lut& get_lut(int scale);
+
+// The same tables copied to a single huge page, where the system allows it
+const lut& get_lut_huge(int scale);
+
+// Memory for large buffers in whole blocks of 2 MiB that start on a 2 MiB
+// boundary. Explicit huge pages are used when a pool of them is reserved,
+// then transparent huge pages, and normal pages when neither is available.
+// kind tells which of them backs the memory.
+enum page_kind
+{
+    pages_normal,
+    pages_transparent,
+    pages_explicit
+};
+
+size_t huge_size(size_t size);
+void* allocate_huge(size_t size, page_kind* kind);
+void free_huge(void* memory, size_t size);
+
+// Byte order of the pixels in memory. The byte that isn't part of the colour
+// is always the highest, it's interpolated like the others but not compared.
+// order_yuv holds BT.601 limited range Y, U and V, which are compared as they
+// are instead of being converted from RGB.
+enum order
+{
+    order_rgba,
+    order_bgra,
+    order_yuv
+};
+
+struct image
+{
+    const uint32_t* pixels;
+    ptrdiff_t stride;
+    int width, height;
+    order channels;
+
+    const uint32_t* row(int y) const { return pixels + y * stride; }
+};
+
+// Pixels with 16-bit channels, R, G, B and A in four 16-bit words, for
+// sources that shouldn't be quantized to 8 bits. They are compared with the
+// thresholds scaled to 16 bits and interpolated with the same weights and
+// rounding. Only the RGBA order is supported.
+struct wide_image
+{
+    const uint16_t* pixels;
+    ptrdiff_t stride; // in pixels of four channels
+    int width, height;
+
+    const uint16_t* row(int y) const { return pixels + y * stride * 4; }
+};
+
+// Pass 1: stores the 12-bit index of the source rows [y0, y1) in the index
+// map, one row of width entries after the other. The low 8 bits of an index
+// hold the pattern and the high 4 bits the cross.
+//
+// The vector classifiers need window_size(width) pixels of scratch memory.
+// They are written once against the backends of simd.h, the SWAR backend
+// runs anywhere and gives the same index map as AVX2.
+size_t window_size(int width);
+void classify_reference(const image& src, int y0, int y1, uint16_t* index);
+void classify_avx2(const image& src, int y0, int y1, uint16_t* index, uint32_t* window);
+void classify_avx2_equal_first(const image& src, int y0, int y1, uint16_t* index, uint32_t* window);
+void classify_swar(const image& src, int y0, int y1, uint16_t* index, uint32_t* window);
+void classify_swar_equal_first(const image& src, int y0, int y1, uint16_t* index, uint32_t* window);
+
+// Portable classifier that compares the pairs of neighbours once into
+// bitplanes of 64 pixels, see classify_bitsliced.cpp. classify() uses it on
+// machines without AVX2. It needs the same scratch memory as the vector
+// classifiers.
+void classify_bitsliced(const image& src, int y0, int y1, uint16_t* index, uint32_t* window);
+
+// Uses the fastest classifier supported by this machine
+void classify(const image& src, int y0, int y1, uint16_t* index, uint32_t* window);
+bool cpu_has_avx2();
+
+// Pass 1 of wide images. The vector classifiers compare the channels in
+// 32-bit lanes and need the same scratch memory as the others.
+void classify_wide_reference(const wide_image& src, int y0, int y1, uint16_t* index);
+void classify_wide_avx2(const wide_image& src, int y0, int y1, uint16_t* index, uint32_t* window);
+void classify_wide_swar(const wide_image& src, int y0, int y1, uint16_t* index, uint32_t* window);
+void classify_wide(const wide_image& src, int y0, int y1, uint16_t* index, uint32_t* window);
+
+// Compares a row of pixels with the same row of the last frame, sets
+// changed[x] to 1 where they differ and 0 elsewhere and returns the number
+// of pixels that changed
+int compare_row_reference(const uint32_t* row, const uint32_t* last, int width, uint8_t* changed);
+int compare_row_avx2(const uint32_t* row, const uint32_t* last, int width, uint8_t* changed);
+int compare_row_swar(const uint32_t* row, const uint32_t* last, int width, uint8_t* changed);
+int compare_row(const uint32_t* row, const uint32_t* last, int width, uint8_t* changed);
+
+// Pass 2: upscales the columns [x0, x1) of the source rows [y0, y1) using
+// their part of the index map, which holds rows of width entries. dst points
+// at the output of column x0 in the first output row of y0.
+//
+// With stream the output bypasses the cache: the SCALE output rows of a few
+// source pixels are blended on the stack and then written one row after the
+// other with non-temporal stores, so the stores fill whole cache lines and
+// don't read the lines they overwrite. The lines at the ends of a span that
+// it only partly covers are written with normal stores.
+void blend_columns(const lut& table, const image& src, int y0, int y1, int x0, int x1, const uint16_t* index,
+                   uint32_t* dst, ptrdiff_t dst_stride, bool stream);
+
+// Vector kernels of pass 2 that blend groups of 8 or 16 pixels of a row with
+// gathers from the look-up table, see blend.h. They start at the pixel x, which must be
+// at least 1, and stop before a group would reach x1 or the last pixel of
+// the row. row holds the source rows around the row, index its index map and
+// out points at the output of pixel x. Returns the first pixel that wasn't
+// blended.
+int blend_span_avx2(const lut& table, const uint32_t* const row[3], const uint16_t* index, int x, int x1,
+                    int width, uint32_t* out, ptrdiff_t out_stride);
+int blend_span_avx512(const lut& table, const uint32_t* const row[3], const uint16_t* index, int x, int x1,
+                      int width, uint32_t* out, ptrdiff_t out_stride);
+int blend_span_swar(const lut& table, const uint32_t* const row[3], const uint16_t* index, int x, int x1,
+                    int width, uint32_t* out, ptrdiff_t out_stride);
+bool cpu_has_avx512();
+
+enum blend_kernel
+{
+    kernel_scalar,
+    kernel_avx2,
+    kernel_avx512,
+    kernel_swar,
+    kernel_linear // scalar, in linear light, see blend.cpp
+};
+
+// The fastest kernel supported by this machine, which blend_columns uses
+blend_kernel best_blend_kernel();
+void blend_columns_with(blend_kernel kernel, const lut& table, const image& src, int y0, int y1, int x0, int x1,
+                        const uint16_t* index, uint32_t* dst, ptrdiff_t dst_stride, bool stream);
+
+// Pass 2 of wide images for whole rows, dst holds pixels of four 16-bit
+// channels and its stride is in pixels. The vector kernels keep every
+// channel in a 32-bit lane and blend half as many pixels per vector as the
+// kernels above, they have the same contract with pixels of 16-bit channels.
+int blend_span_wide_avx2(const lut& table, const uint16_t* const row[3], const uint16_t* index, int x, int x1,
+                         int width, uint16_t* out, ptrdiff_t out_stride);
+int blend_span_wide_avx512(const lut& table, const uint16_t* const row[3], const uint16_t* index, int x, int x1,
+                           int width, uint16_t* out, ptrdiff_t out_stride);
+int blend_span_wide_swar(const lut& table, const uint16_t* const row[3], const uint16_t* index, int x, int x1,
+                         int width, uint16_t* out, ptrdiff_t out_stride);
+void blend_wide_with(blend_kernel kernel, const lut& table, const wide_image& src, int y0, int y1,
+                     const uint16_t* index, uint16_t* dst, ptrdiff_t dst_stride);
+void blend_wide(const lut& table, const wide_image& src, int y0, int y1, const uint16_t* index, uint16_t* dst,
+                ptrdiff_t dst_stride);
+
+// Upscales whole rows
+inline void blend(const lut& table, const image& src, int y0, int y1, const uint16_t* index,
+                  uint32_t* dst, ptrdiff_t dst_stride, bool stream = false)
+{
+    blend_columns(table, src, y0, y1, 0, src.width, index, dst, dst_stride, stream);
+}
+
+// Upscales the columns [x0, x1) of the source rows [y0, y1) without an index
+// map. The single pass classifies every pixel right before blending it, like
+// the shaders in single-pass, with the reference classifier. The fused
+// upscale classifies tiles of fused_rows by fused_columns pixels into a
+// buffer on the stack with the fastest classifier and blends each tile while
+// its source is still in the L1 cache, window is the scratch memory of
+// classify. dst points at the output of column x0 in the first output row of
+// y0.
+enum
+{
+    fused_rows = 8,
+    fused_columns = 128
+};
+
+void upscale_single_pass(const lut& table, const image& src, int y0, int y1, int x0, int x1, uint32_t* dst,
+                         ptrdiff_t dst_stride, bool stream);
+void upscale_fused(const lut& table, const image& src, int y0, int y1, int x0, int x1, uint32_t* window,
+                   uint32_t* dst, ptrdiff_t dst_stride, bool stream);
+
+// Size of the last level cache in bytes, or a guess where it's unknown
+size_t llc_size();
+
+}
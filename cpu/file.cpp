@@ -0,0 +1,353 @@
+/* file.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "context.h"
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Only the source rows of the current strip are mapped, the output of every
+// tile is written straight to the file. The strips span the whole width of
+// the image and are cut into tiles, which are upscaled with a one pixel halo
+// so the output is the same as if the image was upscaled in one go.
+
+namespace
+{
+
+#if defined(_WIN32)
+
+struct source_file
+{
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+    void* view = nullptr;
+    uint64_t size = 0;
+
+    ~source_file()
+    {
+        unmap();
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+    }
+
+    bool open(const char* path)
+    {
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                           nullptr);
+        LARGE_INTEGER length;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &length))
+            return false;
+        size = length.QuadPart;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        return mapping != nullptr;
+    }
+
+    // Maps the bytes [offset, offset + length), returns a pointer to offset
+    const uint8_t* map(uint64_t offset, size_t length)
+    {
+        unmap();
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        const uint64_t start = offset - offset % info.dwAllocationGranularity;
+        view = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)start,
+                             (SIZE_T)(offset - start + length));
+        return view ? (const uint8_t*)view + (offset - start) : nullptr;
+    }
+
+    void unmap()
+    {
+        if (view)
+            UnmapViewOfFile(view);
+        view = nullptr;
+    }
+};
+
+struct output_file
+{
+    HANDLE file = INVALID_HANDLE_VALUE;
+
+    ~output_file()
+    {
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+    }
+
+    bool open(const char* path, uint64_t size)
+    {
+        file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, 0, nullptr);
+        LARGE_INTEGER length;
+        length.QuadPart = size;
+        return file != INVALID_HANDLE_VALUE && SetFilePointerEx(file, length, nullptr, FILE_BEGIN) &&
+               SetEndOfFile(file);
+    }
+
+    bool write(const void* data, size_t length, uint64_t offset)
+    {
+        OVERLAPPED position = {};
+        position.Offset = (DWORD)offset;
+        position.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD written;
+        return WriteFile(file, data, (DWORD)length, &written, &position) && written == length;
+    }
+};
+
+#else
+
+struct source_file
+{
+    int fd = -1;
+    void* view = MAP_FAILED;
+    size_t view_size = 0;
+    uint64_t size = 0;
+
+    ~source_file()
+    {
+        unmap();
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool open(const char* path)
+    {
+        fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        const off_t end = lseek(fd, 0, SEEK_END);
+        size = end < 0 ? 0 : end;
+        return end >= 0;
+    }
+
+    // Maps the bytes [offset, offset + length), returns a pointer to offset
+    const uint8_t* map(uint64_t offset, size_t length)
+    {
+        unmap();
+        const uint64_t start = offset - offset % sysconf(_SC_PAGESIZE);
+        view_size = offset - start + length;
+        view = mmap(nullptr, view_size, PROT_READ, MAP_PRIVATE, fd, start);
+        if (view == MAP_FAILED)
+            return nullptr;
+
+        // Every byte is read once, the halo rows aside
+        madvise(view, view_size, MADV_SEQUENTIAL);
+        madvise(view, view_size, MADV_WILLNEED);
+        return (const uint8_t*)view + (offset - start);
+    }
+
+    void unmap()
+    {
+        if (view != MAP_FAILED)
+            munmap(view, view_size);
+        view = MAP_FAILED;
+    }
+};
+
+struct output_file
+{
+    int fd = -1;
+
+    ~output_file()
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool open(const char* path, uint64_t size)
+    {
+        fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        return fd >= 0 && ftruncate(fd, size) == 0;
+    }
+
+    bool write(const void* data, size_t length, uint64_t offset)
+    {
+        for (const uint8_t* bytes = (const uint8_t*)data; length;)
+        {
+            const ssize_t written = pwrite(fd, bytes, length, offset);
+            if (written <= 0)
+                return false;
+            bytes += written;
+            length -= written;
+            offset += written;
+        }
+        return true;
+    }
+};
+
+#endif
+
+// The size of the strips and tiles, in source pixels
+struct tiling
+{
+    int strip_rows;
+    int tile_width;
+};
+
+// Memory taken by the mapped strip and by every thread upscaling a tile
+static size_t memory_use(const tiling& t, int width, int scale, int pixel_size, int threads)
+{
+    const size_t strip = (size_t)(t.strip_rows + 2) * width * pixel_size;
+    const size_t columns = t.tile_width + 2;
+    const size_t output = columns * scale * (t.strip_rows + 1) * scale * pixel_size;
+
+    // The scratch memory of a context, a band of index and 32-bit output
+    // rows plus the source rows around it
+    const size_t scratch = columns * (16 * 2 + 18 * 4 + 16 * scale * scale * 4);
+    return strip + threads * (output + scratch);
+}
+
+// The largest tiles that fit in the budget, the strips are halved first as
+// long as they're taller than the tiles are wide
+static bool choose_tiling(tiling& t, int width, int height, int scale, int pixel_size, int threads, size_t budget)
+{
+    t.strip_rows = std::min(height, 1024);
+    t.tile_width = std::min(width, 1024);
+    while (memory_use(t, width, scale, pixel_size, threads) > budget)
+    {
+        if (t.strip_rows > 1 && (t.strip_rows >= t.tile_width || t.tile_width <= 16))
+            t.strip_rows = std::max(t.strip_rows / 2, 1);
+        else if (t.tile_width > 16)
+            t.tile_width = std::max(t.tile_width / 2, 16);
+        else
+            return false;
+    }
+    return true;
+}
+
+struct strip
+{
+    const uint8_t* rows; // source row top
+    int top, bottom;     // rows that are mapped
+    int y0, y1;          // rows that are upscaled
+};
+
+}
+
+hqx_status hqx_upscale_file(int scale,
+                            const char* src_path, uint64_t src_offset,
+                            const char* dst_path, uint64_t dst_offset,
+                            int width, int height, hqx_format format,
+                            int threads, size_t memory_budget)
+{
+    const int pixel_size = hqx::pixel_size(format);
+    if (scale < 2 || scale > 4 || !src_path || !dst_path || width <= 0 || height <= 0 || !pixel_size ||
+        src_offset % pixel_size)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    tiling t;
+    if (!choose_tiling(t, width, height, scale, pixel_size, threads, memory_budget))
+        return HQX_ERROR_OUT_OF_MEMORY;
+
+    const uint64_t src_stride = (uint64_t)width * pixel_size;
+    const uint64_t dst_stride = src_stride * scale;
+    source_file src;
+    if (!src.open(src_path))
+        return HQX_ERROR_IO;
+    if (src.size < src_offset + src_stride * height)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    output_file dst;
+    if (!dst.open(dst_path, dst_offset + dst_stride * scale * height))
+        return HQX_ERROR_IO;
+
+    // A context and an output buffer for every thread. The output rows are
+    // placed like in the mapped rows, the halo row above the strip is skipped.
+    const int tiles = (width + t.tile_width - 1) / t.tile_width;
+    threads = std::min(threads, tiles);
+    std::vector<hqx_context*> contexts(threads);
+    std::vector<std::vector<uint8_t>> outputs(threads);
+    hqx_status status = HQX_OK;
+    try
+    {
+        for (int i = 0; i < threads; i++)
+        {
+            contexts[i] = hqx_create(scale);
+            outputs[i].resize((size_t)(t.tile_width + 2) * scale * (t.strip_rows + 1) * scale * pixel_size);
+            if (!contexts[i] ||
+                hqx_reserve(contexts[i], std::min(t.tile_width + 2, width), t.strip_rows + 2, format) != HQX_OK)
+                status = HQX_ERROR_OUT_OF_MEMORY;
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        status = HQX_ERROR_OUT_OF_MEMORY;
+    }
+
+    std::atomic<int> next;
+    std::atomic<int> result(status);
+    strip current = {};
+
+    // Takes tiles of the current strip until there are none left
+    auto work = [&](int thread) {
+        hqx_context* ctx = contexts[thread];
+        uint8_t* output = outputs[thread].data();
+        for (int tile = next++; tile < tiles && result == HQX_OK; tile = next++)
+        {
+            const int x0 = tile * t.tile_width, x1 = std::min(x0 + t.tile_width, width);
+            const int left = std::max(x0 - 1, 0), right = std::min(x1 + 1, width);
+            const ptrdiff_t output_stride = (ptrdiff_t)(right - left) * scale * pixel_size;
+
+            hqx_status s = hqx_upscale_rows(ctx, current.rows + left * pixel_size, (ptrdiff_t)src_stride,
+                                            output, output_stride, right - left, current.bottom - current.top,
+                                            current.y0 - current.top, current.y1 - current.top, format);
+
+            // The output rows without the halo columns
+            const uint8_t* row = output + (current.y0 - current.top) * scale * output_stride +
+                                 (x0 - left) * scale * pixel_size;
+            const size_t length = (size_t)(x1 - x0) * scale * pixel_size;
+            for (int y = current.y0 * scale; s == HQX_OK && y < current.y1 * scale; y++, row += output_stride)
+            {
+                if (!dst.write(row, length, dst_offset + y * dst_stride + (uint64_t)x0 * scale * pixel_size))
+                    s = HQX_ERROR_IO;
+            }
+            if (s != HQX_OK)
+                result = s;
+        }
+    };
+
+    for (int y0 = 0; y0 < height && result == HQX_OK; y0 += t.strip_rows)
+    {
+        current.y0 = y0;
+        current.y1 = std::min(y0 + t.strip_rows, height);
+        current.top = std::max(y0 - 1, 0);
+        current.bottom = std::min(current.y1 + 1, height);
+        current.rows = src.map(src_offset + current.top * src_stride,
+                               (size_t)((current.bottom - current.top) * src_stride));
+        if (!current.rows)
+        {
+            result = HQX_ERROR_IO;
+            break;
+        }
+
+        next = 0;
+        std::vector<std::thread> workers;
+        for (int i = 1; i < threads; i++)
+            workers.emplace_back(work, i);
+        work(0);
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    for (hqx_context* ctx : contexts)
+        hqx_destroy(ctx);
+    return (hqx_status)result.load();
+}
@@ -0,0 +1,101 @@
+#!/usr/bin/env python
+#
+# gen_lut.py
+#
+# Copyright (C) 2014 Jules Blok
+#
+# This software may be modified and distributed under the terms
+# of the GNU Lesser General Public License, version 2.1 or later.
+# See the COPYING file for details.
+#
+# Converts the look-up textures in resources/ into the compact tables in
+# lut_data.inc that the CPU implementation is compiled with. Run it from the
+# cpu directory whenever one of the textures changes.
+#
+# Every texel holds four weights whose sum is a power of two, so they are
+# normalised to a sum of 16 which lets the blend use a fixed shift. A texture
+# only contains a few dozen distinct texels and a few hundred distinct blocks
+# of SCALE*SCALE texels, so those are stored once and referenced by index.
+
+import os
+import struct
+import sys
+import zlib
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    if pa <= pb and pa <= pc:
+        return a
+    return b if pb <= pc else c
+
+def read_png(filename):
+    data = open(filename, 'rb').read()
+    pos, idat = 8, b''
+    while pos < len(data):
+        length, kind = struct.unpack('>I4s', data[pos:pos + 8])
+        chunk = data[pos + 8:pos + 8 + length]
+        pos += length + 12
+        if kind == b'IHDR':
+            width, height, depth, color = struct.unpack('>IIBB', chunk[:10])
+            if depth != 8 or color != 6 or chunk[12] != 0:
+                sys.exit('%s: expected a non-interlaced 8-bit RGBA image' % filename)
+        elif kind == b'IDAT':
+            idat += chunk
+
+    raw = zlib.decompress(idat)
+    stride = width * 4
+    rows, prev = [], bytearray(stride)
+    for y in range(height):
+        kind = raw[y * (stride + 1)]
+        line = bytearray(raw[y * (stride + 1) + 1:(y + 1) * (stride + 1)])
+        for x in range(stride):
+            a = line[x - 4] if x >= 4 else 0
+            b = prev[x]
+            c = prev[x - 4] if x >= 4 else 0
+            line[x] = (line[x] + (0, a, b, (a + b) // 2, paeth(a, b, c))[kind]) & 0xFF
+        rows.append(line)
+        prev = line
+    return width, height, rows
+
+def normalise(texel):
+    total = sum(texel)
+    if total == 0 or 16 % total != 0:
+        sys.exit('weights %s do not sum to a power of two' % (texel,))
+    return tuple(w * (16 // total) for w in texel)
+
+def write_table(out, name, values, per_line, fmt):
+    out.write('%s = {\n' % name)
+    for i in range(0, len(values), per_line):
+        out.write('    ' + ', '.join(fmt % v for v in values[i:i + per_line]) + ',\n')
+    out.write('};\n\n')
+
+def convert(out, scale):
+    filename = os.path.join('..', 'resources', 'hq%dx.png' % scale)
+    width, height, rows = read_png(filename)
+    subpixels = scale * scale
+    assert width == 256 and height == 16 * subpixels
+
+    palette, blocks, index = {}, {}, []
+    for cross in range(16):
+        for pattern in range(256):
+            block = []
+            for subpixel in range(subpixels):
+                row = rows[cross * subpixels + subpixel]
+                texel = normalise(tuple(row[pattern * 4:pattern * 4 + 4]))
+                block.append(palette.setdefault(texel, len(palette)))
+            index.append(blocks.setdefault(tuple(block), len(blocks)))
+
+    packed = [w1 | w2 << 8 | w3 << 16 | w4 << 24 for (w1, w2, w3, w4) in palette]
+    flat = [entry for block in blocks for entry in block]
+
+    out.write('// resources/hq%dx.png: %d texels, %d blocks\n' % (scale, len(palette), len(blocks)))
+    write_table(out, 'static const uint32_t hq%dx_palette[]' % scale, packed, 6, '0x%08x')
+    write_table(out, 'static const uint8_t hq%dx_blocks[][%d]' % (scale, subpixels), flat, 16, '%d')
+    write_table(out, 'static const uint16_t hq%dx_index[4096]' % scale, index, 16, '%d')
+
+if __name__ == '__main__':
+    with open('lut_data.inc', 'w') as out:
+        out.write('// Generated by gen_lut.py, do not edit.\n\n')
+        for scale in (2, 3, 4):
+            convert(out, scale)
@@ -0,0 +1,540 @@
+/* hqx.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "context.h"
+#include "classify.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <vector>
+
+// The source is upscaled in bands of rows, so the index map of a band is
+// still in the cache when it's blended. The YUV output relies on the bands
+// being an even number of rows.
+static const int band_rows = 16;
+
+// The scratch memory of a frame
+struct buffers
+{
+    uint16_t* index;
+    uint32_t* window;
+    uint32_t* pixels; // source rows converted to 32-bit
+    uint32_t* output; // 32-bit output of a band before it's converted to another format
+};
+
+// Takes the buffers from an arena or adds up their size with an arena_layout
+template <typename Allocator>
+static buffers allocate(Allocator& memory, int width, int height, int scale, bool band_input, bool band_output)
+{
+    const size_t band = std::min(height, band_rows);
+
+    buffers b = {};
+    b.index = memory.template allocate<uint16_t>(band * width);
+    b.window = memory.template allocate<uint32_t>(hqx::window_size(width));
+    if (band_input)
+    {
+        // A band and the rows around it
+        b.pixels = memory.template allocate<uint32_t>((band + 2) * width);
+    }
+    if (band_output)
+        b.output = memory.template allocate<uint32_t>(band * scale * width * scale);
+    return b;
+}
+
+int hqx::pixel_size(hqx_format format)
+{
+    switch (format)
+    {
+    case HQX_FORMAT_RGBA8888:
+    case HQX_FORMAT_XRGB8888:
+        return 4;
+    case HQX_FORMAT_RGB565:
+        return 2;
+    case HQX_FORMAT_RGBA16161616:
+        return 8;
+    }
+    return 0;
+}
+
+// Converts to XRGB8888, the low bits are filled by repeating the high bits
+void hqx::expand_rgb565(const uint16_t* src, int width, uint32_t* dst)
+{
+    for (int x = 0; x < width; x++)
+    {
+        uint32_t r = src[x] >> 11, g = src[x] >> 5 & 0x3F, b = src[x] & 0x1F;
+        r = r << 3 | r >> 2;
+        g = g << 2 | g >> 4;
+        b = b << 3 | b >> 2;
+        dst[x] = 0xFF000000 | r << 16 | g << 8 | b;
+    }
+}
+
+void hqx::pack_rgb565(const uint32_t* src, int width, uint16_t* dst)
+{
+    for (int x = 0; x < width; x++)
+        dst[x] = (uint16_t)((src[x] >> 8 & 0xF800) | (src[x] >> 5 & 0x07E0) | (src[x] >> 3 & 0x001F));
+}
+
+hqx_context* hqx_create(int scale)
+{
+    if (scale < 2 || scale > 4)
+        return nullptr;
+
+    hqx_context* ctx = new (std::nothrow) hqx_context;
+    if (!ctx)
+        return nullptr;
+
+    try
+    {
+        ctx->table = &hqx::get_lut(scale);
+    }
+    catch (const std::bad_alloc&)
+    {
+        delete ctx;
+        return nullptr;
+    }
+    return ctx;
+}
+
+void hqx_destroy(hqx_context* ctx)
+{
+    delete ctx;
+}
+
+int hqx_get_scale(const hqx_context* ctx)
+{
+    return ctx ? ctx->table->scale : 0;
+}
+
+uint64_t hqx_get_fingerprint(const hqx_context* ctx)
+{
+    if (!ctx)
+        return 0;
+
+    // FNV-1a over the weights and the thresholds
+    uint64_t hash = 0xCBF29CE484222325ull;
+    auto add = [&hash](uint32_t value) {
+        for (int i = 0; i < 4; i++)
+            hash = (hash ^ (value >> i * 8 & 0xFF)) * 0x100000001B3ull;
+    };
+
+    add(ctx->table->scale);
+    for (size_t i = 0; i < ctx->table->size; i++)
+        add(ctx->table->weights[i]);
+    add(hqx::threshold_y);
+    add(hqx::threshold_u);
+    add(hqx::threshold_v);
+
+    // Only added when it's on, so the fingerprints of output blended on the
+    // encoded values stay the same
+    if (ctx->linear_light)
+        add(1);
+    return hash;
+}
+
+hqx_status hqx_set_traversal(hqx_context* ctx, hqx_traversal traversal, int tile_size)
+{
+    if (!ctx || traversal < HQX_TRAVERSAL_ROWS || traversal > HQX_TRAVERSAL_MORTON || tile_size < 0 ||
+        (tile_size && tile_size < band_rows))
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    ctx->traversal = traversal;
+    ctx->tile_size = tile_size ? tile_size : 128;
+    return HQX_OK;
+}
+
+hqx_status hqx_set_stores(hqx_context* ctx, hqx_stores stores)
+{
+    if (!ctx || stores < HQX_STORES_AUTO || stores > HQX_STORES_STREAMING)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    ctx->stores = stores;
+    return HQX_OK;
+}
+
+hqx_status hqx_set_strategy(hqx_context* ctx, hqx_strategy strategy)
+{
+    if (!ctx || strategy < HQX_STRATEGY_TWO_PASS || strategy > HQX_STRATEGY_FUSED)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    ctx->strategy = strategy;
+    return HQX_OK;
+}
+
+hqx_strategy hqx_select_strategy(hqx_context* ctx)
+{
+    if (!ctx)
+        return HQX_STRATEGY_TWO_PASS;
+
+    // The fastest strategy only depends on the machine and the scale, it's
+    // stored plus one so zero means it hasn't been measured
+    static std::atomic<int> selected[5];
+    const int scale = ctx->table->scale;
+    if (int known = selected[scale].load())
+        return ctx->strategy = (hqx_strategy)(known - 1);
+
+    // Timed on a context of its own with the default settings, so the
+    // settings of the caller's context don't decide the strategy for every
+    // later context, and its arena isn't sized for the test frame
+    hqx_context* timing = hqx_create(scale);
+    if (!timing)
+        return ctx->strategy;
+
+    // Pixel art in flat rectangles with some noise, large enough that the
+    // index map of the two passes leaves the L1 cache
+    const int width = 512, height = 64;
+    std::vector<uint32_t> frame, output;
+    try
+    {
+        frame.resize(width * height);
+        output.resize(width * scale * height * scale);
+    }
+    catch (const std::bad_alloc&)
+    {
+        hqx_destroy(timing);
+        return ctx->strategy;
+    }
+    uint32_t noise = 1;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            noise = noise * 1664525 + 1013904223;
+            frame[y * width + x] = ((x / 11) ^ (y / 9)) % 4 ? 0xFF2060A0 + ((x / 11 + y / 9) % 3 << 8) : noise;
+        }
+    }
+
+    hqx_strategy best = HQX_STRATEGY_TWO_PASS;
+    double best_time = 1e9;
+    for (int strategy = HQX_STRATEGY_TWO_PASS; strategy <= HQX_STRATEGY_FUSED; strategy++)
+    {
+        timing->strategy = (hqx_strategy)strategy;
+        for (int run = 0; run < 5; run++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (hqx_upscale(timing, frame.data(), width * 4, output.data(), width * scale * 4, width, height,
+                            HQX_FORMAT_XRGB8888) != HQX_OK)
+                break;
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (elapsed.count() < best_time)
+            {
+                best_time = elapsed.count();
+                best = timing->strategy;
+            }
+        }
+    }
+    hqx_destroy(timing);
+
+    selected[scale] = best + 1;
+    return ctx->strategy = best;
+}
+
+hqx_status hqx_set_linear_light(hqx_context* ctx, int enable)
+{
+    if (!ctx)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    ctx->linear_light = enable != 0;
+    return HQX_OK;
+}
+
+hqx_status hqx_set_huge_pages(hqx_context* ctx, int enable)
+{
+    if (!ctx)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    const int scale = ctx->table->scale;
+    try
+    {
+        ctx->table = enable ? &hqx::get_lut_huge(scale) : &hqx::get_lut(scale);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return HQX_ERROR_OUT_OF_MEMORY;
+    }
+    ctx->scratch.use_huge_pages(enable != 0);
+    return HQX_OK;
+}
+
+void* hqx_alloc_buffer(size_t size, hqx_pages* pages)
+{
+    // The kinds of pages are in the same order as hqx_pages
+    hqx::page_kind kind = hqx::pages_normal;
+    void* buffer = size ? hqx::allocate_huge(size, &kind) : nullptr;
+    if (pages)
+        *pages = (hqx_pages)kind;
+    return buffer;
+}
+
+void hqx_free_buffer(void* buffer, size_t size)
+{
+    hqx::free_huge(buffer, size);
+}
+
+uint64_t hqx_get_allocation_count(const hqx_context* ctx)
+{
+    return ctx ? ctx->scratch.allocations + ctx->state_allocations : 0;
+}
+
+hqx_status hqx_reserve(hqx_context* ctx, int width, int height, hqx_format format)
+{
+    if (!ctx || width <= 0 || height <= 0 || !hqx::pixel_size(format))
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    hqx::arena_layout layout;
+    // Wide frames are classified and blended in place like 32-bit frames
+    const bool rgb565 = format == HQX_FORMAT_RGB565;
+    allocate(layout, width, height, ctx->table->scale, rgb565, rgb565);
+    return ctx->scratch.reset(layout.size) ? HQX_OK : HQX_ERROR_OUT_OF_MEMORY;
+}
+
+hqx_status hqx_upscale(hqx_context* ctx,
+                       const void* src, ptrdiff_t src_stride,
+                       void* dst, ptrdiff_t dst_stride,
+                       int width, int height, hqx_format format)
+{
+    return hqx_upscale_rows(ctx, src, src_stride, dst, dst_stride, width, height, 0, height, format);
+}
+
+static void read_rgb565(const hqx::source& src, int y, uint32_t* row, int width)
+{
+    hqx::expand_rgb565((const uint16_t*)((const uint8_t*)src.pixels + y * src.stride), width, row);
+}
+
+// Upscales the rows [y0, y1) of a frame of 16-bit channels in bands. There's
+// only the two passes over whole rows, the strategy, traversal and stores of
+// the context are for 32-bit output.
+static hqx_status upscale_wide(hqx_context* ctx, const void* src, ptrdiff_t src_stride, int width, int height,
+                               int y0, int y1, void* dst, ptrdiff_t dst_stride)
+{
+    const int scale = ctx->table->scale;
+    hqx::arena_layout layout;
+    allocate(layout, width, height, scale, false, false);
+    if (!ctx->scratch.reset(layout.size))
+        return HQX_ERROR_OUT_OF_MEMORY;
+
+    const buffers scratch = allocate(ctx->scratch, width, height, scale, false, false);
+    const hqx::wide_image image = { (const uint16_t*)src, src_stride / 8, width, height };
+    const ptrdiff_t out_stride = dst_stride / 8;
+    for (int b0 = y0; b0 < y1; b0 += band_rows)
+    {
+        const int b1 = std::min(b0 + band_rows, y1);
+        hqx::classify_wide(image, b0, b1, scratch.index, scratch.window);
+        hqx::blend_wide(*ctx->table, image, b0, b1, scratch.index, (uint16_t*)dst + b0 * scale * out_stride * 4,
+                        out_stride);
+    }
+    return HQX_OK;
+}
+
+hqx::source hqx::packed_source(const void* pixels, ptrdiff_t stride, hqx_format format)
+{
+    source src = { pixels, stride, format == HQX_FORMAT_RGBA8888 ? order_rgba : order_bgra, nullptr, nullptr,
+                   nullptr };
+    if (format == HQX_FORMAT_RGB565)
+        src.read = read_rgb565;
+    return src;
+}
+
+// Packs the output of a band into RGB565 rows
+struct rgb565_writer
+{
+    uint8_t* dst;
+    ptrdiff_t stride;
+
+    static void write(void* user, int y0, int y1, const uint32_t* output, ptrdiff_t output_stride, int width)
+    {
+        const rgb565_writer& w = *(const rgb565_writer*)user;
+        for (int y = y0; y < y1; y++)
+            hqx::pack_rgb565(output + (y - y0) * output_stride, width, (uint16_t*)(w.dst + y * w.stride));
+    }
+};
+
+hqx_status hqx_upscale_rows(hqx_context* ctx,
+                            const void* src, ptrdiff_t src_stride,
+                            void* dst, ptrdiff_t dst_stride,
+                            int width, int height, int y0, int y1, hqx_format format)
+{
+    const int size = hqx::pixel_size(format);
+    if (!ctx || !src || !dst || !size || width <= 0 || src_stride % size || dst_stride % size ||
+        (uintptr_t)src % size || (uintptr_t)dst % size || y0 < 0 || y1 > height || y0 >= y1)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    if (hqx::wide_format(format))
+        return upscale_wide(ctx, src, src_stride, width, height, y0, y1, dst, dst_stride);
+    return hqx::upscale_packed(ctx, hqx::packed_source(src, src_stride, format), width, height, y0, y1, dst,
+                               dst_stride, format);
+}
+
+hqx_status hqx::upscale_packed(hqx_context* ctx, const source& src, int width, int height, int y0, int y1,
+                               void* dst, ptrdiff_t dst_stride, hqx_format format)
+{
+    if (format != HQX_FORMAT_RGB565)
+        return upscale_bands(ctx, src, width, height, y0, y1, (uint32_t*)dst, dst_stride / 4, nullptr, nullptr);
+
+    rgb565_writer writer = { (uint8_t*)dst, dst_stride };
+    return upscale_bands(ctx, src, width, height, y0, y1, nullptr, 0, rgb565_writer::write, &writer);
+}
+
+hqx::image hqx::read_rows(const source& src, int width, int top, int bottom, uint32_t* pixels)
+{
+    if (!src.read)
+    {
+        const uint8_t* bytes = (const uint8_t*)src.pixels + top * src.stride;
+        return { (const uint32_t*)bytes, src.stride / 4, width, bottom - top, src.channels };
+    }
+
+    for (int y = top; y < bottom; y++)
+        src.read(src, y, pixels + (y - top) * width, width);
+    return { pixels, width, width, bottom - top, src.channels };
+}
+
+// Classifies and blends the columns [x0, x1) of the rows [y0, y1) of an image
+// with the strategy of the context
+static void upscale_image(const hqx_context* ctx, const hqx::image& image, int y0, int y1, int x0, int x1,
+                          const buffers& scratch, uint32_t* dst, ptrdiff_t dst_stride, bool stream)
+{
+    const hqx::lut& table = *ctx->table;
+    const hqx::blend_kernel kernel = hqx::context_kernel(ctx, image.channels);
+    if (kernel == hqx::kernel_linear)
+    {
+        hqx::classify(image, y0, y1, scratch.index, scratch.window);
+        hqx::blend_columns_with(kernel, table, image, y0, y1, x0, x1, scratch.index, dst, dst_stride, false);
+        return;
+    }
+
+    switch (ctx->strategy)
+    {
+    case HQX_STRATEGY_SINGLE_PASS:
+        hqx::upscale_single_pass(table, image, y0, y1, x0, x1, dst, dst_stride, stream);
+        break;
+    case HQX_STRATEGY_FUSED:
+        hqx::upscale_fused(table, image, y0, y1, x0, x1, scratch.window, dst, dst_stride, stream);
+        break;
+    default:
+        hqx::classify(image, y0, y1, scratch.index, scratch.window);
+        hqx::blend_columns(table, image, y0, y1, x0, x1, scratch.index, dst, dst_stride, stream);
+        break;
+    }
+}
+
+// Upscales the columns [x0, x1) of the source rows [y0, y1) in bands. The
+// bands are classified with a column of the source on either side, so the
+// output is the same as when whole rows are upscaled.
+static void upscale_tile(const hqx_context* ctx, const hqx::source& src, const buffers& scratch, int width,
+                         int height, int x0, int x1, int y0, int y1, uint32_t* dst, ptrdiff_t dst_stride, bool stream)
+{
+    const int scale = ctx->table->scale;
+    const int left = std::max(x0 - 1, 0), right = std::min(x1 + 1, width);
+    for (int b0 = y0; b0 < y1; b0 += band_rows)
+    {
+        const int b1 = std::min(b0 + band_rows, y1);
+        const int top = std::max(b0 - 1, 0), bottom = std::min(b1 + 1, height);
+        hqx::image image = hqx::read_rows(src, width, top, bottom, scratch.pixels);
+        image.pixels += left;
+        image.width = right - left;
+
+        upscale_image(ctx, image, b0 - top, b1 - top, x0 - left, x1 - left, scratch,
+                      dst + b0 * scale * dst_stride + x0 * scale, dst_stride, stream);
+    }
+}
+
+// Visits the tiles of the rows [y0, y1) in the order of the traversal
+static void upscale_tiles(const hqx_context* ctx, const hqx::source& src, const buffers& scratch, int width,
+                          int height, int y0, int y1, uint32_t* dst, ptrdiff_t dst_stride, bool stream)
+{
+    const int size = ctx->tile_size;
+    if (ctx->traversal == HQX_TRAVERSAL_COLUMNS)
+    {
+        for (int x0 = 0; x0 < width; x0 += size)
+            upscale_tile(ctx, src, scratch, width, height, x0, std::min(x0 + size, width), y0, y1, dst, dst_stride,
+                         stream);
+        return;
+    }
+
+    // The bits of a Morton code alternate between the x and y of the tile,
+    // the codes past the edges of the grid are skipped
+    const uint32_t tiles_x = (width + size - 1) / size, tiles_y = (y1 - y0 + size - 1) / size;
+    uint32_t side = 1;
+    while (side < std::max(tiles_x, tiles_y))
+        side *= 2;
+
+    for (uint64_t code = 0; code < (uint64_t)side * side; code++)
+    {
+        uint32_t tx = 0, ty = 0;
+        for (int bit = 0; (side >> bit) > 1; bit++)
+        {
+            tx |= (uint32_t)(code >> (2 * bit) & 1) << bit;
+            ty |= (uint32_t)(code >> (2 * bit + 1) & 1) << bit;
+        }
+        if (tx >= tiles_x || ty >= tiles_y)
+            continue;
+
+        const int x0 = tx * size, ty0 = y0 + ty * size;
+        upscale_tile(ctx, src, scratch, width, height, x0, std::min(x0 + size, width), ty0,
+                     std::min(ty0 + size, y1), dst, dst_stride, stream);
+    }
+}
+
+// Frames whose output doesn't fit in the last level cache would evict the
+// source and read every output line before overwriting it
+static bool stream_output(const hqx_context* ctx, int width, int height)
+{
+    if (ctx->stores != HQX_STORES_AUTO)
+        return ctx->stores == HQX_STORES_STREAMING;
+
+    static const size_t llc = hqx::llc_size();
+    const int scale = ctx->table->scale;
+    return (size_t)width * scale * height * scale * sizeof(uint32_t) > llc;
+}
+
+hqx_status hqx::upscale_bands(hqx_context* ctx, const source& src, int width, int height, int y0, int y1,
+                              uint32_t* dst, ptrdiff_t dst_stride, band_writer write, void* user)
+{
+    const int scale = ctx->table->scale;
+    hqx::arena_layout layout;
+    allocate(layout, width, height, scale, src.read != nullptr, !dst);
+    if (!ctx->scratch.reset(layout.size))
+        return HQX_ERROR_OUT_OF_MEMORY;
+
+    const buffers scratch = allocate(ctx->scratch, width, height, scale, src.read != nullptr, !dst);
+    const bool stream = dst && stream_output(ctx, width, height);
+
+    // The tiles read the source in place and write the output in place
+    if (ctx->traversal != HQX_TRAVERSAL_ROWS && dst && !src.read && !src.index)
+    {
+        upscale_tiles(ctx, src, scratch, width, height, y0, y1, dst, dst_stride, stream);
+        return HQX_OK;
+    }
+
+    for (int b0 = y0; b0 < y1; b0 += band_rows)
+    {
+        const int b1 = std::min(b0 + band_rows, y1);
+
+        // The band with the rows around it, only the edges of the whole
+        // image are repeated
+        const int top = std::max(b0 - 1, 0), bottom = std::min(b1 + 1, height);
+        const hqx::image image = hqx::read_rows(src, width, top, bottom, scratch.pixels);
+
+        uint32_t* out = dst ? dst + b0 * scale * dst_stride : scratch.output;
+        const ptrdiff_t out_stride = dst ? dst_stride : width * scale;
+        if (!src.index)
+            upscale_image(ctx, image, b0 - top, b1 - top, 0, width, scratch, out, out_stride, stream);
+        else if (src.index->read(scratch.index, (size_t)(b1 - b0) * width))
+            hqx::blend_columns_with(hqx::context_kernel(ctx, image.channels), *ctx->table, image, b0 - top,
+                                    b1 - top, 0, width, scratch.index, out, out_stride, stream);
+        else
+            return HQX_ERROR_INVALID_ARGUMENT;
+
+        if (!dst)
+            write(user, b0 * scale, b1 * scale, scratch.output, width * scale, width * scale);
+    }
+    return HQX_OK;
+}
@@ -0,0 +1,413 @@
+/* hqx.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#ifndef HQX_H
+#define HQX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(HQX_SHARED)
+#  if defined(_WIN32) && defined(HQX_BUILD)
+#    define HQX_API __declspec(dllexport)
+#  elif defined(_WIN32)
+#    define HQX_API __declspec(dllimport)
+#  else
+#    define HQX_API __attribute__((visibility("default")))
+#  endif
+#else
+#  define HQX_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Pixel formats, the output is written in the same format as the input.
+ * HQX_FORMAT_RGBA16161616 is only taken by hqx_reserve, hqx_upscale,
+ * hqx_upscale_rows, hqx_upscale_file, the upscaler, the pool and the
+ * scheduler, the other functions return HQX_ERROR_INVALID_ARGUMENT. */
+typedef enum hqx_format
+{
+    HQX_FORMAT_RGBA8888     = 0, /* R, G, B, A bytes, alpha is interpolated but not compared */
+    HQX_FORMAT_XRGB8888     = 1, /* 32-bit words holding 0xXXRRGGBB in native byte order */
+    HQX_FORMAT_RGB565       = 2, /* 16-bit words holding 5-6-5 bits of R, G, B in native byte order */
+    HQX_FORMAT_RGBA16161616 = 3  /* R, G, B, A 16-bit words in native byte order, alpha as in RGBA8888 */
+} hqx_format;
+
+typedef enum hqx_status
+{
+    HQX_OK = 0,
+    HQX_ERROR_INVALID_ARGUMENT = -1,
+    HQX_ERROR_OUT_OF_MEMORY = -2,
+    HQX_ERROR_IO = -3
+} hqx_status;
+
+typedef struct hqx_context hqx_context;
+
+/* Creates a context for the given scale (2, 3 or 4), returns NULL on failure.
+ * A context may be used by one thread at a time. */
+HQX_API hqx_context* hqx_create(int scale);
+
+HQX_API void hqx_destroy(hqx_context* ctx);
+
+HQX_API int hqx_get_scale(const hqx_context* ctx);
+
+/* Allocates the memory needed to upscale frames of up to width by height
+ * pixels in the given format. This is done by hqx_upscale when a frame is
+ * larger than any before it, calling it up front ensures that hqx_upscale
+ * never allocates. */
+HQX_API hqx_status hqx_reserve(hqx_context* ctx, int width, int height, hqx_format format);
+
+/* Identifies everything besides the source that the output of the context
+ * depends on: the scale, the look-up tables and the thresholds. Output that
+ * was stored along with the fingerprint can be reused while it stays the
+ * same. */
+HQX_API uint64_t hqx_get_fingerprint(const hqx_context* ctx);
+
+/* Backs the look-up tables and the scratch memory of the context, such as the
+ * index maps, with 2 MiB huge pages where the system allows it. This saves
+ * TLB misses on the random look-ups into the tables and the sweeps over
+ * large frames. */
+HQX_API hqx_status hqx_set_huge_pages(hqx_context* ctx, int enable);
+
+/* The kind of pages that back a buffer from hqx_alloc_buffer. Explicit huge
+ * pages come from the pool reserved in vm.nr_hugepages on Linux, transparent
+ * huge pages are given by the kernel where it has them to spare. */
+typedef enum hqx_pages
+{
+    HQX_PAGES_NORMAL      = 0,
+    HQX_PAGES_TRANSPARENT = 1,
+    HQX_PAGES_EXPLICIT    = 2
+} hqx_pages;
+
+/* Allocates a buffer for large frames on huge pages where possible, falling
+ * back to normal pages. pages may be NULL. The buffer is freed with
+ * hqx_free_buffer with the same size. */
+HQX_API void* hqx_alloc_buffer(size_t size, hqx_pages* pages);
+HQX_API void hqx_free_buffer(void* buffer, size_t size);
+
+/* Number of times the context allocated memory from the heap, for scratch
+ * memory or the state of the video and progressive modes. The memory is sized
+ * by the largest frame so far, so this stays the same while frames don't grow
+ * and no other heap allocations are made per frame. hqx-bench checks it. */
+HQX_API uint64_t hqx_get_allocation_count(const hqx_context* ctx);
+
+/* Upscales a width by height image into dst, which must have room for
+ * width*scale by height*scale pixels. Strides are in bytes and may be
+ * negative for bottom-up images. The output is written directly into dst,
+ * the source and destination must not overlap. */
+HQX_API hqx_status hqx_upscale(hqx_context* ctx,
+                               const void* src, ptrdiff_t src_stride,
+                               void* dst, ptrdiff_t dst_stride,
+                               int width, int height, hqx_format format);
+
+/* Upscales only the source rows [y0, y1) of the image, which writes the
+ * output rows [y0*scale, y1*scale) of dst. src and dst point at the whole
+ * images, so the rows around the range are taken into account. Ranges can
+ * be upscaled in parallel, using a context for every thread. */
+HQX_API hqx_status hqx_upscale_rows(hqx_context* ctx,
+                                    const void* src, ptrdiff_t src_stride,
+                                    void* dst, ptrdiff_t dst_stride,
+                                    int width, int height, int y0, int y1, hqx_format format);
+
+/* Index map sidecars (.hqxidx) for static images such as sprite sheets. The
+ * 12-bit index of every pixel only depends on the source, so it can be stored
+ * once and loaded to skip the classification at every scale. The format is
+ * little-endian:
+ *
+ *   8 bytes   "HQXIDX" followed by the version 1 and a zero byte
+ *   4 bytes   width
+ *   4 bytes   height
+ *   12 bytes  Y, U and V thresholds of the classification, scaled by 1000
+ *   runs      varints of (run length - 1) << 12 | index, in row order
+ *
+ * The varints hold 7 bits per byte with the high bit set on all but the last
+ * byte. The runs add up to exactly width * height entries. */
+
+/* Upper bound of the size of the sidecar of a width by height image */
+HQX_API size_t hqx_index_bound(int width, int height);
+
+/* Classifies the image and writes its sidecar into data, which has room for
+ * capacity bytes. size receives the number of bytes written. */
+HQX_API hqx_status hqx_index_save(hqx_context* ctx,
+                                  const void* src, ptrdiff_t src_stride,
+                                  int width, int height, hqx_format format,
+                                  void* data, size_t capacity, size_t* size);
+
+/* Checks a sidecar and returns the size of its image. Sidecars made with
+ * other thresholds than those of this library are rejected. */
+HQX_API hqx_status hqx_index_info(const void* data, size_t size, int* width, int* height);
+
+/* Like hqx_upscale, but the index map is decoded from the sidecar of the
+ * image instead of being computed. The sidecar must be made from the same
+ * pixels, which is not checked. */
+HQX_API hqx_status hqx_upscale_indexed(hqx_context* ctx,
+                                       const void* src, ptrdiff_t src_stride,
+                                       void* dst, ptrdiff_t dst_stride,
+                                       int width, int height, hqx_format format,
+                                       const void* index, size_t index_size);
+
+/* Out-of-core mode for images larger than memory, such as stitched maps. The
+ * source is a file of raw pixels in the given format, rows of width pixels
+ * without padding starting src_offset bytes into the file. It's mapped into
+ * memory a strip of rows at a time and every strip is upscaled in tiles on
+ * several threads. The output is written to dst_path as rows of width*scale
+ * pixels without padding starting dst_offset bytes into the file, the bytes
+ * in front of it are kept so a header can be written first. The mapped strip
+ * and the output of the tiles are sized to stay within memory_budget bytes
+ * whatever the size of the image. threads 0 uses one thread per core. */
+HQX_API hqx_status hqx_upscale_file(int scale,
+                                    const char* src_path, uint64_t src_offset,
+                                    const char* dst_path, uint64_t dst_offset,
+                                    int width, int height, hqx_format format,
+                                    int threads, size_t memory_budget);
+
+/* The order in which hqx_upscale and hqx_upscale_rows work through a frame
+ * with 32-bit pixels. Rows take bands of rows across the whole width, which
+ * suits most frames. On very wide images the rows above a band are evicted
+ * from the cache before the band below needs them, the other orders work in
+ * tiles of tile_size pixels. */
+typedef enum hqx_traversal
+{
+    HQX_TRAVERSAL_ROWS    = 0, /* bands of rows from top to bottom */
+    HQX_TRAVERSAL_COLUMNS = 1, /* strips of tile_size columns, each from top to bottom */
+    HQX_TRAVERSAL_MORTON  = 2  /* square tiles in Z-order */
+} hqx_traversal;
+
+/* tile_size 0 picks the default of 128 pixels. RGB565 frames are always
+ * upscaled in rows. */
+HQX_API hqx_status hqx_set_traversal(hqx_context* ctx, hqx_traversal traversal, int tile_size);
+
+/* How hqx_upscale and hqx_upscale_rows store 32-bit output. Streaming stores
+ * write whole cache lines past the cache, which saves reading every line of
+ * the output before it's overwritten but leaves the output out of the cache.
+ * The default streams frames whose output is larger than the last level
+ * cache. */
+typedef enum hqx_stores
+{
+    HQX_STORES_AUTO      = 0,
+    HQX_STORES_CACHED    = 1,
+    HQX_STORES_STREAMING = 2
+} hqx_stores;
+
+HQX_API hqx_status hqx_set_stores(hqx_context* ctx, hqx_stores stores);
+
+/* How the two passes of HQx are combined. The two-pass strategy classifies a
+ * band of rows into an index map and then blends it, like the shaders in cg.
+ * The single pass classifies every pixel right before blending it, like the
+ * shaders in single-pass. The fused strategy classifies small tiles into a
+ * buffer on the stack and blends each tile while its source is still in the
+ * L1 cache. The output is the same with every strategy. */
+typedef enum hqx_strategy
+{
+    HQX_STRATEGY_TWO_PASS    = 0,
+    HQX_STRATEGY_SINGLE_PASS = 1,
+    HQX_STRATEGY_FUSED       = 2
+} hqx_strategy;
+
+HQX_API hqx_status hqx_set_strategy(hqx_context* ctx, hqx_strategy strategy);
+
+/* Times the strategies on a test frame, in a context of its own with the
+ * default settings, and sets the fastest one for this machine. The frame is
+ * only timed the first time it's called for a scale, which takes a few
+ * milliseconds, later calls set the same strategy. */
+HQX_API hqx_strategy hqx_select_strategy(hqx_context* ctx);
+
+/* Blends the pixels in linear light instead of the gamma-encoded values,
+ * which keeps blended edges from coming out darker than the colours on
+ * either side. The source is taken to be sRGB and converted with look-up
+ * tables, alpha is blended as it is. The pixels are still compared on the
+ * encoded values, so the index map doesn't change. The linear blend has no
+ * vector kernels and ignores the strategy and stores, hqx-bench measures
+ * its cost. YUV frames and frames of 16-bit channels are always blended as
+ * they are. */
+HQX_API hqx_status hqx_set_linear_light(hqx_context* ctx, int enable);
+
+/* Planar YUV frames for video encoders, with BT.601 limited range colours.
+ * The chroma planes have half the width and height of the luma plane,
+ * rounded up. */
+typedef enum hqx_yuv_format
+{
+    HQX_YUV_I420 = 0, /* Y, U and V planes */
+    HQX_YUV_NV12 = 1  /* Y plane and a plane of interleaved U and V */
+} hqx_yuv_format;
+
+typedef struct hqx_yuv_planes
+{
+    uint8_t* planes[3]; /* NV12 only uses the first two */
+    ptrdiff_t strides[3];
+} hqx_yuv_planes;
+
+/* Like hqx_upscale, but writes the output as planar YUV. The output of each
+ * band of rows is converted while it's still in the cache, so the frame is
+ * never written out in RGB. */
+HQX_API hqx_status hqx_upscale_to_yuv(hqx_context* ctx,
+                                      const void* src, ptrdiff_t src_stride,
+                                      int width, int height, hqx_format format,
+                                      const hqx_yuv_planes* dst, hqx_yuv_format yuv_format);
+
+/* Upscales planar YUV video, such as captured frames on their way to an
+ * encoder, without converting it to RGB. The pixels are compared in YUV with
+ * the thresholds rescaled to limited range and blended in YUV, the planes of
+ * src are only read. */
+HQX_API hqx_status hqx_upscale_yuv(hqx_context* ctx,
+                                   const hqx_yuv_planes* src, hqx_yuv_format src_format,
+                                   int width, int height,
+                                   const hqx_yuv_planes* dst, hqx_yuv_format dst_format);
+
+typedef struct hqx_video_stats
+{
+    uint32_t pixels;     /* source pixels in the frame */
+    uint32_t changed;    /* pixels that differ from the last frame */
+    uint32_t recomputed; /* pixels that were classified and blended again */
+    double reuse_ratio;  /* share of the pixels that kept their output */
+} hqx_video_stats;
+
+/* Video mode for frames that mostly repeat the last one. The context keeps
+ * the last frame and its index map, and only the pixels whose neighbourhood
+ * changed are classified and blended again. The rest of the output is kept,
+ * which requires dst to be the same buffer as in the last call, untouched
+ * in between. Otherwise the whole frame is upscaled. stats may be NULL. */
+HQX_API hqx_status hqx_upscale_video(hqx_context* ctx,
+                                     const void* src, ptrdiff_t src_stride,
+                                     void* dst, ptrdiff_t dst_stride,
+                                     int width, int height, hqx_format format,
+                                     hqx_video_stats* stats);
+
+/* Tiles of the progressive mode, flags[tile_y * tiles_x + tile_x] is nonzero
+ * where the tile holds the HQx output and zero where it's still scaled with
+ * nearest neighbour */
+typedef struct hqx_progress
+{
+    int tile_size; /* source pixels along the side of a tile */
+    int tiles_x, tiles_y;
+    int refined;   /* number of tiles with HQx output */
+    const uint8_t* flags; /* valid until the next call with the same context */
+} hqx_progress;
+
+/* Progressive mode for frames that might not be upscaled in time: the whole
+ * frame is scaled with nearest neighbour first, then tiles are upscaled with
+ * HQx until budget_us microseconds have passed. Tiles with the most edges go
+ * first, tiles of a single colour look the same either way and are skipped.
+ * Tiles that were left over in the last frame and haven't changed since go
+ * before all others. When dst is the same buffer as in the last call and
+ * wasn't touched in between, unchanged tiles keep their HQx output, so a
+ * still image is complete after a few frames. progress may be NULL. */
+HQX_API hqx_status hqx_upscale_progressive(hqx_context* ctx,
+                                           const void* src, ptrdiff_t src_stride,
+                                           void* dst, ptrdiff_t dst_stride,
+                                           int width, int height, hqx_format format,
+                                           uint32_t budget_us, hqx_progress* progress);
+
+/* Threaded front-end that upscales the frames of an emulator on a thread of
+ * its own. The emulator writes a frame into hqx_upscaler_input and submits it,
+ * which never blocks. The upscaler always works on the newest submitted frame
+ * and frames that are replaced before it gets to them are dropped. The
+ * presenting thread takes the newest upscaled frame with hqx_upscaler_output. */
+typedef struct hqx_upscaler hqx_upscaler;
+
+typedef struct hqx_upscaler_stats
+{
+    uint64_t submitted;  /* frames submitted by the emulator */
+    uint64_t upscaled;   /* frames upscaled */
+    uint64_t presented;  /* new frames returned by hqx_upscaler_output */
+    uint64_t dropped;    /* frames replaced before they were upscaled or presented */
+    uint64_t duplicated; /* calls to hqx_upscaler_output that returned the last frame again */
+} hqx_upscaler_stats;
+
+/* Starts the upscaling thread for frames of up to max_width by max_height
+ * pixels, returns NULL on failure */
+HQX_API hqx_upscaler* hqx_upscaler_create(int scale, int max_width, int max_height, hqx_format format);
+
+HQX_API void hqx_upscaler_destroy(hqx_upscaler* upscaler);
+
+/* Emulator thread: the buffer to write the next frame into, which stays the
+ * same until the frame is submitted. The stride is in bytes. */
+HQX_API void* hqx_upscaler_input(hqx_upscaler* upscaler, ptrdiff_t* stride);
+
+HQX_API hqx_status hqx_upscaler_submit(hqx_upscaler* upscaler, int width, int height);
+
+/* Presenting thread: the newest upscaled frame, which stays valid until the
+ * next call. Returns NULL until the first frame has been upscaled. */
+HQX_API const void* hqx_upscaler_output(hqx_upscaler* upscaler, int* width, int* height, ptrdiff_t* stride);
+
+HQX_API void hqx_upscaler_get_stats(const hqx_upscaler* upscaler, hqx_upscaler_stats* stats);
+
+/* Low-latency mode that upscales a single frame on several cores. Every
+ * thread upscales a fixed band of rows, the calling thread takes the first
+ * band and is left where it runs. The pool's own threads are pinned to the
+ * cores after the first and spin for spin_us microseconds between frames
+ * before they go to sleep, so frames that follow each other closely start
+ * without waking threads up. A pool may be used by one thread
+ * at a time. */
+typedef struct hqx_pool hqx_pool;
+
+/* threads includes the calling thread, 0 uses one thread per core. Returns
+ * NULL on failure. */
+HQX_API hqx_pool* hqx_pool_create(int scale, int threads, int spin_us);
+
+HQX_API void hqx_pool_destroy(hqx_pool* pool);
+
+HQX_API int hqx_pool_get_threads(const hqx_pool* pool);
+
+/* Like hqx_upscale, returns once the whole frame has been upscaled */
+HQX_API hqx_status hqx_pool_upscale(hqx_pool* pool,
+                                    const void* src, ptrdiff_t src_stride,
+                                    void* dst, ptrdiff_t dst_stride,
+                                    int width, int height, hqx_format format);
+
+/* Scheduler for hosts that upscale the frames of many independent streams,
+ * such as a server running many emulators. Frames are split into chunks of
+ * rows and the worker threads take batches of chunks from all streams, the
+ * chunk with the earliest deadline first. The frames of a stream are
+ * completed in the order they were submitted. */
+typedef struct hqx_scheduler hqx_scheduler;
+typedef struct hqx_stream hqx_stream;
+
+typedef struct hqx_scheduler_stats
+{
+    uint64_t frames;  /* frames completed */
+    uint64_t late;    /* frames completed after their deadline */
+    uint64_t batches; /* batches of chunks taken by the workers */
+    uint64_t chunks;  /* chunks upscaled */
+} hqx_scheduler_stats;
+
+/* Called on a worker thread when a frame is done, in the order the frames of
+ * the stream were submitted. late is nonzero when the deadline was missed. */
+typedef void (*hqx_frame_callback)(void* userdata, uint64_t frame, hqx_status status, int late);
+
+/* threads is the number of worker threads, 0 uses one per core. Returns NULL
+ * on failure. */
+HQX_API hqx_scheduler* hqx_scheduler_create(int threads);
+
+/* All streams must have been destroyed */
+HQX_API void hqx_scheduler_destroy(hqx_scheduler* scheduler);
+
+HQX_API void hqx_scheduler_get_stats(hqx_scheduler* scheduler, hqx_scheduler_stats* stats);
+
+HQX_API hqx_stream* hqx_stream_create(hqx_scheduler* scheduler, int scale, hqx_format format,
+                                      hqx_frame_callback callback, void* userdata);
+
+/* Waits for the frames of the stream that are still queued */
+HQX_API void hqx_stream_destroy(hqx_stream* stream);
+
+/* Queues a frame, src and dst must stay valid until its callback. The frame
+ * should be done deadline_us microseconds from now. Doesn't wait for the
+ * workers. */
+HQX_API hqx_status hqx_stream_submit(hqx_stream* stream,
+                                     const void* src, ptrdiff_t src_stride,
+                                     void* dst, ptrdiff_t dst_stride,
+                                     int width, int height, uint64_t frame, uint32_t deadline_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,118 @@
+/* hugepages.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+// Upscales a large frame with normal pages and with huge pages for the
+// look-up tables, the scratch memory and the output, and compares the dTLB
+// misses and page faults counted by perf_event_open.
+
+#include "hqx.h"
+#include "perf.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static perf_counter counters[] = {
+    { "dTLB load misses", PERF_TYPE_HW_CACHE,
+      cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), -1 },
+    { "dTLB store misses", PERF_TYPE_HW_CACHE,
+      cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_WRITE, PERF_COUNT_HW_CACHE_RESULT_MISS), -1 },
+    { "page faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, -1 },
+};
+
+// Kilobytes of anonymous memory backed by transparent huge pages
+static long anon_huge_pages()
+{
+    FILE* file = fopen("/proc/self/smaps_rollup", "r");
+    if (!file)
+        return -1;
+
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), file))
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+            break;
+    fclose(file);
+    return kb;
+}
+
+int main(int argc, const char* argv[])
+{
+    const int width = argc > 1 ? atoi(argv[1]) : 4096;
+    const int height = argc > 2 ? atoi(argv[2]) : 1024;
+    const int scale = argc > 3 ? atoi(argv[3]) : 4;
+    if (width <= 0 || height <= 0 || scale < 2 || scale > 4)
+    {
+        printf("Usage: %s [width] [height] [scale]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937 rng(1);
+    std::vector<uint32_t> input((size_t)width * height);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            input[(size_t)y * width + x] = ((x / 11) ^ (y / 9)) % 4 ? 0xFF2060A0 + ((x / 11 + y / 9) % 3 << 8) : rng();
+
+    const size_t size = (size_t)width * scale * height * scale * 4;
+    const ptrdiff_t stride = (ptrdiff_t)width * scale * 4;
+    const double pixels = (double)width * height;
+    printf("%dx%d -> %dx%d, %.0f MiB of output\n", width, height, width * scale, height * scale, size / 1048576.0);
+
+    open_counters(counters);
+    std::vector<uint32_t> expected;
+    int failures = 0;
+    for (bool huge : { false, true })
+    {
+        hqx_context* ctx = hqx_create(scale);
+        hqx_set_huge_pages(ctx, huge);
+
+        hqx_pages pages = HQX_PAGES_NORMAL;
+        uint32_t* output = huge ? (uint32_t*)hqx_alloc_buffer(size, &pages) : new uint32_t[size / 4];
+        const char* kinds[] = { "normal pages", "transparent huge pages", "explicit huge pages" };
+        printf("%s:\n", kinds[pages]);
+
+        // The first frame faults in the output, the others reuse it
+        for (int frame = 0; frame < 2; frame++)
+        {
+            const int runs = frame ? 3 : 1;
+            start_counters(counters);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < runs; i++)
+                hqx_upscale(ctx, input.data(), width * 4, output, stride, width, height, HQX_FORMAT_XRGB8888);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            printf("  %-11s %7.1f MP/s, per source megapixel:", frame ? "next frames" : "first frame",
+                   pixels * runs / elapsed.count() / 1e6);
+            stop_counters(counters, pixels * runs / 1e6);
+        }
+
+        long huge_kb = anon_huge_pages();
+        if (huge_kb >= 0)
+            printf("  AnonHugePages %ld MiB\n", huge_kb / 1024);
+
+        if (!huge)
+            expected.assign(output, output + size / 4);
+        else if (memcmp(output, expected.data(), size) != 0)
+        {
+            printf("the output on huge pages differs\n");
+            failures++;
+        }
+
+        if (huge)
+            hqx_free_buffer(output, size);
+        else
+            delete[] output;
+        hqx_destroy(ctx);
+    }
+
+    close_counters(counters);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,227 @@
+/* index.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "context.h"
+#include "classify.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Index map sidecars, the format is described in hqx.h. Static images have
+// long runs of the same index in flat areas, while a run of one entry still
+// fits in two bytes.
+
+static const uint8_t magic[8] = { 'H', 'Q', 'X', 'I', 'D', 'X', 1, 0 };
+static const size_t header_size = 28;
+static const int index_bits = 12;
+
+// Rows classified at a time
+static const int band_rows = 16;
+
+static void put_u32(uint8_t* data, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        data[i] = (uint8_t)(value >> i * 8);
+}
+
+static uint32_t get_u32(const uint8_t* data)
+{
+    return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+// Appends a varint, returns false when it doesn't fit
+static bool put_varint(uint8_t*& data, const uint8_t* end, uint64_t value)
+{
+    for (; data < end; value >>= 7)
+    {
+        if (value < 0x80)
+        {
+            *data++ = (uint8_t)value;
+            return true;
+        }
+        *data++ = (uint8_t)(value | 0x80);
+    }
+    return false;
+}
+
+static bool get_varint(const uint8_t*& data, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (int shift = 0; data < end && shift < 64; shift += 7)
+    {
+        const uint8_t byte = *data++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool hqx::index_decoder::read(uint16_t* index, size_t count)
+{
+    while (count)
+    {
+        if (!remaining)
+        {
+            uint64_t token;
+            if (!get_varint(data, end, token))
+                return false;
+            value = (uint16_t)(token & ((1 << index_bits) - 1));
+            remaining = (token >> index_bits) + 1;
+        }
+
+        const size_t run = (size_t)std::min<uint64_t>(remaining, count);
+        std::fill(index, index + run, value);
+        index += run;
+        count -= run;
+        remaining -= run;
+    }
+    return true;
+}
+
+// Checks the header and that the runs cover the image exactly, so decoding
+// can't fail halfway through a frame
+static bool check_sidecar(const void* data, size_t size, int& width, int& height, hqx::index_decoder& decoder)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    if (!data || size < header_size || memcmp(bytes, magic, sizeof(magic)) != 0 ||
+        get_u32(bytes + 16) != hqx::threshold_y || get_u32(bytes + 20) != hqx::threshold_u ||
+        get_u32(bytes + 24) != hqx::threshold_v)
+        return false;
+
+    const uint32_t w = get_u32(bytes + 8), h = get_u32(bytes + 12);
+    if (!w || !h || w > INT32_MAX || h > INT32_MAX)
+        return false;
+
+    decoder = { bytes + header_size, bytes + size, 0, 0 };
+    uint64_t entries = 0;
+    for (const uint8_t* run = decoder.data; run < decoder.end;)
+    {
+        uint64_t token;
+        if (!get_varint(run, decoder.end, token))
+            return false;
+        entries += (token >> index_bits) + 1;
+        if (entries > (uint64_t)w * h)
+            return false;
+    }
+
+    width = (int)w;
+    height = (int)h;
+    return entries == (uint64_t)w * h;
+}
+
+size_t hqx_index_bound(int width, int height)
+{
+    if (width <= 0 || height <= 0)
+        return 0;
+
+    // Every run takes at most two bytes per entry
+    return header_size + 2 * (size_t)width * height;
+}
+
+hqx_status hqx_index_save(hqx_context* ctx,
+                          const void* src, ptrdiff_t src_stride,
+                          int width, int height, hqx_format format,
+                          void* data, size_t capacity, size_t* size)
+{
+    const int pixel_size = hqx::pixel_size(format);
+    if (!ctx || !src || !data || !size || !pixel_size || hqx::wide_format(format) || width <= 0 || height <= 0 ||
+        src_stride % pixel_size || (uintptr_t)src % pixel_size || capacity < header_size)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    const hqx::source source = hqx::packed_source(src, src_stride, format);
+    const size_t band = std::min(height, band_rows);
+
+    hqx::arena_layout layout;
+    layout.allocate<uint16_t>(band * width);
+    layout.allocate<uint32_t>(hqx::window_size(width));
+    layout.allocate<uint32_t>((band + 2) * width);
+    if (!ctx->scratch.reset(layout.size))
+        return HQX_ERROR_OUT_OF_MEMORY;
+
+    uint16_t* index = ctx->scratch.allocate<uint16_t>(band * width);
+    uint32_t* window = ctx->scratch.allocate<uint32_t>(hqx::window_size(width));
+    uint32_t* pixels = ctx->scratch.allocate<uint32_t>((band + 2) * width);
+
+    uint8_t* out = (uint8_t*)data;
+    const uint8_t* end = out + capacity;
+
+    memcpy(out, magic, sizeof(magic));
+    put_u32(out + 8, width);
+    put_u32(out + 12, height);
+    put_u32(out + 16, hqx::threshold_y);
+    put_u32(out + 20, hqx::threshold_u);
+    put_u32(out + 24, hqx::threshold_v);
+    out += header_size;
+
+    // Runs continue across rows and bands
+    uint16_t value = 0;
+    uint64_t run = 0;
+    for (int b0 = 0; b0 < height; b0 += band_rows)
+    {
+        const int b1 = std::min(b0 + band_rows, height);
+        const int top = std::max(b0 - 1, 0), bottom = std::min(b1 + 1, height);
+        hqx::classify(hqx::read_rows(source, width, top, bottom, pixels), b0 - top, b1 - top, index, window);
+
+        for (size_t i = 0; i < (size_t)(b1 - b0) * width; i++)
+        {
+            if (run && index[i] == value)
+            {
+                run++;
+                continue;
+            }
+            if (run && !put_varint(out, end, (run - 1) << index_bits | value))
+                return HQX_ERROR_INVALID_ARGUMENT;
+            value = index[i];
+            run = 1;
+        }
+    }
+    if (!put_varint(out, end, (run - 1) << index_bits | value))
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    *size = out - (uint8_t*)data;
+    return HQX_OK;
+}
+
+hqx_status hqx_index_info(const void* data, size_t size, int* width, int* height)
+{
+    int w, h;
+    hqx::index_decoder decoder;
+    if (!check_sidecar(data, size, w, h, decoder))
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    if (width)
+        *width = w;
+    if (height)
+        *height = h;
+    return HQX_OK;
+}
+
+hqx_status hqx_upscale_indexed(hqx_context* ctx,
+                               const void* src, ptrdiff_t src_stride,
+                               void* dst, ptrdiff_t dst_stride,
+                               int width, int height, hqx_format format,
+                               const void* index, size_t index_size)
+{
+    int index_width, index_height;
+    hqx::index_decoder decoder;
+    if (!check_sidecar(index, index_size, index_width, index_height, decoder) || index_width != width ||
+        index_height != height)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    // Checks the other arguments
+    const int size = hqx::pixel_size(format);
+    if (!ctx || !src || !dst || !size || hqx::wide_format(format) || src_stride % size || dst_stride % size ||
+        (uintptr_t)src % size || (uintptr_t)dst % size)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    hqx::source source = hqx::packed_source(src, src_stride, format);
+    source.index = &decoder;
+    return hqx::upscale_packed(ctx, source, width, height, 0, height, dst, dst_stride, format);
+}
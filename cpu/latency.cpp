@@ -0,0 +1,101 @@
+/* latency.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+// Measures the wall time of upscaling single frames, with one thread and
+// with the low-latency pool, both back to back and paced like a 60 Hz
+// emulator.
+
+#include "hqx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+static const int width = 320, height = 240, scale = 4;
+
+// Wall times of a number of frames in microseconds, sorted
+static std::vector<double> measure(const std::function<void()>& upscale, int frames, bool paced)
+{
+    std::vector<double> times;
+    auto next = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++)
+    {
+        if (paced)
+        {
+            next += std::chrono::microseconds(16667);
+            std::this_thread::sleep_until(next);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        upscale();
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        times.push_back(elapsed.count());
+    }
+    std::sort(times.begin(), times.end());
+    return times;
+}
+
+static void report(const char* name, bool paced, const std::vector<double>& times)
+{
+    printf("%-22s %-12s p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", name, paced ? "60 Hz" : "back to back",
+           times[times.size() / 2], times[times.size() * 99 / 100], times.back());
+}
+
+int main(int argc, const char* argv[])
+{
+    const int spin_us = argc > 1 ? atoi(argv[1]) : 20000;
+
+    std::mt19937 rng(1);
+    std::vector<uint32_t> input(width * height);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            input[y * width + x] = ((x / 11) ^ (y / 9)) % 4 ? 0xFF2060A0 + ((x / 11 + y / 9) % 3 << 8) : rng();
+
+    std::vector<uint32_t> expected(width * scale * height * scale), output(expected.size());
+    hqx_context* ctx = hqx_create(scale);
+    auto single = [&] {
+        hqx_upscale(ctx, input.data(), width * 4, expected.data(), width * scale * 4, width, height, HQX_FORMAT_XRGB8888);
+    };
+
+    printf("%dx%d -> %dx%d, workers spin for %d us\n", width, height, width * scale, height * scale, spin_us);
+    for (bool paced : { false, true })
+        report("single thread", paced, measure(single, paced ? 120 : 500, paced));
+
+    int failures = 0;
+    const int max_threads = argc > 2 ? atoi(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+    for (int threads = 2; threads <= max_threads; threads *= 2)
+    {
+        hqx_pool* pool = hqx_pool_create(scale, threads, spin_us);
+        auto parallel = [&] {
+            hqx_pool_upscale(pool, input.data(), width * 4, output.data(), width * scale * 4, width, height,
+                             HQX_FORMAT_XRGB8888);
+        };
+
+        char name[32];
+        snprintf(name, sizeof(name), "pool of %d threads", threads);
+        for (bool paced : { false, true })
+            report(name, paced, measure(parallel, paced ? 120 : 500, paced));
+
+        if (output != expected)
+        {
+            printf("%s: output differs from hqx_upscale\n", name);
+            failures++;
+        }
+        hqx_pool_destroy(pool);
+    }
+
+    hqx_destroy(ctx);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+/* lut.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "engine.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "lut_data.inc"
+
+namespace hqx
+{
+
+template <int SCALE>
+static std::vector<uint32_t> expand(const uint32_t* palette, const uint8_t (*blocks)[SCALE * SCALE],
+                                    const uint16_t* index)
+{
+    std::vector<uint32_t> weights(4096 * SCALE * SCALE);
+
+    uint32_t* entry = weights.data();
+    for (int i = 0; i < 4096; i++)
+    {
+        for (int subpixel = 0; subpixel < SCALE * SCALE; subpixel++)
+            *entry++ = palette[blocks[index[i]][subpixel]];
+    }
+    return weights;
+}
+
+static const std::vector<uint32_t>& expanded(int scale)
+{
+    // Function statics are initialised once, even when called from several threads
+    static const std::vector<uint32_t> hq2x = expand<2>(hq2x_palette, hq2x_blocks, hq2x_index);
+    static const std::vector<uint32_t> hq3x = expand<3>(hq3x_palette, hq3x_blocks, hq3x_index);
+    static const std::vector<uint32_t> hq4x = expand<4>(hq4x_palette, hq4x_blocks, hq4x_index);
+
+    if (scale == 2)
+        return hq2x;
+    if (scale == 3)
+        return hq3x;
+    return hq4x;
+}
+
+const lut& get_lut(int scale)
+{
+    static const lut tables[] = {
+        { 2, expanded(2).data(), expanded(2).size() },
+        { 3, expanded(3).data(), expanded(3).size() },
+        { 4, expanded(4).data(), expanded(4).size() }
+    };
+
+    assert(2 <= scale && scale <= 4);
+    return tables[scale - 2];
+}
+
+// The three tables take less than 512 KiB, so a single huge page holds them
+// all and the random look-ups of the blend hit the same TLB entry
+struct huge_tables
+{
+    lut tables[3];
+
+    huge_tables()
+    {
+        size_t size = 0;
+        for (int scale = 2; scale <= 4; scale++)
+            size += get_lut(scale).size * sizeof(uint32_t);
+
+        page_kind kind;
+        uint32_t* memory = (uint32_t*)allocate_huge(size, &kind);
+        for (int scale = 2; scale <= 4; scale++)
+        {
+            tables[scale - 2] = get_lut(scale);
+            if (!memory)
+                continue;
+
+            std::copy(tables[scale - 2].weights, tables[scale - 2].weights + tables[scale - 2].size, memory);
+            tables[scale - 2].weights = memory;
+            memory += tables[scale - 2].size;
+        }
+    }
+};
+
+const lut& get_lut_huge(int scale)
+{
+    static const huge_tables huge;
+
+    assert(2 <= scale && scale <= 4);
+    return huge.tables[scale - 2];
+}
+
+}
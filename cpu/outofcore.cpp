@@ -0,0 +1,113 @@
+/* outofcore.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+// Upscales a raw image file with hqx_upscale_file and reports the peak memory
+// use, --generate first writes a synthetic source of the given size.
+
+#include "hqx.h"
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Pixel art in a few colours with some noise, written a row at a time. The
+// 16-bit format gets the same colours with every channel expanded to 16 bits.
+static bool generate(const char* path, int width, int height, hqx_format format)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    const int pixel_size = format == HQX_FORMAT_RGB565 ? 2 : format == HQX_FORMAT_RGBA16161616 ? 8 : 4;
+    std::vector<uint8_t> row((size_t)width * pixel_size);
+    uint32_t seed = 1;
+    bool ok = true;
+    for (int y = 0; y < height && ok; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            uint32_t colour = ((x / 13) ^ (y / 7)) % 5 ? 0xFFF0C080 * ((x / 13 + y / 7) % 3 + 1) : seed;
+            if (format == HQX_FORMAT_RGBA16161616)
+            {
+                const uint16_t channels[4] = {
+                    (uint16_t)((colour & 0xFF) * 257), (uint16_t)((colour >> 8 & 0xFF) * 257),
+                    (uint16_t)((colour >> 16 & 0xFF) * 257), (uint16_t)((colour >> 24) * 257)
+                };
+                memcpy(&row[(size_t)x * pixel_size], channels, pixel_size);
+            }
+            else
+                memcpy(&row[(size_t)x * pixel_size], &colour, pixel_size);
+        }
+        ok = fwrite(row.data(), 1, row.size(), file) == row.size();
+    }
+    return fclose(file) == 0 && ok;
+}
+
+int main(int argc, const char* argv[])
+{
+    const char* paths[2] = {};
+    int size[2] = {}, positional = 0;
+    int scale = 2, threads = 0;
+    size_t budget_mb = 256;
+    hqx_format format = HQX_FORMAT_RGBA8888;
+    bool generate_source = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-x") == 0 && i + 1 < argc)
+            scale = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+            budget_mb = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            format = (hqx_format)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--generate") == 0)
+            generate_source = true;
+        else if (positional < 2)
+            paths[positional++] = argv[i];
+        else if (positional < 4)
+            size[positional++ - 2] = atoi(argv[i]);
+    }
+
+    if (positional < 4)
+    {
+        printf("Usage: %s <source> <output> <width> <height> [-x scale] [-f format] [-j threads] "
+               "[-m budget MiB] [--generate]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (generate_source && !generate(paths[0], size[0], size[1], format))
+    {
+        printf("Failed to write %s\n", paths[0]);
+        return EXIT_FAILURE;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    hqx_status status = hqx_upscale_file(scale, paths[0], 0, paths[1], 0, size[0], size[1], format, threads,
+                                         budget_mb << 20);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    if (status != HQX_OK)
+    {
+        printf("Failed to upscale %s: %d\n", paths[0], status);
+        return EXIT_FAILURE;
+    }
+
+    printf("%dx%d -> %dx%d in %.2f s, %.1f MP/s, peak RSS %ld MiB with a budget of %zu MiB\n", size[0], size[1],
+           size[0] * scale, size[1] * scale, elapsed.count(), (double)size[0] * size[1] / elapsed.count() / 1e6,
+           usage.ru_maxrss / 1024, budget_mb);
+    return EXIT_SUCCESS;
+}
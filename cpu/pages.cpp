@@ -0,0 +1,110 @@
+/* pages.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "engine.h"
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace hqx
+{
+
+static const size_t huge_page = 2 << 20;
+
+size_t huge_size(size_t size)
+{
+    return (size + huge_page - 1) & ~(huge_page - 1);
+}
+
+#if defined(__linux__)
+
+// Transparent huge pages are only given to mappings that ask for them when
+// the kernel isn't set to never use them
+static bool transparent_huge_pages()
+{
+    FILE* file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (!file)
+        return false;
+
+    char mode[128] = {};
+    size_t length = fread(mode, 1, sizeof(mode) - 1, file);
+    fclose(file);
+    return length && !strstr(mode, "[never]");
+}
+
+void* allocate_huge(size_t size, page_kind* kind)
+{
+    size = huge_size(size);
+
+    // Explicit huge pages need a pool reserved in vm.nr_hugepages
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED)
+    {
+        *kind = pages_explicit;
+        return memory;
+    }
+
+    // Otherwise map an extra huge page and trim the mapping to start on a
+    // 2 MiB boundary, so the kernel can back all of it with huge pages
+    uint8_t* mapping = (uint8_t*)mmap(nullptr, size + huge_page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                                      -1, 0);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+
+    uint8_t* aligned = (uint8_t*)(((uintptr_t)mapping + huge_page - 1) & ~(uintptr_t)(huge_page - 1));
+    if (aligned > mapping)
+        munmap(mapping, aligned - mapping);
+    munmap(aligned + size, mapping + huge_page - aligned);
+
+    static const bool transparent = transparent_huge_pages();
+    *kind = transparent && madvise(aligned, size, MADV_HUGEPAGE) == 0 ? pages_transparent : pages_normal;
+    return aligned;
+}
+
+void free_huge(void* memory, size_t size)
+{
+    if (memory)
+        munmap(memory, huge_size(size));
+}
+
+#else
+
+// An extra huge page for the alignment, the start of the allocation is kept
+// in front of the aligned block to free it
+void* allocate_huge(size_t size, page_kind* kind)
+{
+    *kind = pages_normal;
+    uint8_t* allocation = new (std::nothrow) uint8_t[huge_size(size) + huge_page];
+    if (!allocation)
+        return nullptr;
+
+    uint8_t* aligned = (uint8_t*)(((uintptr_t)allocation + sizeof(void*) + huge_page - 1) &
+                                  ~(uintptr_t)(huge_page - 1));
+    memcpy(aligned - sizeof(void*), &allocation, sizeof(void*));
+    return aligned;
+}
+
+void free_huge(void* memory, size_t)
+{
+    if (!memory)
+        return;
+
+    uint8_t* allocation;
+    memcpy(&allocation, (uint8_t*)memory - sizeof(void*), sizeof(void*));
+    delete[] allocation;
+}
+
+#endif
+
+}
@@ -0,0 +1,93 @@
+/* perf.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#pragma once
+
+// Counts events of this thread with perf_event_open for the benchmarks. The
+// counters that aren't available to this process, such as the hardware
+// counters in most virtual machines, are reported as n/a.
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+struct perf_counter
+{
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+    int fd;
+};
+
+// The config of a generic cache event, such as a read miss of the L1D cache
+inline uint64_t cache_event(uint64_t cache, uint64_t op, uint64_t result)
+{
+    return cache | op << 8 | result << 16;
+}
+
+template <size_t N>
+void open_counters(perf_counter (&counters)[N])
+{
+    for (perf_counter& c : counters)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = c.type;
+        attr.config = c.config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        c.fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+template <size_t N>
+void start_counters(perf_counter (&counters)[N])
+{
+    for (perf_counter& c : counters)
+    {
+        if (c.fd >= 0)
+        {
+            ioctl(c.fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(c.fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+// Prints the counters divided by per, such as the number of pixels
+template <size_t N>
+void stop_counters(perf_counter (&counters)[N], double per)
+{
+    for (perf_counter& c : counters)
+    {
+        uint64_t value;
+        if (c.fd >= 0 && ioctl(c.fd, PERF_EVENT_IOC_DISABLE, 0) == 0 && read(c.fd, &value, sizeof(value)) == sizeof(value))
+            printf("  %s %7.3f", c.name, value / per);
+        else
+            printf("  %s     n/a", c.name);
+    }
+    printf("\n");
+}
+
+template <size_t N>
+void close_counters(perf_counter (&counters)[N])
+{
+    for (perf_counter& c : counters)
+    {
+        if (c.fd >= 0)
+            close(c.fd);
+        c.fd = -1;
+    }
+}
@@ -0,0 +1,218 @@
+/* pool.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "hqx.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() std::this_thread::yield()
+#endif
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+typedef std::chrono::steady_clock clock_type;
+
+// The frame all threads are working on
+struct job
+{
+    const void* src;
+    ptrdiff_t src_stride;
+    void* dst;
+    ptrdiff_t dst_stride;
+    int width, height;
+    hqx_format format;
+};
+
+struct hqx_pool
+{
+    int threads;
+    clock_type::duration spin;
+    std::vector<hqx_context*> contexts;
+    std::vector<std::thread> workers;
+
+    // Bumped for every frame, the workers spin on it and then sleep
+    job current;
+    std::atomic<uint64_t> generation;
+    std::atomic<int> sleepers;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    // Counts the bands that are done, the calling thread spins on it
+    std::atomic<int> finished;
+    std::atomic<int> status;
+
+    hqx_pool() : generation(0), sleepers(0), finished(0), status(HQX_OK) {}
+    ~hqx_pool()
+    {
+        for (hqx_context* ctx : contexts)
+            hqx_destroy(ctx);
+    }
+};
+
+static void pin(std::thread::native_handle_type thread, int core)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+#elif defined(_WIN32)
+    SetThreadAffinityMask((HANDLE)thread, (DWORD_PTR)1 << core);
+#else
+    (void)thread;
+    (void)core;
+#endif
+}
+
+// Upscales the band of rows that belongs to a thread
+static void upscale_band(hqx_pool* pool, int band)
+{
+    const job& j = pool->current;
+    const int y0 = (int)((int64_t)j.height * band / pool->threads);
+    const int y1 = (int)((int64_t)j.height * (band + 1) / pool->threads);
+    if (y0 < y1)
+    {
+        hqx_status status = hqx_upscale_rows(pool->contexts[band], j.src, j.src_stride, j.dst, j.dst_stride,
+                                             j.width, j.height, y0, y1, j.format);
+        if (status != HQX_OK)
+            pool->status = status;
+    }
+}
+
+static void run(hqx_pool* pool, int band)
+{
+    uint64_t seen = 0;
+    for (;;)
+    {
+        // Spin for a while, then sleep until the next frame
+        clock_type::time_point deadline = clock_type::now() + pool->spin;
+        while (pool->generation.load(std::memory_order_acquire) == seen && clock_type::now() < deadline)
+            cpu_relax();
+
+        if (pool->generation.load(std::memory_order_acquire) == seen)
+        {
+            std::unique_lock<std::mutex> guard(pool->lock);
+            pool->sleepers++;
+            pool->wake.wait(guard, [pool, seen] { return pool->stopping || pool->generation != seen; });
+            pool->sleepers--;
+        }
+        if (pool->stopping)
+            return;
+
+        seen = pool->generation.load(std::memory_order_acquire);
+        upscale_band(pool, band);
+        pool->finished.fetch_add(1, std::memory_order_release);
+    }
+}
+
+static int core_count()
+{
+    int cores = (int)std::thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+}
+
+hqx_pool* hqx_pool_create(int scale, int threads, int spin_us)
+{
+    if (threads < 0 || spin_us < 0)
+        return nullptr;
+
+    hqx_pool* pool = new (std::nothrow) hqx_pool;
+    if (!pool)
+        return nullptr;
+
+    pool->threads = threads ? threads : core_count();
+    pool->spin = std::chrono::microseconds(spin_us);
+    try
+    {
+        for (int i = 0; i < pool->threads; i++)
+        {
+            pool->contexts.push_back(hqx_create(scale));
+            if (!pool->contexts.back())
+                throw std::bad_alloc();
+        }
+
+        for (int i = 1; i < pool->threads; i++)
+        {
+            pool->workers.emplace_back(run, pool, i);
+            pin(pool->workers.back().native_handle(), i % core_count());
+        }
+    }
+    catch (const std::exception&)
+    {
+        hqx_pool_destroy(pool);
+        return nullptr;
+    }
+    return pool;
+}
+
+void hqx_pool_destroy(hqx_pool* pool)
+{
+    if (!pool)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->stopping = true;
+        pool->generation++;
+    }
+    pool->wake.notify_all();
+    for (std::thread& worker : pool->workers)
+        worker.join();
+    delete pool;
+}
+
+int hqx_pool_get_threads(const hqx_pool* pool)
+{
+    return pool ? pool->threads : 0;
+}
+
+hqx_status hqx_pool_upscale(hqx_pool* pool,
+                            const void* src, ptrdiff_t src_stride,
+                            void* dst, ptrdiff_t dst_stride,
+                            int width, int height, hqx_format format)
+{
+    if (!pool || width <= 0 || height <= 0)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    pool->current = job { src, src_stride, dst, dst_stride, width, height, format };
+    pool->status = HQX_OK;
+    pool->finished.store(0, std::memory_order_relaxed);
+
+    // A worker counts itself as a sleeper before it checks the generation
+    // under the lock, so either it sees the new frame or it's woken up
+    pool->generation.fetch_add(1);
+    if (pool->sleepers.load() > 0)
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->wake.notify_all();
+    }
+
+    upscale_band(pool, 0);
+
+    // Spin barrier, the frame is done when every worker finished its band
+    while (pool->finished.load(std::memory_order_acquire) < pool->threads - 1)
+        cpu_relax();
+    return (hqx_status)pool->status.load();
+}
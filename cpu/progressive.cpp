@@ -0,0 +1,258 @@
+/* progressive.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "context.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+typedef std::chrono::steady_clock clock_type;
+
+static const int tile_size = 32;
+
+// A tile with the pixels around it, which are needed to classify its edges
+static const int halo_size = tile_size + 2;
+
+// The scratch memory of a tile
+struct tile_buffers
+{
+    uint16_t* index;
+    uint32_t* window;
+    uint32_t* pixels; // RGB565 source converted to 32-bit
+    uint32_t* output;
+};
+
+template <typename Allocator>
+static tile_buffers allocate(Allocator& memory, int scale)
+{
+    tile_buffers b;
+    b.index = memory.template allocate<uint16_t>(halo_size * halo_size);
+    b.window = memory.template allocate<uint32_t>(hqx::window_size(halo_size));
+    b.pixels = memory.template allocate<uint32_t>(halo_size * halo_size);
+    b.output = memory.template allocate<uint32_t>(halo_size * scale * halo_size * scale);
+    return b;
+}
+
+// Pixels of a tile in the source
+struct tile
+{
+    int x0, y0, x1, y1;
+    int left, top, right, bottom; // including the pixels around it
+};
+
+static tile get_tile(int index, int tiles_x, int width, int height)
+{
+    tile t;
+    t.x0 = index % tiles_x * tile_size;
+    t.y0 = index / tiles_x * tile_size;
+    t.x1 = std::min(t.x0 + tile_size, width);
+    t.y1 = std::min(t.y0 + tile_size, height);
+    t.left = std::max(t.x0 - 1, 0);
+    t.top = std::max(t.y0 - 1, 0);
+    t.right = std::min(t.x1 + 1, width);
+    t.bottom = std::min(t.y1 + 1, height);
+    return t;
+}
+
+// Hashes the tile with the pixels around it, which all affect its output,
+// and counts the pixels that differ from their right or bottom neighbour
+template <typename T>
+static uint64_t hash_tile(const uint8_t* src, ptrdiff_t stride, const tile& t, uint32_t& edges)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    edges = 0;
+    for (int y = t.top; y < t.bottom; y++)
+    {
+        const T* row = (const T*)(src + y * stride);
+        const T* below = y + 1 < t.bottom ? (const T*)(src + (y + 1) * stride) : row;
+        for (int x = t.left; x < t.right; x++)
+        {
+            hash = (hash ^ row[x]) * 0x100000001B3ull;
+            edges += (x + 1 < t.right && row[x] != row[x + 1]) || row[x] != below[x];
+        }
+    }
+    return hash;
+}
+
+template <typename T>
+static void nearest_neighbour(const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride,
+                              int width, int height, int scale)
+{
+    for (int y = 0; y < height; y++)
+    {
+        const T* in = (const T*)(src + y * src_stride);
+        uint8_t* out = dst + y * scale * dst_stride;
+        T* first = (T*)out;
+        for (int x = 0; x < width; x++)
+            for (int i = 0; i < scale; i++)
+                first[x * scale + i] = in[x];
+
+        for (int i = 1; i < scale; i++)
+            memcpy(out + i * dst_stride, first, width * scale * sizeof(T));
+    }
+}
+
+// Upscales a tile with HQx, the pixels around it are classified and blended
+// as well but only the tile itself is written
+static void refine(hqx_context* ctx, const tile_buffers& scratch, const tile& t,
+                   const uint8_t* src, ptrdiff_t src_stride, uint8_t* dst, ptrdiff_t dst_stride,
+                   hqx_format format)
+{
+    const int scale = ctx->table->scale;
+    const int width = t.right - t.left;
+    hqx::image image = { (const uint32_t*)(src + t.top * src_stride) + t.left, src_stride / 4,
+                         width, t.bottom - t.top, format == HQX_FORMAT_RGBA8888 ? hqx::order_rgba : hqx::order_bgra };
+    if (format == HQX_FORMAT_RGB565)
+    {
+        for (int y = t.top; y < t.bottom; y++)
+            hqx::expand_rgb565((const uint16_t*)(src + y * src_stride) + t.left, width,
+                               scratch.pixels + (y - t.top) * width);
+        image.pixels = scratch.pixels;
+        image.stride = width;
+    }
+
+    const int y0 = t.y0 - t.top, y1 = t.y1 - t.top;
+    hqx::classify(image, y0, y1, scratch.index, scratch.window);
+    hqx::blend_columns_with(hqx::context_kernel(ctx, image.channels), *ctx->table, image, y0, y1, 0, width,
+                            scratch.index, scratch.output, width * scale, false);
+
+    const int skip = (t.x0 - t.left) * scale, count = (t.x1 - t.x0) * scale;
+    for (int y = 0; y < (t.y1 - t.y0) * scale; y++)
+    {
+        const uint32_t* row = scratch.output + y * width * scale + skip;
+        uint8_t* out = dst + (t.y0 * scale + y) * dst_stride;
+        if (format == HQX_FORMAT_RGB565)
+            hqx::pack_rgb565(row, count, (uint16_t*)out + t.x0 * scale);
+        else
+            memcpy((uint32_t*)out + t.x0 * scale, row, count * 4);
+    }
+}
+
+hqx_status hqx_upscale_progressive(hqx_context* ctx,
+                                   const void* src, ptrdiff_t src_stride,
+                                   void* dst, ptrdiff_t dst_stride,
+                                   int width, int height, hqx_format format,
+                                   uint32_t budget_us, hqx_progress* progress)
+{
+    const clock_type::time_point deadline = clock_type::now() + std::chrono::microseconds(budget_us);
+    const int size = hqx::pixel_size(format);
+    if (!ctx || !src || !dst || !size || hqx::wide_format(format) || width <= 0 || height <= 0 ||
+        src_stride % size || dst_stride % size || (uintptr_t)src % size || (uintptr_t)dst % size)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    const int scale = ctx->table->scale;
+    hqx::arena_layout layout;
+    allocate(layout, scale);
+    if (!ctx->scratch.reset(layout.size))
+        return HQX_ERROR_OUT_OF_MEMORY;
+    const tile_buffers scratch = allocate(ctx->scratch, scale);
+
+    const int tiles_x = (width + tile_size - 1) / tile_size, tiles_y = (height + tile_size - 1) / tile_size;
+    const int tiles = tiles_x * tiles_y;
+    progressive_state& state = ctx->progressive;
+    try
+    {
+        // Nothing carries over to a frame of another size
+        if (state.width != width || state.height != height || state.format != format)
+        {
+            state.width = width;
+            state.height = height;
+            state.format = format;
+            state.dst = nullptr;
+            hqx::assign_state(ctx, state.hashes, tiles, (uint64_t)0);
+            hqx::assign_state(ctx, state.refined, tiles, (uint8_t)1);
+            hqx::assign_state(ctx, state.order, tiles, 0u);
+            hqx::assign_state(ctx, state.scores, tiles, 0u);
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        state.width = 0;
+        return HQX_ERROR_OUT_OF_MEMORY;
+    }
+
+    // The output of unchanged tiles is kept when the frame goes into the
+    // same buffer as the last one and is blended the same way
+    const bool same_output = state.dst == dst && state.dst_stride == dst_stride &&
+                             state.linear_light == ctx->linear_light;
+    state.dst = dst;
+    state.dst_stride = dst_stride;
+    state.linear_light = ctx->linear_light;
+
+    // The tiles that were left over from the last frame and are the same in
+    // this one go first, then the tiles with the most edges
+    const uint32_t leftover = 0x80000000;
+    const uint8_t* src_bytes = (const uint8_t*)src;
+    uint8_t* dst_bytes = (uint8_t*)dst;
+    int refined = 0, queued = 0;
+    for (int i = 0; i < tiles; i++)
+    {
+        const tile t = get_tile(i, tiles_x, width, height);
+        uint32_t edges;
+        const uint64_t hash = size == 2 ? hash_tile<uint16_t>(src_bytes, src_stride, t, edges)
+                                        : hash_tile<uint32_t>(src_bytes, src_stride, t, edges);
+        const bool unchanged = hash == state.hashes[i];
+        state.hashes[i] = hash;
+
+        if (unchanged && same_output && state.refined[i])
+        {
+            refined++;
+            continue;
+        }
+
+        const uint8_t* in = src_bytes + t.y0 * src_stride + t.x0 * size;
+        uint8_t* out = dst_bytes + t.y0 * scale * dst_stride + t.x0 * scale * size;
+        if (size == 2)
+            nearest_neighbour<uint16_t>(in, src_stride, out, dst_stride, t.x1 - t.x0, t.y1 - t.y0, scale);
+        else
+            nearest_neighbour<uint32_t>(in, src_stride, out, dst_stride, t.x1 - t.x0, t.y1 - t.y0, scale);
+
+        // A tile of a single colour looks the same either way
+        if (!edges)
+        {
+            state.refined[i] = 1;
+            refined++;
+            continue;
+        }
+
+        state.scores[i] = edges | (unchanged && !state.refined[i] ? leftover : 0);
+        state.refined[i] = 0;
+        state.order[queued++] = i;
+    }
+
+    std::sort(state.order.begin(), state.order.begin() + queued,
+              [&state](uint32_t a, uint32_t b) { return state.scores[a] > state.scores[b]; });
+
+    // A tile is only started when it's expected to be done in time
+    clock_type::duration slowest = clock_type::duration::zero();
+    for (int i = 0; i < queued; i++)
+    {
+        const clock_type::time_point start = clock_type::now();
+        if (start + slowest > deadline)
+            break;
+
+        const int index = state.order[i];
+        refine(ctx, scratch, get_tile(index, tiles_x, width, height), src_bytes, src_stride, dst_bytes, dst_stride,
+               format);
+        state.refined[index] = 1;
+        refined++;
+        slowest = std::max(slowest, clock_type::now() - start);
+    }
+
+    if (progress)
+    {
+        progress->tile_size = tile_size;
+        progress->tiles_x = tiles_x;
+        progress->tiles_y = tiles_y;
+        progress->refined = refined;
+        progress->flags = state.refined.data();
+    }
+    return HQX_OK;
+}
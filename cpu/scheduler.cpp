@@ -0,0 +1,311 @@
+/* scheduler.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "hqx.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock clock_type;
+
+// Frames are split into chunks of about this many source pixels, small
+// enough that a frame can be spread over a few cores when its deadline is near
+static const int chunk_pixels = 16384;
+
+// A batch is filled up to this many source pixels, so the scheduler's lock
+// is taken once for several chunks while there's plenty of work
+static const int batch_pixels = 65536;
+
+struct frame
+{
+    const void* src;
+    ptrdiff_t src_stride;
+    void* dst;
+    ptrdiff_t dst_stride;
+    int width, height;
+    uint64_t number;
+    clock_type::time_point deadline;
+
+    int chunk_rows;
+    int next_row = 0;  // rows handed out so far
+    int remaining = 0; // chunks not done yet
+    hqx_status status = HQX_OK;
+};
+
+struct hqx_stream
+{
+    hqx_scheduler* scheduler;
+    int scale;
+    hqx_format format;
+    hqx_frame_callback callback;
+    void* userdata;
+
+    // Frames in the order they were submitted, until their callback was made
+    std::deque<frame> frames;
+    size_t next_frame = 0;   // the first frame with rows that weren't handed out
+    bool delivering = false; // a worker is making callbacks
+};
+
+// A chunk of rows taken by a worker
+struct chunk
+{
+    hqx_stream* stream;
+    frame* f;
+    int y0, y1;
+    hqx_status status;
+};
+
+struct hqx_scheduler
+{
+    std::mutex lock;
+    std::condition_variable work;
+    std::condition_variable idle;
+    std::vector<hqx_stream*> streams;
+    std::vector<std::thread> workers;
+    size_t pending_pixels = 0;
+    bool stopping = false;
+    hqx_scheduler_stats stats = {};
+};
+
+// The stream whose next chunk has the earliest deadline
+static hqx_stream* earliest(hqx_scheduler* s)
+{
+    hqx_stream* best = nullptr;
+    for (hqx_stream* stream : s->streams)
+    {
+        if (stream->next_frame == stream->frames.size())
+            continue;
+        if (!best || stream->frames[stream->next_frame].deadline < best->frames[best->next_frame].deadline)
+            best = stream;
+    }
+    return best;
+}
+
+// Takes chunks in order of their deadlines. While there's little work the
+// batch is a single chunk, so it's spread over all workers.
+static void take_batch(hqx_scheduler* s, std::vector<chunk>& batch)
+{
+    const size_t target = std::min<size_t>(batch_pixels, s->pending_pixels / s->workers.size());
+    size_t pixels = 0;
+    while (batch.empty() || pixels < target)
+    {
+        hqx_stream* stream = earliest(s);
+        if (!stream)
+            break;
+
+        frame& f = stream->frames[stream->next_frame];
+        const int y0 = f.next_row, y1 = std::min(y0 + f.chunk_rows, f.height);
+        batch.push_back(chunk { stream, &f, y0, y1, HQX_OK });
+        f.next_row = y1;
+        if (y1 == f.height)
+            stream->next_frame++;
+
+        pixels += (size_t)(y1 - y0) * f.width;
+    }
+    s->pending_pixels -= pixels;
+    s->stats.batches++;
+}
+
+// Makes the callbacks of the finished frames at the head of a stream. Only
+// one worker does this for a stream at a time, so they're made in order.
+static void deliver(hqx_scheduler* s, hqx_stream* stream, std::unique_lock<std::mutex>& guard)
+{
+    if (stream->delivering)
+        return;
+
+    stream->delivering = true;
+    while (!stream->frames.empty() && stream->next_frame > 0 && stream->frames.front().remaining == 0)
+    {
+        const frame f = stream->frames.front();
+        stream->frames.pop_front();
+        stream->next_frame--;
+
+        const bool late = clock_type::now() > f.deadline;
+        s->stats.frames++;
+        s->stats.late += late;
+
+        guard.unlock();
+        stream->callback(stream->userdata, f.number, f.status, late);
+        guard.lock();
+    }
+    stream->delivering = false;
+    s->idle.notify_all();
+}
+
+static void run(hqx_scheduler* s)
+{
+    // The contexts only hold scratch memory, the look-up tables are shared by all threads
+    hqx_context* contexts[5] = {};
+    for (int scale = 2; scale <= 4; scale++)
+        contexts[scale] = hqx_create(scale);
+
+    std::vector<chunk> batch;
+    std::unique_lock<std::mutex> guard(s->lock);
+    for (;;)
+    {
+        s->work.wait(guard, [s] { return s->stopping || s->pending_pixels > 0; });
+        if (s->stopping)
+            break;
+
+        batch.clear();
+        take_batch(s, batch);
+        if (s->pending_pixels > 0)
+            s->work.notify_one();
+        guard.unlock();
+
+        for (chunk& c : batch)
+        {
+            const frame& f = *c.f;
+            c.status = hqx_upscale_rows(contexts[c.stream->scale], f.src, f.src_stride, f.dst, f.dst_stride,
+                                        f.width, f.height, c.y0, c.y1, c.stream->format);
+        }
+
+        guard.lock();
+        s->stats.chunks += batch.size();
+        for (chunk& c : batch)
+        {
+            if (c.status != HQX_OK)
+                c.f->status = c.status;
+            if (--c.f->remaining == 0)
+                deliver(s, c.stream, guard);
+        }
+    }
+
+    guard.unlock();
+    for (hqx_context* ctx : contexts)
+        hqx_destroy(ctx);
+}
+
+hqx_scheduler* hqx_scheduler_create(int threads)
+{
+    if (threads < 0)
+        return nullptr;
+
+    hqx_scheduler* s = new (std::nothrow) hqx_scheduler;
+    if (!s)
+        return nullptr;
+
+    if (!threads)
+        threads = std::max(1, (int)std::thread::hardware_concurrency());
+    try
+    {
+        for (int i = 0; i < threads; i++)
+            s->workers.emplace_back(run, s);
+    }
+    catch (const std::exception&)
+    {
+        hqx_scheduler_destroy(s);
+        return nullptr;
+    }
+    return s;
+}
+
+void hqx_scheduler_destroy(hqx_scheduler* scheduler)
+{
+    if (!scheduler)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(scheduler->lock);
+        scheduler->stopping = true;
+    }
+    scheduler->work.notify_all();
+    for (std::thread& worker : scheduler->workers)
+        worker.join();
+    delete scheduler;
+}
+
+void hqx_scheduler_get_stats(hqx_scheduler* scheduler, hqx_scheduler_stats* stats)
+{
+    std::lock_guard<std::mutex> guard(scheduler->lock);
+    *stats = scheduler->stats;
+}
+
+hqx_stream* hqx_stream_create(hqx_scheduler* scheduler, int scale, hqx_format format,
+                              hqx_frame_callback callback, void* userdata)
+{
+    if (!scheduler || scale < 2 || scale > 4 || format < HQX_FORMAT_RGBA8888 ||
+        format > HQX_FORMAT_RGBA16161616 || !callback)
+        return nullptr;
+
+    hqx_stream* stream = new (std::nothrow) hqx_stream;
+    if (!stream)
+        return nullptr;
+
+    stream->scheduler = scheduler;
+    stream->scale = scale;
+    stream->format = format;
+    stream->callback = callback;
+    stream->userdata = userdata;
+    try
+    {
+        std::lock_guard<std::mutex> guard(scheduler->lock);
+        scheduler->streams.push_back(stream);
+    }
+    catch (const std::bad_alloc&)
+    {
+        delete stream;
+        return nullptr;
+    }
+    return stream;
+}
+
+void hqx_stream_destroy(hqx_stream* stream)
+{
+    if (!stream)
+        return;
+
+    hqx_scheduler* s = stream->scheduler;
+    std::unique_lock<std::mutex> guard(s->lock);
+    s->idle.wait(guard, [stream] { return stream->frames.empty() && !stream->delivering; });
+    s->streams.erase(std::find(s->streams.begin(), s->streams.end(), stream));
+    guard.unlock();
+    delete stream;
+}
+
+hqx_status hqx_stream_submit(hqx_stream* stream,
+                             const void* src, ptrdiff_t src_stride,
+                             void* dst, ptrdiff_t dst_stride,
+                             int width, int height, uint64_t frame_number, uint32_t deadline_us)
+{
+    if (!stream || !src || !dst || width <= 0 || height <= 0)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    frame f;
+    f.src = src;
+    f.src_stride = src_stride;
+    f.dst = dst;
+    f.dst_stride = dst_stride;
+    f.width = width;
+    f.height = height;
+    f.number = frame_number;
+    f.deadline = clock_type::now() + std::chrono::microseconds(deadline_us);
+    f.chunk_rows = std::max(1, std::min(height, chunk_pixels / width));
+    f.remaining = (height + f.chunk_rows - 1) / f.chunk_rows;
+
+    hqx_scheduler* s = stream->scheduler;
+    try
+    {
+        std::lock_guard<std::mutex> guard(s->lock);
+        stream->frames.push_back(f);
+        s->pending_pixels += (size_t)width * height;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return HQX_ERROR_OUT_OF_MEMORY;
+    }
+    s->work.notify_one();
+    return HQX_OK;
+}
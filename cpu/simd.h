@@ -0,0 +1,521 @@
+/* simd.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// The vector operations of the CPU kernels. Every kernel is a template over
+// a backend and is compiled once per backend, in a source file built for the
+// instructions of that backend. A backend holds lanes 32-bit lanes in a vec
+// and provides:
+//
+//   load, store          unaligned vectors of 32-bit values
+//   load_u16, store_u16  16-bit values widened to lanes and narrowed back,
+//                        store_u16 stores the first count of them
+//   set1, zero           the same value in every lane
+//   bit_and, bit_or, bit_xor
+//   add32, sub32         lanes as 32-bit integers
+//   add16, sub16, mullo16, srl16, sll16
+//                        lanes as two 16-bit integers
+//   srl32, sll32, mullo32
+//   madd16               the products of the signed 16-bit halves of a and b,
+//                        added into the lane like pmaddwd
+//   abs32, cmpgt32       signed 32-bit lanes
+//   cmpeq32              comparisons set all bits of the lanes where they hold
+//   movemask             the top bit of every lane as a bit of an int
+//   is_zero              whether no bit of the vector is set
+//   to_mask, select      select takes b in the lanes where a comparison
+//                        result turned into a mask with to_mask is set, and
+//                        a elsewhere
+//   permute              lane i of the result is lane idx[i] of v
+//   gather               lane i of the result is base[idx[i]]
+//   spread_byte          byte k of every lane in both of its 16-bit halves
+//   compress_store       stores the lanes selected by the bits of a movemask
+//                        one after the other, and may write up to lanes
+//                        values
+//
+// The backends and the helpers for movemasks are in an unnamed namespace,
+// so every kernel instantiated with them is local to its source file.
+// Otherwise the linker could merge a copy built for AVX2 into the portable
+// code, which then can't run on machines without AVX2.
+namespace hqx
+{
+
+namespace
+{
+
+inline int count_bits(uint32_t bits)
+{
+#if defined(_MSC_VER)
+    bits = bits - (bits >> 1 & 0x55555555);
+    bits = (bits & 0x33333333) + (bits >> 2 & 0x33333333);
+    return (int)(((bits + (bits >> 4)) & 0x0F0F0F0F) * 0x01010101 >> 24);
+#else
+    return __builtin_popcount(bits);
+#endif
+}
+
+// The lowest set bit, bits must not be zero
+inline int lowest_bit(uint32_t bits)
+{
+#if defined(_MSC_VER)
+    unsigned long bit;
+    _BitScanForward(&bit, bits);
+    return (int)bit;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+// Eight lanes in four 64-bit words for machines without a vector unit we
+// support. Lanes 2k and 2k + 1 are the low and high half of word k. The
+// bitwise operations, the additions, shifts and comparisons work on whole
+// words with the carries kept inside the lanes, the multiplications and the
+// lane shuffles go through the lanes one at a time.
+struct vec_swar
+{
+    enum { lanes = 8 };
+
+    struct vec
+    {
+        uint64_t w[4];
+    };
+    typedef vec mask;
+
+    // The top bit of every 16-bit and every 32-bit field, and the low bit of
+    // every 32-bit field
+    static uint64_t high16() { return 0x8000800080008000ull; }
+    static uint64_t high32() { return 0x8000000080000000ull; }
+    static uint64_t low32() { return 0x0000000100000001ull; }
+
+    static uint32_t lane(const vec& v, int i) { return (uint32_t)(v.w[i / 2] >> 32 * (i % 2)); }
+
+    static vec from_lanes(const uint32_t l[8])
+    {
+        vec v;
+        for (int k = 0; k < 4; k++)
+            v.w[k] = l[2 * k] | (uint64_t)l[2 * k + 1] << 32;
+        return v;
+    }
+
+    // Sets every bit of the 32-bit fields whose top bit is set in h
+    static uint64_t expand(uint64_t h) { return (h >> 31 & low32()) * 0xFFFFFFFFu; }
+
+    static vec load(const void* p)
+    {
+        uint32_t l[8];
+        memcpy(l, p, sizeof(l));
+        return from_lanes(l);
+    }
+
+    static void store(void* p, const vec& v)
+    {
+        uint32_t l[8];
+        for (int i = 0; i < 8; i++)
+            l[i] = lane(v, i);
+        memcpy(p, l, sizeof(l));
+    }
+
+    static vec load_u16(const uint16_t* p)
+    {
+        uint32_t l[8];
+        for (int i = 0; i < 8; i++)
+            l[i] = p[i];
+        return from_lanes(l);
+    }
+
+    static void store_u16(uint16_t* p, const vec& v, int count)
+    {
+        for (int i = 0; i < count; i++)
+            p[i] = (uint16_t)lane(v, i);
+    }
+
+    static vec set1(int32_t x)
+    {
+        const uint64_t word = (uint32_t)x * low32();
+        vec v = { { word, word, word, word } };
+        return v;
+    }
+
+    static vec zero() { return set1(0); }
+
+    static vec bit_and(const vec& a, const vec& b)
+    {
+        vec r;
+        for (int k = 0; k < 4; k++)
+            r.w[k] = a.w[k] & b.w[k];
+        return r;
+    }
+
+    static vec bit_or(const vec& a, const vec& b)
+    {
+        vec r;
+        for (int k = 0; k < 4; k++)
+            r.w[k] = a.w[k] | b.w[k];
+        return r;
+    }
+
+    static vec bit_xor(const vec& a, const vec& b)
+    {
+        vec r;
+        for (int k = 0; k < 4; k++)
+            r.w[k] = a.w[k] ^ b.w[k];
+        return r;
+    }
+
+    // Adds the fields without their top bits, which can't carry into the
+    // next field, and then adds the top bits without a carry
+    static vec add(const vec& a, const vec& b, uint64_t high)
+    {
+        vec r;
+        for (int k = 0; k < 4; k++)
+            r.w[k] = ((a.w[k] & ~high) + (b.w[k] & ~high)) ^ ((a.w[k] ^ b.w[k]) & high);
+        return r;
+    }
+
+    // Sets the top bits of a so no field borrows from the next one
+    static vec sub(const vec& a, const vec& b, uint64_t high)
+    {
+        vec r;
+        for (int k = 0; k < 4; k++)
+            r.w[k] = ((a.w[k] | high) - (b.w[k] & ~high)) ^ ((a.w[k] ^ ~b.w[k]) & high);
+        return r;
+    }
+
+    static vec add32(const vec& a, const vec& b) { return add(a, b, high32()); }
+    static vec sub32(const vec& a, const vec& b) { return sub(a, b, high32()); }
+    static vec add16(const vec& a, const vec& b) { return add(a, b, high16()); }
+    static vec sub16(const vec& a, const vec& b) { return sub(a, b, high16()); }
+
+    static vec shift_right(const vec& a, int n, uint64_t keep)
+    {
+        vec r;
+        for (int k = 0; k < 4; k++)
+            r.w[k] = a.w[k] >> n & keep;
+        return r;
+    }
+
+    static vec srl32(const vec& a, int n) { return shift_right(a, n, (0xFFFFFFFFu >> n) * low32()); }
+    static vec srl16(const vec& a, int n) { return shift_right(a, n, (0xFFFFu >> n) * 0x0001000100010001ull); }
+
+    static vec sll32(const vec& a, int n)
+    {
+        const uint64_t keep = (uint64_t)(uint32_t)(0xFFFFFFFFu << n) * low32();
+        vec r;
+        for (int k = 0; k < 4; k++)
+            r.w[k] = a.w[k] << n & keep;
+        return r;
+    }
+
+    static vec sll16(const vec& a, int n)
+    {
+        const uint64_t keep = (0xFFFFu << n & 0xFFFFu) * 0x0001000100010001ull;
+        vec r;
+        for (int k = 0; k < 4; k++)
+            r.w[k] = a.w[k] << n & keep;
+        return r;
+    }
+
+    // Applies f to the pairs of lanes of a and b, two lanes per word
+    template <class F>
+    static vec lanewise(const vec& a, const vec& b, F f)
+    {
+        vec r;
+        for (int k = 0; k < 4; k++)
+        {
+            const uint64_t high = f((uint32_t)(a.w[k] >> 32), (uint32_t)(b.w[k] >> 32));
+            r.w[k] = f((uint32_t)a.w[k], (uint32_t)b.w[k]) | high << 32;
+        }
+        return r;
+    }
+
+    static vec mullo16(const vec& a, const vec& b)
+    {
+        return lanewise(a, b, [](uint32_t x, uint32_t y) {
+            return ((x & 0xFFFF) * (y & 0xFFFF) & 0xFFFF) | (x >> 16) * (y >> 16) << 16;
+        });
+    }
+
+    static vec mullo32(const vec& a, const vec& b)
+    {
+        return lanewise(a, b, [](uint32_t x, uint32_t y) { return x * y; });
+    }
+
+    static vec madd16(const vec& a, const vec& b)
+    {
+        return lanewise(a, b, [](uint32_t x, uint32_t y) {
+            return (uint32_t)((int64_t)(int16_t)x * (int16_t)y + (int64_t)(int16_t)(x >> 16) * (int16_t)(y >> 16));
+        });
+    }
+
+    static vec abs32(const vec& a)
+    {
+        vec sign;
+        for (int k = 0; k < 4; k++)
+            sign.w[k] = expand(a.w[k] & high32());
+        return sub32(bit_xor(a, sign), sign);
+    }
+
+    // b < a without overflow, the sign of b - a corrected where a and b
+    // have different signs (Hacker's Delight 2-12)
+    static vec cmpgt32(const vec& a, const vec& b)
+    {
+        const vec d = sub32(b, a);
+        vec r;
+        for (int k = 0; k < 4; k++)
+            r.w[k] = expand((d.w[k] ^ ((b.w[k] ^ a.w[k]) & (d.w[k] ^ b.w[k]))) & high32());
+        return r;
+    }
+
+    // The top bit of a field is set when any of its bits is: the low 31
+    // bits carry into it when they aren't all zero
+    static vec cmpeq32(const vec& a, const vec& b)
+    {
+        vec r;
+        for (int k = 0; k < 4; k++)
+        {
+            const uint64_t x = a.w[k] ^ b.w[k];
+            const uint64_t nonzero = (((x & ~high32()) + ~high32()) | x) & high32();
+            r.w[k] = expand(nonzero ^ high32());
+        }
+        return r;
+    }
+
+    static int movemask(const vec& v)
+    {
+        int bits = 0;
+        for (int k = 0; k < 4; k++)
+            bits |= (int)((v.w[k] >> 31 & 1) | (v.w[k] >> 62 & 2)) << 2 * k;
+        return bits;
+    }
+
+    static bool is_zero(const vec& v) { return (v.w[0] | v.w[1] | v.w[2] | v.w[3]) == 0; }
+
+    static mask to_mask(const vec& v) { return v; }
+
+    static vec select(const vec& a, const vec& b, const mask& m)
+    {
+        vec r;
+        for (int k = 0; k < 4; k++)
+            r.w[k] = (a.w[k] & ~m.w[k]) | (b.w[k] & m.w[k]);
+        return r;
+    }
+
+    static vec permute(const vec& v, const vec& idx)
+    {
+        uint32_t l[8];
+        for (int i = 0; i < 8; i++)
+            l[i] = lane(v, lane(idx, i) & 7);
+        return from_lanes(l);
+    }
+
+    static vec gather(const uint32_t* base, const vec& idx)
+    {
+        uint32_t l[8];
+        for (int i = 0; i < 8; i++)
+            l[i] = base[lane(idx, i)];
+        return from_lanes(l);
+    }
+
+    // The bytes fit in 16 bits after the multiplication, so it doesn't
+    // carry into the other lane of the word
+    static vec spread_byte(const vec& v, int k)
+    {
+        vec r;
+        for (int j = 0; j < 4; j++)
+            r.w[j] = (v.w[j] >> 8 * k & 0xFF * low32()) * 0x00010001u;
+        return r;
+    }
+
+    static void compress_store(uint32_t* dst, const vec& v, int selected)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            if (selected & (1 << i))
+                *dst++ = lane(v, i);
+        }
+    }
+};
+
+#if defined(__AVX2__)
+
+struct vec_avx2
+{
+    enum { lanes = 8 };
+
+    typedef __m256i vec;
+    typedef __m256i mask;
+
+    // Indices for permute that move the lanes selected by a movemask to the
+    // front of the vector
+    struct compress_table
+    {
+        uint32_t lanes[256][8];
+
+        compress_table()
+        {
+            for (int selected = 0; selected < 256; selected++)
+            {
+                int n = 0;
+                for (int lane = 0; lane < 8; lane++)
+                {
+                    if (selected & (1 << lane))
+                        lanes[selected][n++] = lane;
+                }
+                while (n < 8)
+                    lanes[selected][n++] = 0;
+            }
+        }
+    };
+
+    static vec load(const void* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void store(void* p, vec v) { _mm256_storeu_si256((__m256i*)p, v); }
+    static vec load_u16(const uint16_t* p) { return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p)); }
+
+    static void store_u16(uint16_t* p, vec v, int count)
+    {
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        if (count == 8)
+        {
+            _mm_storeu_si128((__m128i*)p, packed);
+        }
+        else
+        {
+            uint16_t tmp[8];
+            _mm_storeu_si128((__m128i*)tmp, packed);
+            memcpy(p, tmp, count * sizeof(uint16_t));
+        }
+    }
+
+    static vec set1(int32_t x) { return _mm256_set1_epi32(x); }
+    static vec zero() { return _mm256_setzero_si256(); }
+    static vec bit_and(vec a, vec b) { return _mm256_and_si256(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm256_or_si256(a, b); }
+    static vec bit_xor(vec a, vec b) { return _mm256_xor_si256(a, b); }
+    static vec add32(vec a, vec b) { return _mm256_add_epi32(a, b); }
+    static vec sub32(vec a, vec b) { return _mm256_sub_epi32(a, b); }
+    static vec add16(vec a, vec b) { return _mm256_add_epi16(a, b); }
+    static vec sub16(vec a, vec b) { return _mm256_sub_epi16(a, b); }
+    static vec srl32(vec a, int n) { return _mm256_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+    static vec sll32(vec a, int n) { return _mm256_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+    static vec srl16(vec a, int n) { return _mm256_srl_epi16(a, _mm_cvtsi32_si128(n)); }
+    static vec sll16(vec a, int n) { return _mm256_sll_epi16(a, _mm_cvtsi32_si128(n)); }
+    static vec mullo16(vec a, vec b) { return _mm256_mullo_epi16(a, b); }
+    static vec mullo32(vec a, vec b) { return _mm256_mullo_epi32(a, b); }
+    static vec madd16(vec a, vec b) { return _mm256_madd_epi16(a, b); }
+    static vec abs32(vec a) { return _mm256_abs_epi32(a); }
+    static vec cmpgt32(vec a, vec b) { return _mm256_cmpgt_epi32(a, b); }
+    static vec cmpeq32(vec a, vec b) { return _mm256_cmpeq_epi32(a, b); }
+    static int movemask(vec v) { return _mm256_movemask_ps(_mm256_castsi256_ps(v)); }
+    static bool is_zero(vec v) { return _mm256_testz_si256(v, v) != 0; }
+    static mask to_mask(vec v) { return v; }
+    static vec select(vec a, vec b, mask m) { return _mm256_blendv_epi8(a, b, m); }
+    static vec permute(vec v, vec idx) { return _mm256_permutevar8x32_epi32(v, idx); }
+    static vec gather(const uint32_t* base, vec idx) { return _mm256_i32gather_epi32((const int*)base, idx, 4); }
+
+    static vec spread_byte(vec v, int k)
+    {
+        const int first = (int)(0x80008000u | k * 0x00010001u), step = 4 * 0x00010001;
+        return _mm256_shuffle_epi8(v, _mm256_setr_epi32(first, first + step, first + 2 * step, first + 3 * step,
+                                                        first, first + step, first + 2 * step, first + 3 * step));
+    }
+
+    static void compress_store(uint32_t* dst, vec v, int selected)
+    {
+        static const compress_table table;
+        store(dst, permute(v, load(table.lanes[selected])));
+    }
+};
+
+#endif
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+
+// Comparisons give vectors like the other backends, masks are only used by
+// select and compress_store
+struct vec_avx512
+{
+    enum { lanes = 16 };
+
+    typedef __m512i vec;
+    typedef __mmask16 mask;
+
+    static vec load(const void* p) { return _mm512_loadu_si512(p); }
+    static void store(void* p, vec v) { _mm512_storeu_si512(p, v); }
+    static vec load_u16(const uint16_t* p) { return _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)p)); }
+
+    static void store_u16(uint16_t* p, vec v, int count)
+    {
+        __m256i narrow = _mm512_cvtepi32_epi16(v);
+        if (count == 16)
+        {
+            _mm256_storeu_si256((__m256i*)p, narrow);
+        }
+        else
+        {
+            uint16_t tmp[16];
+            _mm256_storeu_si256((__m256i*)tmp, narrow);
+            memcpy(p, tmp, count * sizeof(uint16_t));
+        }
+    }
+
+    static vec set1(int32_t x) { return _mm512_set1_epi32(x); }
+    static vec zero() { return _mm512_setzero_si512(); }
+    static vec bit_and(vec a, vec b) { return _mm512_and_si512(a, b); }
+    static vec bit_or(vec a, vec b) { return _mm512_or_si512(a, b); }
+    static vec bit_xor(vec a, vec b) { return _mm512_xor_si512(a, b); }
+    static vec add32(vec a, vec b) { return _mm512_add_epi32(a, b); }
+    static vec sub32(vec a, vec b) { return _mm512_sub_epi32(a, b); }
+    static vec add16(vec a, vec b) { return _mm512_add_epi16(a, b); }
+    static vec sub16(vec a, vec b) { return _mm512_sub_epi16(a, b); }
+    static vec srl32(vec a, int n) { return _mm512_srl_epi32(a, _mm_cvtsi32_si128(n)); }
+    static vec sll32(vec a, int n) { return _mm512_sll_epi32(a, _mm_cvtsi32_si128(n)); }
+    static vec srl16(vec a, int n) { return _mm512_srl_epi16(a, _mm_cvtsi32_si128(n)); }
+    static vec sll16(vec a, int n) { return _mm512_sll_epi16(a, _mm_cvtsi32_si128(n)); }
+    static vec mullo16(vec a, vec b) { return _mm512_mullo_epi16(a, b); }
+    static vec mullo32(vec a, vec b) { return _mm512_mullo_epi32(a, b); }
+    static vec madd16(vec a, vec b) { return _mm512_madd_epi16(a, b); }
+    static vec abs32(vec a) { return _mm512_abs_epi32(a); }
+    static vec cmpgt32(vec a, vec b) { return _mm512_maskz_set1_epi32(_mm512_cmpgt_epi32_mask(a, b), -1); }
+    static vec cmpeq32(vec a, vec b) { return _mm512_maskz_set1_epi32(_mm512_cmpeq_epi32_mask(a, b), -1); }
+    static int movemask(vec v) { return _mm512_cmplt_epi32_mask(v, _mm512_setzero_si512()); }
+    static bool is_zero(vec v) { return _mm512_test_epi32_mask(v, v) == 0; }
+    static mask to_mask(vec v) { return _mm512_test_epi32_mask(v, v); }
+    static vec select(vec a, vec b, mask m) { return _mm512_mask_blend_epi32(m, a, b); }
+    static vec permute(vec v, vec idx) { return _mm512_permutexvar_epi32(idx, v); }
+    static vec gather(const uint32_t* base, vec idx) { return _mm512_i32gather_epi32(idx, base, 4); }
+
+    static vec spread_byte(vec v, int k)
+    {
+        const int first = (int)(0x80008000u | k * 0x00010001u), step = 4 * 0x00010001;
+        return _mm512_shuffle_epi8(v, _mm512_broadcast_i32x4(
+                                          _mm_setr_epi32(first, first + step, first + 2 * step, first + 3 * step)));
+    }
+
+    static void compress_store(uint32_t* dst, vec v, int selected)
+    {
+        _mm512_mask_compressstoreu_epi32(dst, (__mmask16)selected, v);
+    }
+};
+
+#endif
+
+}
+
+}
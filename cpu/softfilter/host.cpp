@@ -0,0 +1,169 @@
+/* host.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+// Loads a software filter plugin the way RetroArch does and runs it on its
+// worker threads, the output is checked against libhqx.
+
+#include "softfilter.h"
+#include "hqx.h"
+
+#include <dlfcn.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const unsigned width = 320, height = 240;
+static int filter_scale = 2;
+
+static int get_int(void* userdata, const char* key, int* value, int default_value)
+{
+    if (strcmp(key, "scale") == 0)
+    {
+        *value = filter_scale;
+        return 1;
+    }
+    *value = default_value;
+    return 0;
+}
+
+static int get_float(void*, const char*, float* value, float default_value)
+{
+    *value = default_value;
+    return 0;
+}
+
+static int get_hex(void*, const char*, unsigned* value, unsigned default_value)
+{
+    *value = default_value;
+    return 0;
+}
+
+static int get_string(void*, const char*, char** output, const char* default_output)
+{
+    *output = strdup(default_output);
+    return 0;
+}
+
+static const softfilter_config config = { get_float, get_int, get_hex, nullptr, nullptr, get_string, free };
+
+// Runs the first packet on this thread and the others on their own threads
+static void run_packets(const std::vector<softfilter_work_packet>& packets, void* data)
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < packets.size(); i++)
+        threads.emplace_back(packets[i].work, data, packets[i].thread_data);
+
+    packets[0].work(data, packets[0].thread_data);
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+static bool run(const softfilter_implementation* impl, unsigned format, unsigned thread_count)
+{
+    const char* name = format == SOFTFILTER_FMT_RGB565 ? "RGB565" : "XRGB8888";
+    const size_t pixel_size = format == SOFTFILTER_FMT_RGB565 ? 2 : 4;
+
+    void* data = impl->create(&config, format, format, width, height, thread_count, 0, nullptr);
+    if (!data)
+    {
+        printf("%s: create failed\n", name);
+        return false;
+    }
+
+    unsigned out_width, out_height;
+    impl->query_output_size(data, &out_width, &out_height, width, height);
+
+    // Pixel art in a few colours
+    std::mt19937 rng(1);
+    std::vector<uint8_t> input(width * height * pixel_size);
+    for (unsigned y = 0; y < height; y++)
+    {
+        for (unsigned x = 0; x < width; x++)
+        {
+            uint32_t colour = ((x / 13) ^ (y / 7)) % 5 ? 0x00F0C080 * ((x / 13 + y / 7) % 3 + 1) : rng();
+            if (format == SOFTFILTER_FMT_RGB565)
+                ((uint16_t*)input.data())[y * width + x] = (uint16_t)colour;
+            else
+                ((uint32_t*)input.data())[y * width + x] = colour;
+        }
+    }
+
+    std::vector<softfilter_work_packet> packets(impl->query_num_threads(data));
+    std::vector<uint8_t> output(out_width * out_height * pixel_size);
+
+    auto start = std::chrono::steady_clock::now();
+    const int frames = 100;
+    for (int i = 0; i < frames; i++)
+    {
+        impl->get_work_packets(data, packets.data(), output.data(), out_width * pixel_size,
+                               input.data(), width, height, width * pixel_size);
+        run_packets(packets, data);
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    impl->destroy(data);
+
+    // Upscale the frame in one go to compare
+    hqx_format hqx_fmt = format == SOFTFILTER_FMT_RGB565 ? HQX_FORMAT_RGB565 : HQX_FORMAT_XRGB8888;
+    std::vector<uint8_t> expected(output.size());
+    hqx_context* ctx = hqx_create(filter_scale);
+    hqx_upscale(ctx, input.data(), width * pixel_size, expected.data(), out_width * pixel_size, width, height, hqx_fmt);
+    hqx_destroy(ctx);
+
+    bool ok = output == expected;
+    printf("%-8s %ux%u -> %ux%u, %zu threads: %.3f ms/frame, %s\n", name, width, height, out_width, out_height,
+           packets.size(), elapsed.count() / frames, ok ? "matches libhqx" : "DIFFERS from libhqx");
+    return ok;
+}
+
+int main(int argc, const char* argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s <filter plugin> [scale] [threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    filter_scale = argc > 2 ? atoi(argv[2]) : 2;
+    unsigned thread_count = argc > 3 ? atoi(argv[3]) : std::thread::hardware_concurrency();
+
+    void* plugin = dlopen(argv[1], RTLD_NOW | RTLD_LOCAL);
+    if (!plugin)
+    {
+        printf("Failed to load %s: %s\n", argv[1], dlerror());
+        return EXIT_FAILURE;
+    }
+
+    softfilter_get_implementation_t get_implementation =
+        (softfilter_get_implementation_t)dlsym(plugin, "softfilter_get_implementation");
+    const softfilter_implementation* impl = get_implementation ? get_implementation(0) : nullptr;
+    if (!impl || impl->api_version != SOFTFILTER_API_VERSION)
+    {
+        printf("%s is not a software filter with API version %d\n", argv[1], SOFTFILTER_API_VERSION);
+        return EXIT_FAILURE;
+    }
+
+    printf("%s (%s), scale %d\n", impl->ident, impl->short_ident, filter_scale);
+
+    bool ok = true;
+    const unsigned formats[] = { SOFTFILTER_FMT_RGB565, SOFTFILTER_FMT_XRGB8888 };
+    for (unsigned format : formats)
+    {
+        if (impl->query_input_formats() & format && impl->query_output_formats(format) & format)
+            ok &= run(impl, format, thread_count);
+    }
+
+    dlclose(plugin);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,172 @@
+/* hqx_filter.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "softfilter.h"
+#include "hqx.h"
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#if defined(_WIN32)
+#define SOFTFILTER_EXPORT __declspec(dllexport)
+#else
+#define SOFTFILTER_EXPORT __attribute__((visibility("default")))
+#endif
+
+static const unsigned supported_formats = SOFTFILTER_FMT_RGB565 | SOFTFILTER_FMT_XRGB8888;
+
+// Every worker thread upscales a band of rows with its own context
+struct filter_thread
+{
+    hqx_context* ctx;
+    hqx_format format;
+
+    const void* input;
+    void* output;
+    size_t input_stride, output_stride;
+    int width, height, y0, y1;
+};
+
+struct filter
+{
+    int scale;
+    std::vector<filter_thread> threads;
+};
+
+static unsigned query_input_formats(void)
+{
+    return supported_formats;
+}
+
+static unsigned query_output_formats(unsigned input_format)
+{
+    return input_format & supported_formats;
+}
+
+static void destroy(void* data)
+{
+    filter* f = (filter*)data;
+    for (filter_thread& thread : f->threads)
+        hqx_destroy(thread.ctx);
+    delete f;
+}
+
+static void* create(const struct softfilter_config* config,
+                    unsigned in_fmt, unsigned out_fmt,
+                    unsigned max_width, unsigned max_height,
+                    unsigned threads, softfilter_simd_mask_t simd, void* userdata)
+{
+    if (in_fmt != out_fmt || (in_fmt != SOFTFILTER_FMT_RGB565 && in_fmt != SOFTFILTER_FMT_XRGB8888))
+        return nullptr;
+
+    int scale = 2;
+    if (config && config->get_int)
+        config->get_int(userdata, "scale", &scale, 2);
+    if (scale < 2 || scale > 4)
+        return nullptr;
+
+    filter* f = new (std::nothrow) filter;
+    if (!f)
+        return nullptr;
+    f->scale = scale;
+
+    try
+    {
+        f->threads.resize(std::max(threads, 1u));
+    }
+    catch (const std::bad_alloc&)
+    {
+        delete f;
+        return nullptr;
+    }
+
+    // Reserve the scratch memory now so the frames don't allocate
+    const hqx_format format = in_fmt == SOFTFILTER_FMT_RGB565 ? HQX_FORMAT_RGB565 : HQX_FORMAT_XRGB8888;
+    for (filter_thread& thread : f->threads)
+    {
+        thread.format = format;
+        thread.ctx = hqx_create(scale);
+        if (!thread.ctx || hqx_reserve(thread.ctx, std::max(max_width, 1u), std::max(max_height, 1u), format) != HQX_OK)
+        {
+            destroy(f);
+            return nullptr;
+        }
+    }
+    return f;
+}
+
+static unsigned query_num_threads(void* data)
+{
+    return (unsigned)((filter*)data)->threads.size();
+}
+
+static void query_output_size(void* data, unsigned* out_width, unsigned* out_height,
+                              unsigned width, unsigned height)
+{
+    filter* f = (filter*)data;
+    *out_width = width * f->scale;
+    *out_height = height * f->scale;
+}
+
+static void work(void* data, void* thread_data)
+{
+    filter_thread* thread = (filter_thread*)thread_data;
+    if (thread->y0 < thread->y1)
+    {
+        hqx_upscale_rows(thread->ctx, thread->input, thread->input_stride, thread->output, thread->output_stride,
+                         thread->width, thread->height, thread->y0, thread->y1, thread->format);
+    }
+}
+
+static void get_work_packets(void* data, struct softfilter_work_packet* packets,
+                             void* output, size_t output_stride,
+                             const void* input, unsigned width, unsigned height, size_t input_stride)
+{
+    filter* f = (filter*)data;
+    const int count = (int)f->threads.size();
+
+    // Split the frame into bands of the same height
+    for (int i = 0; i < count; i++)
+    {
+        filter_thread& thread = f->threads[i];
+        thread.input = input;
+        thread.output = output;
+        thread.input_stride = input_stride;
+        thread.output_stride = output_stride;
+        thread.width = (int)width;
+        thread.height = (int)height;
+        thread.y0 = (int)((uint64_t)height * i / count);
+        thread.y1 = (int)((uint64_t)height * (i + 1) / count);
+
+        packets[i].work = work;
+        packets[i].thread_data = &thread;
+    }
+}
+
+static const struct softfilter_implementation hqx_implementation = {
+    query_input_formats,
+    query_output_formats,
+
+    create,
+    destroy,
+
+    query_num_threads,
+    query_output_size,
+    get_work_packets,
+
+    "HQx",
+    "hqx",
+    SOFTFILTER_API_VERSION
+};
+
+extern "C" SOFTFILTER_EXPORT const struct softfilter_implementation* softfilter_get_implementation(softfilter_simd_mask_t simd)
+{
+    return &hqx_implementation;
+}
@@ -0,0 +1,127 @@
+/* softfilter.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+/* Declarations of version 2 of the software video filter interface used by
+ * RetroArch (gfx/video_filters/softfilter.h). The layout of the structures
+ * and the signatures must stay identical to RetroArch's. */
+
+#ifndef SOFTFILTER_H
+#define SOFTFILTER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SOFTFILTER_SIMD_SSE      (1 << 0)
+#define SOFTFILTER_SIMD_SSE2     (1 << 1)
+#define SOFTFILTER_SIMD_VMX      (1 << 2)
+#define SOFTFILTER_SIMD_VMX128   (1 << 3)
+#define SOFTFILTER_SIMD_AVX      (1 << 4)
+#define SOFTFILTER_SIMD_NEON     (1 << 5)
+#define SOFTFILTER_SIMD_SSE3     (1 << 6)
+#define SOFTFILTER_SIMD_SSSE3    (1 << 7)
+#define SOFTFILTER_SIMD_MMX      (1 << 8)
+#define SOFTFILTER_SIMD_MMXEXT   (1 << 9)
+#define SOFTFILTER_SIMD_SSE4     (1 << 10)
+#define SOFTFILTER_SIMD_SSE42    (1 << 11)
+#define SOFTFILTER_SIMD_AVX2     (1 << 12)
+#define SOFTFILTER_SIMD_VFPU     (1 << 13)
+#define SOFTFILTER_SIMD_PS       (1 << 14)
+
+typedef unsigned softfilter_simd_mask_t;
+
+/* Reads the settings of the filter from its .filt file, the functions
+ * return non-zero when the key was found */
+typedef int (*softfilter_config_get_float_t)(void *userdata, const char *key, float *value, float default_value);
+typedef int (*softfilter_config_get_int_t)(void *userdata, const char *key, int *value, int default_value);
+typedef int (*softfilter_config_get_hex_t)(void *userdata, const char *key, unsigned *value, unsigned default_value);
+typedef int (*softfilter_config_get_float_array_t)(void *userdata, const char *key,
+      float **values, unsigned *out_num_values,
+      const float *default_values, unsigned num_default_values);
+typedef int (*softfilter_config_get_int_array_t)(void *userdata, const char *key,
+      int **values, unsigned *out_num_values,
+      const int *default_values, unsigned num_default_values);
+typedef int (*softfilter_config_get_string_t)(void *userdata, const char *key, char **output, const char *default_output);
+typedef void (*softfilter_config_free_t)(void *ptr);
+
+struct softfilter_config
+{
+   softfilter_config_get_float_t get_float;
+   softfilter_config_get_int_t get_int;
+   softfilter_config_get_hex_t get_hex;
+   softfilter_config_get_float_array_t get_float_array;
+   softfilter_config_get_int_array_t get_int_array;
+   softfilter_config_get_string_t get_string;
+   softfilter_config_free_t free;
+};
+
+#define SOFTFILTER_FMT_NONE     0
+#define SOFTFILTER_FMT_RGB565   (1 << 0)
+#define SOFTFILTER_FMT_XRGB8888 (1 << 1)
+#define SOFTFILTER_FMT_RGB4444  (1 << 2)
+
+typedef unsigned (*softfilter_query_input_formats_t)(void);
+typedef unsigned (*softfilter_query_output_formats_t)(unsigned input_format);
+
+typedef void *(*softfilter_create_t)(const struct softfilter_config *config,
+      unsigned in_fmt, unsigned out_fmt,
+      unsigned max_width, unsigned max_height,
+      unsigned threads, softfilter_simd_mask_t simd, void *userdata);
+typedef void (*softfilter_destroy_t)(void *data);
+
+typedef unsigned (*softfilter_query_num_threads_t)(void *data);
+typedef void (*softfilter_query_output_size_t)(void *data,
+      unsigned *out_width, unsigned *out_height,
+      unsigned width, unsigned height);
+
+/* The host runs every packet once per frame, each on its own thread */
+typedef void (*softfilter_work_t)(void *data, void *thread_data);
+
+struct softfilter_work_packet
+{
+   softfilter_work_t work;
+   void *thread_data;
+};
+
+typedef void (*softfilter_get_work_packets_t)(void *data,
+      struct softfilter_work_packet *packets,
+      void *output, size_t output_stride,
+      const void *input, unsigned width, unsigned height, size_t input_stride);
+
+#define SOFTFILTER_API_VERSION 2
+
+struct softfilter_implementation
+{
+   softfilter_query_input_formats_t query_input_formats;
+   softfilter_query_output_formats_t query_output_formats;
+
+   softfilter_create_t create;
+   softfilter_destroy_t destroy;
+
+   softfilter_query_num_threads_t query_num_threads;
+   softfilter_query_output_size_t query_output_size;
+   softfilter_get_work_packets_t get_work_packets;
+
+   const char *ident;
+   const char *short_ident;
+   unsigned api_version;
+};
+
+typedef const struct softfilter_implementation *(*softfilter_get_implementation_t)(softfilter_simd_mask_t simd);
+
+/* The entry point that is looked up in the filter's shared object */
+const struct softfilter_implementation *softfilter_get_implementation(softfilter_simd_mask_t simd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+/* streams.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+// Simulates a host running many emulators: every stream submits a frame at
+// 60 Hz with the next vsync as its deadline. Reports the frame latency,
+// missed deadlines and how the chunks were batched, and checks the order and
+// output of the frames.
+
+#include "hqx.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock clock_type;
+
+static const int frame_us = 16667;
+
+static std::mutex latency_lock;
+static std::vector<double> latencies;
+
+struct stream_state
+{
+    hqx_stream* stream = nullptr;
+    std::vector<uint32_t> input;
+    std::vector<uint32_t> outputs[2]; // one frame may be upscaled while the next is queued
+    clock_type::time_point submitted[2];
+    std::atomic<int> in_flight;
+    uint64_t submitted_frames = 0;
+    uint64_t last_frame = 0;
+    bool out_of_order = false;
+
+    stream_state() : in_flight(0) {}
+};
+
+static void frame_done(void* userdata, uint64_t frame, hqx_status status, int)
+{
+    stream_state& s = *(stream_state*)userdata;
+    double us = std::chrono::duration<double, std::micro>(clock_type::now() - s.submitted[frame % 2]).count();
+    if (frame != s.last_frame + 1 || status != HQX_OK)
+        s.out_of_order = true;
+    s.last_frame = frame;
+
+    std::lock_guard<std::mutex> guard(latency_lock);
+    latencies.push_back(us);
+    s.in_flight--;
+}
+
+int main(int argc, const char* argv[])
+{
+    const int stream_count = argc > 1 ? atoi(argv[1]) : 32;
+    const int width = argc > 2 ? atoi(argv[2]) : 256;
+    const int height = argc > 3 ? atoi(argv[3]) : 224;
+    const int scale = argc > 4 ? atoi(argv[4]) : 2;
+    const int threads = argc > 5 ? atoi(argv[5]) : 0;
+    const int frames = 300;
+    if (stream_count <= 0 || width <= 0 || height <= 0)
+    {
+        printf("Usage: %s [streams] [width] [height] [scale] [threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    hqx_scheduler* scheduler = hqx_scheduler_create(threads);
+    std::vector<stream_state> streams(stream_count);
+    std::mt19937 rng(1);
+    for (stream_state& s : streams)
+    {
+        s.input.resize(width * height);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                s.input[y * width + x] = ((x / 8) ^ (y / 8)) % 3 ? 0xFF3070B0 : rng();
+        s.outputs[0].resize(width * scale * height * scale);
+        s.outputs[1].resize(s.outputs[0].size());
+        s.stream = hqx_stream_create(scheduler, scale, HQX_FORMAT_XRGB8888, frame_done, &s);
+    }
+
+    // Every stream submits its frame at the start of the interval, a stream
+    // that still has two frames queued skips one like an emulator would
+    uint64_t skipped = 0;
+    clock_type::time_point start = clock_type::now(), next = start;
+    for (int i = 0; i < frames; i++)
+    {
+        for (stream_state& s : streams)
+        {
+            if (s.in_flight == 2)
+            {
+                skipped++;
+                continue;
+            }
+
+            const uint64_t frame = ++s.submitted_frames;
+            s.submitted[frame % 2] = clock_type::now();
+            s.in_flight++;
+            hqx_stream_submit(s.stream, s.input.data(), width * 4, s.outputs[frame % 2].data(), width * scale * 4,
+                              width, height, frame, frame_us);
+        }
+        next += std::chrono::microseconds(frame_us);
+        std::this_thread::sleep_until(next);
+    }
+    std::chrono::duration<double> elapsed = clock_type::now() - start;
+
+    int failures = 0;
+    for (stream_state& s : streams)
+    {
+        hqx_stream_destroy(s.stream);
+        if (s.out_of_order)
+            failures++;
+    }
+
+    hqx_scheduler_stats stats;
+    hqx_scheduler_get_stats(scheduler, &stats);
+    hqx_scheduler_destroy(scheduler);
+
+    // The last frame of every stream is compared with hqx_upscale
+    std::vector<uint32_t> expected(streams[0].outputs[0].size());
+    hqx_context* ctx = hqx_create(scale);
+    for (stream_state& s : streams)
+    {
+        hqx_upscale(ctx, s.input.data(), width * 4, expected.data(), width * scale * 4, width, height,
+                    HQX_FORMAT_XRGB8888);
+        failures += s.outputs[s.submitted_frames % 2] != expected;
+    }
+    hqx_destroy(ctx);
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%d streams of %dx%d at %dx: %.1f frames/s\n", stream_count, width, height, scale,
+           stats.frames / elapsed.count());
+    printf("latency p50 %.0f us, p99 %.0f us, max %.0f us\n", latencies[latencies.size() / 2],
+           latencies[latencies.size() * 99 / 100], latencies.back());
+    printf("%llu frames, %llu late, %llu skipped, %.1f chunks per batch\n", (unsigned long long)stats.frames,
+           (unsigned long long)stats.late, (unsigned long long)skipped, (double)stats.chunks / stats.batches);
+    if (failures)
+        printf("%d streams had frames out of order or with the wrong output\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
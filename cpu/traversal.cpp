@@ -0,0 +1,87 @@
+/* traversal.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+// Compares the traversal orders on a very wide frame: the throughput and the
+// cache misses counted by perf_event_open. The generic events only cover the
+// L1 data cache and the last level cache, the counters that aren't available
+// to this process are reported as n/a.
+
+#include "hqx.h"
+#include "perf.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+static perf_counter counters[] = {
+    { "L1D read misses", PERF_TYPE_HW_CACHE,
+      cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS), -1 },
+    { "LLC references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, -1 },
+    { "LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1 },
+};
+
+int main(int argc, const char* argv[])
+{
+    const int width = 16384;
+    const int height = argc > 1 ? atoi(argv[1]) : 256;
+    const int tile_size = argc > 2 ? atoi(argv[2]) : 0;
+    if (height <= 0 || tile_size < 0)
+    {
+        printf("Usage: %s [height] [tile size]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937 rng(1);
+    std::vector<uint32_t> input((size_t)width * height);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            input[(size_t)y * width + x] = ((x / 11) ^ (y / 9)) % 4 ? 0xFF2060A0 + ((x / 11 + y / 9) % 3 << 8) : rng();
+
+    open_counters(counters);
+    printf("%dx%d, tiles of %d pixels\n", width, height, tile_size ? tile_size : 128);
+
+    const char* names[] = { "rows", "columns", "morton" };
+    int failures = 0;
+    for (int scale = 2; scale <= 4; scale++)
+    {
+        const ptrdiff_t stride = (ptrdiff_t)width * scale * 4;
+        std::vector<uint32_t> expected((size_t)width * scale * height * scale), output(expected.size());
+        hqx_context* ctx = hqx_create(scale);
+        for (int traversal = HQX_TRAVERSAL_ROWS; traversal <= HQX_TRAVERSAL_MORTON; traversal++)
+        {
+            hqx_set_traversal(ctx, (hqx_traversal)traversal, tile_size);
+            std::vector<uint32_t>& dst = traversal == HQX_TRAVERSAL_ROWS ? expected : output;
+
+            // The first run touches the output pages
+            hqx_upscale(ctx, input.data(), width * 4, dst.data(), stride, width, height, HQX_FORMAT_XRGB8888);
+
+            printf("%dx %-8s", scale, names[traversal]);
+            const int runs = 3;
+            start_counters(counters);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < runs; i++)
+                hqx_upscale(ctx, input.data(), width * 4, dst.data(), stride, width, height, HQX_FORMAT_XRGB8888);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            printf(" %7.1f MP/s", (double)width * height * runs / elapsed.count() / 1e6);
+            stop_counters(counters, (double)width * height * runs);
+
+            if (traversal != HQX_TRAVERSAL_ROWS && output != expected)
+            {
+                printf("%dx %s: output differs from rows\n", scale, names[traversal]);
+                failures++;
+            }
+        }
+        hqx_destroy(ctx);
+    }
+
+    close_counters(counters);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+/* triple_buffer.h
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace hqx
+{
+
+// Hands frames from one producer thread to one consumer thread without locks.
+// Of the three slots the producer owns one to write into and the consumer one
+// to read from, the third holds the latest published frame. Publishing and
+// acquiring swap the owned slot with that one, so neither side ever waits and
+// a frame that is published before the last one was read replaces it.
+struct triple_buffer
+{
+    // The low bits hold the slot in the middle, the flag is set when it holds
+    // a frame the consumer hasn't taken yet
+    enum { slot_mask = 3, fresh = 4 };
+
+    std::atomic<uint8_t> middle;
+    int write_slot = 0;
+    int read_slot = 2;
+
+    triple_buffer() : middle(1) {}
+
+    // Producer: publishes the write slot and takes over the middle one,
+    // returns true when that still held an unread frame which is now dropped
+    bool publish()
+    {
+        uint8_t prev = middle.exchange((uint8_t)(write_slot | fresh), std::memory_order_acq_rel);
+        write_slot = prev & slot_mask;
+        return (prev & fresh) != 0;
+    }
+
+    bool pending() const
+    {
+        return (middle.load(std::memory_order_acquire) & fresh) != 0;
+    }
+
+    // Consumer: takes the latest frame into the read slot, returns false and
+    // keeps the read slot when nothing was published since the last call
+    bool acquire()
+    {
+        // Only the producer sets the flag, so it's still set at the exchange
+        if (!pending())
+            return false;
+
+        uint8_t prev = middle.exchange((uint8_t)read_slot, std::memory_order_acq_rel);
+        read_slot = prev & slot_mask;
+        return true;
+    }
+};
+
+}
@@ -0,0 +1,203 @@
+/* upscaler.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "hqx.h"
+#include "triple_buffer.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+struct frame_slot
+{
+    std::vector<uint8_t> pixels;
+    int width = 0, height = 0;
+};
+
+struct hqx_upscaler
+{
+    hqx_context* ctx = nullptr;
+    hqx_format format;
+    int scale, max_width, max_height;
+    ptrdiff_t input_stride, output_stride;
+
+    // Emulator to upscaler and upscaler to presenter
+    hqx::triple_buffer input, output;
+    frame_slot inputs[3], outputs[3];
+    bool presented_any = false;
+
+    // The upscaler sleeps while no frame is pending. It counts itself in
+    // sleepers before it checks for a frame, so the emulator thread only
+    // takes the lock to wake it up when it may be asleep.
+    std::mutex lock;
+    std::condition_variable wake;
+    std::atomic<int> sleepers;
+    bool stopping = false;
+    std::thread thread;
+
+    std::atomic<uint64_t> submitted, upscaled, presented, dropped, duplicated;
+
+    hqx_upscaler() : sleepers(0), submitted(0), upscaled(0), presented(0), dropped(0), duplicated(0) {}
+    ~hqx_upscaler() { hqx_destroy(ctx); }
+};
+
+static void run(hqx_upscaler* u)
+{
+    for (;;)
+    {
+        if (!u->input.pending())
+        {
+            std::unique_lock<std::mutex> guard(u->lock);
+            u->sleepers++;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            u->wake.wait(guard, [u] { return u->stopping || u->input.pending(); });
+            u->sleepers--;
+            if (u->stopping)
+                return;
+        }
+
+        u->input.acquire();
+        const frame_slot& src = u->inputs[u->input.read_slot];
+        frame_slot& dst = u->outputs[u->output.write_slot];
+        if (hqx_upscale(u->ctx, src.pixels.data(), u->input_stride, dst.pixels.data(), u->output_stride,
+                        src.width, src.height, u->format) != HQX_OK)
+            continue;
+
+        dst.width = src.width * u->scale;
+        dst.height = src.height * u->scale;
+        u->upscaled++;
+        if (u->output.publish())
+            u->dropped++;
+    }
+}
+
+hqx_upscaler* hqx_upscaler_create(int scale, int max_width, int max_height, hqx_format format)
+{
+    if (max_width <= 0 || max_height <= 0)
+        return nullptr;
+
+    hqx_upscaler* u = new (std::nothrow) hqx_upscaler;
+    if (!u)
+        return nullptr;
+
+    u->ctx = hqx_create(scale);
+    if (!u->ctx || hqx_reserve(u->ctx, max_width, max_height, format) != HQX_OK)
+    {
+        delete u;
+        return nullptr;
+    }
+
+    const ptrdiff_t size = format == HQX_FORMAT_RGB565 ? 2 : format == HQX_FORMAT_RGBA16161616 ? 8 : 4;
+    u->format = format;
+    u->scale = scale;
+    u->max_width = max_width;
+    u->max_height = max_height;
+    u->input_stride = max_width * size;
+    u->output_stride = max_width * scale * size;
+
+    try
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            u->inputs[i].pixels.resize(u->input_stride * max_height);
+            u->outputs[i].pixels.resize(u->output_stride * max_height * scale);
+        }
+        u->thread = std::thread(run, u);
+    }
+    catch (const std::exception&)
+    {
+        delete u;
+        return nullptr;
+    }
+    return u;
+}
+
+void hqx_upscaler_destroy(hqx_upscaler* upscaler)
+{
+    if (!upscaler)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(upscaler->lock);
+        upscaler->stopping = true;
+    }
+    upscaler->wake.notify_one();
+    upscaler->thread.join();
+    delete upscaler;
+}
+
+void* hqx_upscaler_input(hqx_upscaler* upscaler, ptrdiff_t* stride)
+{
+    if (stride)
+        *stride = upscaler->input_stride;
+    return upscaler->inputs[upscaler->input.write_slot].pixels.data();
+}
+
+hqx_status hqx_upscaler_submit(hqx_upscaler* upscaler, int width, int height)
+{
+    if (!upscaler || width <= 0 || height <= 0 || width > upscaler->max_width || height > upscaler->max_height)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    frame_slot& slot = upscaler->inputs[upscaler->input.write_slot];
+    slot.width = width;
+    slot.height = height;
+    upscaler->submitted++;
+    if (upscaler->input.publish())
+        upscaler->dropped++;
+
+    // The fences order the frame with the upscaler's count of sleepers, so
+    // either it sees the frame before it sleeps or it's woken up. Otherwise
+    // the emulator thread never touches the lock.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (upscaler->sleepers.load(std::memory_order_relaxed) > 0)
+    {
+        std::lock_guard<std::mutex> guard(upscaler->lock);
+        upscaler->wake.notify_one();
+    }
+    return HQX_OK;
+}
+
+const void* hqx_upscaler_output(hqx_upscaler* upscaler, int* width, int* height, ptrdiff_t* stride)
+{
+    if (upscaler->output.acquire())
+    {
+        upscaler->presented++;
+        upscaler->presented_any = true;
+    }
+    else if (upscaler->presented_any)
+    {
+        upscaler->duplicated++;
+    }
+    else
+    {
+        return nullptr;
+    }
+
+    const frame_slot& slot = upscaler->outputs[upscaler->output.read_slot];
+    if (width)
+        *width = slot.width;
+    if (height)
+        *height = slot.height;
+    if (stride)
+        *stride = upscaler->output_stride;
+    return slot.pixels.data();
+}
+
+void hqx_upscaler_get_stats(const hqx_upscaler* upscaler, hqx_upscaler_stats* stats)
+{
+    stats->submitted = upscaler->submitted;
+    stats->upscaled = upscaler->upscaled;
+    stats->presented = upscaler->presented;
+    stats->dropped = upscaler->dropped;
+    stats->duplicated = upscaler->duplicated;
+}
@@ -0,0 +1,195 @@
+/* video.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "context.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Runs of changed pixels closer than this are upscaled together, which saves
+// classifying the pixels around every run
+static const int merge_gap = 8;
+
+// The scratch memory of a frame
+struct video_buffers
+{
+    uint32_t* row;     // RGB565 source row converted to 32-bit
+    uint8_t* near;     // changed pixels in a column of three rows
+    uint8_t* dirty;    // pixels with a changed neighbourhood
+    uint16_t* index;   // a run and the pixels around it
+    uint32_t* window;
+    uint32_t* output;
+};
+
+template <typename Allocator>
+static video_buffers allocate(Allocator& memory, int width, int scale)
+{
+    video_buffers b;
+    b.row = memory.template allocate<uint32_t>(width);
+    b.near = memory.template allocate<uint8_t>(width);
+    b.dirty = memory.template allocate<uint8_t>(width);
+    b.index = memory.template allocate<uint16_t>(width + 2);
+    b.window = memory.template allocate<uint32_t>(hqx::window_size(width + 2));
+    b.output = memory.template allocate<uint32_t>((width + 2) * scale * scale);
+    return b;
+}
+
+// Pixels whose 3x3 neighbourhood holds a changed pixel, the edges of the
+// frame are repeated
+static void dilate(const video_state& state, int y, const video_buffers& scratch)
+{
+    const int width = state.width;
+    const uint8_t* above = &state.changed[std::max(y - 1, 0) * width];
+    const uint8_t* row = &state.changed[y * width];
+    const uint8_t* below = &state.changed[std::min(y + 1, state.height - 1) * width];
+    for (int x = 0; x < width; x++)
+        scratch.near[x] = above[x] | row[x] | below[x];
+
+    for (int x = 0; x < width; x++)
+        scratch.dirty[x] = scratch.near[std::max(x - 1, 0)] | scratch.near[x] | scratch.near[std::min(x + 1, width - 1)];
+}
+
+// Classifies and blends the pixels [x0, x1) of a row again, the pixels next
+// to the run are included so its edges see their real neighbours
+static void upscale_run(hqx_context* ctx, const video_buffers& scratch, int y, int x0, int x1, hqx::order channels,
+                        uint8_t* dst, ptrdiff_t dst_stride, hqx_format format)
+{
+    video_state& state = ctx->video;
+    const int scale = ctx->table->scale;
+    const int left = std::max(x0 - 1, 0), right = std::min(x1 + 1, state.width);
+    const int width = right - left;
+    const hqx::image image = { &state.frame[left], state.width, width, state.height, channels };
+
+    hqx::classify(image, y, y + 1, scratch.index, scratch.window);
+    std::copy(scratch.index + (x0 - left), scratch.index + (x1 - left), &state.index[y * state.width + x0]);
+    std::copy(&state.index[y * state.width + left], &state.index[y * state.width + right], scratch.index);
+    hqx::blend_columns_with(hqx::context_kernel(ctx, channels), *ctx->table, image, y, y + 1, 0, width,
+                            scratch.index, scratch.output, width * scale, false);
+
+    const int skip = (x0 - left) * scale, count = (x1 - x0) * scale;
+    for (int i = 0; i < scale; i++)
+    {
+        const uint32_t* row = scratch.output + i * width * scale + skip;
+        uint8_t* out = dst + (y * scale + i) * dst_stride;
+        if (format == HQX_FORMAT_RGB565)
+            hqx::pack_rgb565(row, count, (uint16_t*)out + x0 * scale);
+        else
+            memcpy((uint32_t*)out + x0 * scale, row, count * 4);
+    }
+}
+
+hqx_status hqx_upscale_video(hqx_context* ctx,
+                             const void* src, ptrdiff_t src_stride,
+                             void* dst, ptrdiff_t dst_stride,
+                             int width, int height, hqx_format format,
+                             hqx_video_stats* stats)
+{
+    const int size = hqx::pixel_size(format);
+    if (!ctx || !src || !dst || !size || hqx::wide_format(format) || width <= 0 || height <= 0 ||
+        src_stride % size || dst_stride % size || (uintptr_t)src % size || (uintptr_t)dst % size)
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    const int scale = ctx->table->scale;
+    hqx::arena_layout layout;
+    allocate(layout, width, scale);
+    if (!ctx->scratch.reset(layout.size))
+        return HQX_ERROR_OUT_OF_MEMORY;
+    const video_buffers scratch = allocate(ctx->scratch, width, scale);
+
+    // Everything is upscaled when there's no last frame to go by
+    video_state& state = ctx->video;
+    const bool reuse = state.width == width && state.height == height && state.format == format &&
+                       state.dst == dst && state.dst_stride == dst_stride && state.linear_light == ctx->linear_light;
+    try
+    {
+        if (!reuse)
+        {
+            hqx::assign_state(ctx, state.frame, (size_t)width * height, 0u);
+            hqx::assign_state(ctx, state.index, (size_t)width * height, (uint16_t)0);
+            hqx::assign_state(ctx, state.changed, (size_t)width * height, (uint8_t)0);
+        }
+    }
+    catch (const std::bad_alloc&)
+    {
+        state.width = 0;
+        return HQX_ERROR_OUT_OF_MEMORY;
+    }
+    state.width = width;
+    state.height = height;
+    state.format = format;
+    state.dst = dst;
+    state.dst_stride = dst_stride;
+    state.linear_light = ctx->linear_light;
+
+    // Takes the new frame in and marks the pixels that changed
+    uint32_t changed = 0;
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t* in = (const uint8_t*)src + y * src_stride;
+        const uint32_t* row = (const uint32_t*)in;
+        if (format == HQX_FORMAT_RGB565)
+        {
+            hqx::expand_rgb565((const uint16_t*)in, width, scratch.row);
+            row = scratch.row;
+        }
+
+        uint32_t* last = &state.frame[(size_t)y * width];
+        uint8_t* flags = &state.changed[(size_t)y * width];
+        if (!reuse)
+        {
+            memset(flags, 1, width);
+            changed += width;
+            memcpy(last, row, width * 4);
+            continue;
+        }
+
+        int count = hqx::compare_row(row, last, width, flags);
+        if (count)
+            memcpy(last, row, width * 4);
+        changed += count;
+    }
+
+    const hqx::order channels = format == HQX_FORMAT_RGBA8888 ? hqx::order_rgba : hqx::order_bgra;
+    uint32_t recomputed = 0;
+    for (int y = 0; y < height && changed; y++)
+    {
+        dilate(state, y, scratch);
+
+        int x = 0;
+        while (x < width)
+        {
+            while (x < width && !scratch.dirty[x])
+                x++;
+            if (x == width)
+                break;
+
+            // The end of the run, with short gaps taken along
+            int x0 = x, x1 = x;
+            while (x < width && x - x1 < merge_gap)
+            {
+                if (scratch.dirty[x])
+                    x1 = x + 1;
+                x++;
+            }
+            x = x1;
+
+            upscale_run(ctx, scratch, y, x0, x1, channels, (uint8_t*)dst, dst_stride, format);
+            recomputed += x1 - x0;
+        }
+    }
+
+    if (stats)
+    {
+        stats->pixels = (uint32_t)width * height;
+        stats->changed = changed;
+        stats->recomputed = recomputed;
+        stats->reuse_ratio = 1.0 - (double)recomputed / stats->pixels;
+    }
+    return HQX_OK;
+}
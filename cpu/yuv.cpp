@@ -0,0 +1,200 @@
+/* yuv.cpp
+*
+* Copyright (C) 2014 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the GNU Lesser General Public License, version 2.1 or later.
+* See the COPYING file for details.
+*/
+
+#include "context.h"
+
+// The YUV planes and where the output of a band goes in them
+struct yuv_writer
+{
+    hqx_yuv_planes planes;
+    hqx_yuv_format format;
+    hqx::order channels;
+
+    static void write(void* user, int y0, int y1, const uint32_t* output, ptrdiff_t stride, int width);
+};
+
+static void split(uint32_t pixel, hqx::order channels, int& r, int& g, int& b)
+{
+    const int c0 = pixel & 0xFF, c2 = pixel >> 16 & 0xFF;
+    r = channels == hqx::order_rgba ? c0 : c2;
+    g = pixel >> 8 & 0xFF;
+    b = channels == hqx::order_rgba ? c2 : c0;
+}
+
+// BT.601 with limited range in 8-bit fixed point
+static uint8_t luma(int r, int g, int b)
+{
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+// From the sums of the channels of four pixels
+static void chroma(int r, int g, int b, uint8_t& u, uint8_t& v)
+{
+    u = (uint8_t)(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+    v = (uint8_t)(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+}
+
+// Converts a pair of rows, the second one may be the first one again at the
+// bottom of an odd height
+static void convert_rows(const yuv_writer& w, const uint32_t* row0, const uint32_t* row1, int y, int width)
+{
+    uint8_t* luma0 = w.planes.planes[0] + y * w.planes.strides[0];
+    uint8_t* luma1 = row1 != row0 ? luma0 + w.planes.strides[0] : nullptr;
+    uint8_t* u_row = w.planes.planes[1] + y / 2 * w.planes.strides[1];
+    uint8_t* v_row = w.format == HQX_YUV_I420 ? w.planes.planes[2] + y / 2 * w.planes.strides[2] : nullptr;
+
+    for (int x = 0; x < width; x += 2)
+    {
+        // The last column is repeated at an odd width
+        const int x1 = x + 1 < width ? x + 1 : x;
+        int r[4], g[4], b[4];
+        split(row0[x], w.channels, r[0], g[0], b[0]);
+        split(row0[x1], w.channels, r[1], g[1], b[1]);
+        split(row1[x], w.channels, r[2], g[2], b[2]);
+        split(row1[x1], w.channels, r[3], g[3], b[3]);
+
+        luma0[x] = luma(r[0], g[0], b[0]);
+        if (x1 != x)
+            luma0[x1] = luma(r[1], g[1], b[1]);
+        if (luma1)
+        {
+            luma1[x] = luma(r[2], g[2], b[2]);
+            if (x1 != x)
+                luma1[x1] = luma(r[3], g[3], b[3]);
+        }
+
+        uint8_t u, v;
+        chroma(r[0] + r[1] + r[2] + r[3], g[0] + g[1] + g[2] + g[3], b[0] + b[1] + b[2] + b[3], u, v);
+        if (v_row)
+        {
+            u_row[x / 2] = u;
+            v_row[x / 2] = v;
+        }
+        else
+        {
+            u_row[x] = u;
+            u_row[x + 1] = v;
+        }
+    }
+}
+
+// Output that was blended in YUV already, luma is copied and chroma averaged
+static void subsample_rows(const yuv_writer& w, const uint32_t* row0, const uint32_t* row1, int y, int width)
+{
+    uint8_t* luma0 = w.planes.planes[0] + y * w.planes.strides[0];
+    uint8_t* luma1 = row1 != row0 ? luma0 + w.planes.strides[0] : nullptr;
+    uint8_t* u_row = w.planes.planes[1] + y / 2 * w.planes.strides[1];
+    uint8_t* v_row = w.format == HQX_YUV_I420 ? w.planes.planes[2] + y / 2 * w.planes.strides[2] : nullptr;
+
+    for (int x = 0; x < width; x++)
+    {
+        luma0[x] = (uint8_t)row0[x];
+        if (luma1)
+            luma1[x] = (uint8_t)row1[x];
+    }
+
+    for (int x = 0; x < width; x += 2)
+    {
+        const int x1 = x + 1 < width ? x + 1 : x;
+        const uint32_t p[4] = { row0[x], row0[x1], row1[x], row1[x1] };
+        uint32_t u = 2, v = 2;
+        for (uint32_t pixel : p)
+        {
+            u += pixel >> 8 & 0xFF;
+            v += pixel >> 16 & 0xFF;
+        }
+
+        if (v_row)
+        {
+            u_row[x / 2] = (uint8_t)(u >> 2);
+            v_row[x / 2] = (uint8_t)(v >> 2);
+        }
+        else
+        {
+            u_row[x] = (uint8_t)(u >> 2);
+            u_row[x + 1] = (uint8_t)(v >> 2);
+        }
+    }
+}
+
+// The bands hold an even number of source rows, so only the last one can end
+// in a row without a partner for the chroma
+void yuv_writer::write(void* user, int y0, int y1, const uint32_t* output, ptrdiff_t stride, int width)
+{
+    const yuv_writer& w = *(const yuv_writer*)user;
+    for (int y = y0; y < y1; y += 2)
+    {
+        const uint32_t* row = output + (y - y0) * stride;
+        const uint32_t* next = y + 1 < y1 ? row + stride : row;
+        if (w.channels == hqx::order_yuv)
+            subsample_rows(w, row, next, y, width);
+        else
+            convert_rows(w, row, next, y, width);
+    }
+}
+
+static bool valid_planes(const hqx_yuv_planes* planes, hqx_yuv_format format)
+{
+    return planes && (format == HQX_YUV_I420 || format == HQX_YUV_NV12) && planes->planes[0] && planes->planes[1] &&
+           (format == HQX_YUV_NV12 || planes->planes[2]);
+}
+
+hqx_status hqx_upscale_to_yuv(hqx_context* ctx,
+                              const void* src, ptrdiff_t src_stride,
+                              int width, int height, hqx_format format,
+                              const hqx_yuv_planes* dst, hqx_yuv_format yuv_format)
+{
+    const int size = hqx::pixel_size(format);
+    if (!ctx || !src || !size || hqx::wide_format(format) || width <= 0 || height <= 0 || src_stride % size ||
+        (uintptr_t)src % size || !valid_planes(dst, yuv_format))
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    const hqx::source source = hqx::packed_source(src, src_stride, format);
+    yuv_writer writer = { *dst, yuv_format, source.channels };
+    return hqx::upscale_bands(ctx, source, width, height, 0, height, nullptr, 0, yuv_writer::write, &writer);
+}
+
+// Source planes of hqx_upscale_yuv
+struct yuv_reader
+{
+    hqx_yuv_planes planes;
+    hqx_yuv_format format;
+
+    // Packs Y, U and V into the first three bytes of a pixel
+    static void read(const hqx::source& src, int y, uint32_t* row, int width)
+    {
+        const yuv_reader& r = *(const yuv_reader*)src.user;
+        const uint8_t* luma = r.planes.planes[0] + y * r.planes.strides[0];
+        const uint8_t* u_row = r.planes.planes[1] + y / 2 * r.planes.strides[1];
+        if (r.format == HQX_YUV_NV12)
+        {
+            for (int x = 0; x < width; x++)
+                row[x] = 0xFF000000 | (uint32_t)u_row[(x & ~1) + 1] << 16 | (uint32_t)u_row[x & ~1] << 8 | luma[x];
+            return;
+        }
+
+        const uint8_t* v_row = r.planes.planes[2] + y / 2 * r.planes.strides[2];
+        for (int x = 0; x < width; x++)
+            row[x] = 0xFF000000 | (uint32_t)v_row[x / 2] << 16 | (uint32_t)u_row[x / 2] << 8 | luma[x];
+    }
+};
+
+hqx_status hqx_upscale_yuv(hqx_context* ctx,
+                           const hqx_yuv_planes* src, hqx_yuv_format src_format,
+                           int width, int height,
+                           const hqx_yuv_planes* dst, hqx_yuv_format dst_format)
+{
+    if (!ctx || width <= 0 || height <= 0 || !valid_planes(src, src_format) || !valid_planes(dst, dst_format))
+        return HQX_ERROR_INVALID_ARGUMENT;
+
+    const yuv_reader reader = { *src, src_format };
+    const hqx::source source = { nullptr, 0, hqx::order_yuv, yuv_reader::read, &reader, nullptr };
+    yuv_writer writer = { *dst, dst_format, hqx::order_yuv };
+    return hqx::upscale_bands(ctx, source, width, height, 0, height, nullptr, 0, yuv_writer::write, &writer);
+}
@@ -71,6 +71,15 @@ void main()
 
 uniform sampler2D Texture;
 uniform sampler2D LUT;
+#if defined(LINEAR_LIGHT)
+// An sRGB texture of the same source, which the hardware converts to linear
+// light for the blend. The pixels are still compared on the encoded values
+// in Texture, the output has to go to an sRGB framebuffer.
+uniform sampler2D LinearTexture;
+#define BLEND_TEXTURE LinearTexture
+#else
+#define BLEND_TEXTURE Texture
+#endif
 uniform int FrameDirection;
 uniform int FrameCount;
 uniform vec2 OutputSize;
@@ -97,10 +106,10 @@ void main()
 
 	float dx = vTexCoord[0].z;
 	float dy = vTexCoord[0].w;
-	vec3 p1  = texture2D(Texture, vTexCoord[0].xy).rgb;
-	vec3 p2  = texture2D(Texture, vTexCoord[0].xy + vec2(dx, dy) * quad).rgb;
-	vec3 p3  = texture2D(Texture, vTexCoord[0].xy + vec2(dx, 0) * quad).rgb;
-	vec3 p4  = texture2D(Texture, vTexCoord[0].xy + vec2(0, dy) * quad).rgb;
+	vec3 p1  = texture2D(BLEND_TEXTURE, vTexCoord[0].xy).rgb;
+	vec3 p2  = texture2D(BLEND_TEXTURE, vTexCoord[0].xy + vec2(dx, dy) * quad).rgb;
+	vec3 p3  = texture2D(BLEND_TEXTURE, vTexCoord[0].xy + vec2(dx, 0) * quad).rgb;
+	vec3 p4  = texture2D(BLEND_TEXTURE, vTexCoord[0].xy + vec2(0, dy) * quad).rgb;
 	mat4x3 pixels = mat4x3(p1, p2, p3, p4);
 
 	vec3 w1  = yuv * texture2D(Texture, vTexCoord[1].xw).rgb;
@@ -108,7 +117,11 @@ void main()
 	vec3 w3  = yuv * texture2D(Texture, vTexCoord[1].zw).rgb;
 
 	vec3 w4  = yuv * texture2D(Texture, vTexCoord[2].xw).rgb;
+#if defined(LINEAR_LIGHT)
+	vec3 w5  = yuv * texture2D(Texture, vTexCoord[0].xy).rgb;
+#else
 	vec3 w5  = yuv * p1;
+#endif
 	vec3 w6  = yuv * texture2D(Texture, vTexCoord[2].zw).rgb;
 
 	vec3 w7  = yuv * texture2D(Texture, vTexCoord[3].xw).rgb;
@@ -11,11 +11,18 @@
 
 #include "lodepng.h"
 #include "linmath.h"
+#include "viewer.h"
 
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <vector>
 
 #ifdef _WIN32
 #define _ "\\"
@@ -23,11 +30,7 @@
 #define _ "/"
 #endif
 
-static const struct
-{
-    float x, y, z, w;
-    float u, v, s, t;
-} vertices[] =
+static const vertex vertices[] =
 {
     { -1.f, -1.f, 0.f, 1.f, 0.f, 1.f, 0.f, 0.f },
     { -1.f,  1.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f },
@@ -53,6 +56,32 @@ static const char* fragment_shader_text =
 "    gl_FragColor = texture2D(Texture, tex);\n"
 "}\n";
 
+// Blends with the index map of an .hqxidx sidecar, which replaces the
+// classification of the hqx shaders. Alpha is blended as well, as on the CPU.
+static const char* indexed_fragment_shader_text =
+"uniform sampler2D Texture;\n"
+"uniform usampler2D Index;\n"
+"uniform sampler2D LUT;\n"
+"uniform vec2 TextureSize;\n"
+"uniform float Scale;\n"
+"varying vec2 tex;\n"
+"void main()\n"
+"{\n"
+"    vec2 fp = fract(tex * TextureSize);\n"
+"    vec2 quad = sign(-0.5 + fp);\n"
+"    vec2 ps = 1.0 / TextureSize;\n"
+"    vec4 p1 = texture2D(Texture, tex);\n"
+"    vec4 p2 = texture2D(Texture, tex + ps * quad);\n"
+"    vec4 p3 = texture2D(Texture, tex + vec2(ps.x, 0) * quad);\n"
+"    vec4 p4 = texture2D(Texture, tex + vec2(0, ps.y) * quad);\n"
+"    mat4 pixels = mat4(p1, p2, p3, p4);\n"
+"    uint i = texelFetch(Index, ivec2(tex * TextureSize), 0).r;\n"
+"    vec2 index = vec2(float(i & 0xFFu), float(i >> 8u) * (Scale * Scale) + dot(floor(fp * Scale), vec2(1, Scale)));\n"
+"    vec2 step = 1.0 / vec2(256.0, 16.0 * (Scale * Scale));\n"
+"    vec4 weights = texture2D(LUT, index * step + step / 2.0);\n"
+"    gl_FragColor = pixels * (weights / dot(weights, vec4(1)));\n"
+"}\n";
+
 static const char* shader_files[] = {
     _"glsl" _"hq2x.glsl",
     _"glsl" _"hq3x.glsl",
@@ -68,6 +97,21 @@ static const char* lut_files[] = {
 static const uint8_t indices[] = { 0, 1, 2, 0, 2, 3 };
 
 static uint32_t image_width, image_height, image_scale = 2;
+static bool use_index = false;
+
+// Blends in linear light, from an sRGB copy of the image into the sRGB
+// framebuffer of the window
+static bool use_linear = false;
+
+// The tile viewer is used for images beyond GL_MAX_TEXTURE_SIZE and can be
+// switched on for the others
+static tile_viewer* viewer = nullptr;
+static bool use_viewer = false, viewer_only = false;
+static bool dragging = false;
+static double drag_x, drag_y;
+
+// Texels of upscaled tiles the viewer keeps
+static const size_t viewer_budget = 64 << 20;
 
 static void error_callback(int error, const char* description)
 {
@@ -84,14 +128,78 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 	{
 		image_scale = key - GLFW_KEY_0;
 
-        if (mods != GLFW_MOD_SHIFT)
+        if (mods != GLFW_MOD_SHIFT && !use_viewer)
 		    glfwSetWindowSize(window, image_width * image_scale, image_height * image_scale);
 	}
+
+    if (key == GLFW_KEY_I && action == GLFW_PRESS)
+        use_index = !use_index;
+
+    if (key == GLFW_KEY_L && action == GLFW_PRESS)
+        use_linear = !use_linear;
+
+    if (key == GLFW_KEY_V && action == GLFW_PRESS && viewer && !viewer_only)
+        use_viewer = !use_viewer;
+
+    if (use_viewer && (action == GLFW_PRESS || action == GLFW_REPEAT))
+    {
+        const double step = 64.0;
+        if (key == GLFW_KEY_LEFT)  viewer->pan(-step, 0);
+        if (key == GLFW_KEY_RIGHT) viewer->pan(step, 0);
+        if (key == GLFW_KEY_UP)    viewer->pan(0, -step);
+        if (key == GLFW_KEY_DOWN)  viewer->pan(0, step);
+    }
 }
 
+// Converts window coordinates to framebuffer pixels, which differ on high DPI screens
+static void to_framebuffer(GLFWwindow* window, double& x, double& y)
+{
+    int window_width, window_height, fb_width, fb_height;
+    glfwGetWindowSize(window, &window_width, &window_height);
+    glfwGetFramebufferSize(window, &fb_width, &fb_height);
+    x *= (double)fb_width / std::max(window_width, 1);
+    y *= (double)fb_height / std::max(window_height, 1);
+}
+
+static void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
+{
+    if (!use_viewer)
+        return;
+
+    double x, y;
+    int fb_width, fb_height;
+    glfwGetCursorPos(window, &x, &y);
+    to_framebuffer(window, x, y);
+    glfwGetFramebufferSize(window, &fb_width, &fb_height);
+    viewer->zoom_at(std::pow(1.25, yoffset), x, y, fb_width, fb_height);
+}
+
+static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+    if (button != GLFW_MOUSE_BUTTON_LEFT)
+        return;
+
+    dragging = action == GLFW_PRESS;
+    glfwGetCursorPos(window, &drag_x, &drag_y);
+    to_framebuffer(window, drag_x, drag_y);
+}
+
+static void cursor_position_callback(GLFWwindow* window, double x, double y)
+{
+    if (!dragging || !use_viewer)
+        return;
+
+    // The image follows the cursor
+    to_framebuffer(window, x, y);
+    viewer->pan(drag_x - x, drag_y - y);
+    drag_x = x;
+    drag_y = y;
+}
+
+// The buffer is reused between calls and only grows, the contents are null-terminated
 static void read_file(const char* filename, std::vector<char>& buffer)
 {
-    std::ifstream file(filename, std::ios::ate);
+    std::ifstream file(filename, std::ios::ate | std::ios::binary);
     if (!file.is_open())
     {
         std::cout << "Failed to open " << filename << std::endl;
@@ -101,42 +209,119 @@ static void read_file(const char* filename, std::vector<char>& buffer)
     std::streamsize size = file.tellg();
     file.seekg(0, std::ios::beg);
 
-    buffer.resize(size);
+    if (buffer.size() < (size_t)size + 1)
+        buffer.resize(size + 1);
     file.read(buffer.data(), size);
+    buffer[size] = '\0';
 }
 
-static GLuint load_texture(uint32_t* width, uint32_t* height, const char* filename)
+// The image buffer is reused between calls to avoid reallocating it for every file
+static void decode_image(uint32_t* width, uint32_t* height, const char* filename, std::vector<uint8_t>& image)
 {
-    std::vector<uint8_t> image;
-    uint32_t w, h, error;
-    GLuint texture;
+    uint32_t error;
 
-    error = lodepng::decode(image, w, h, filename);
+    image.clear();
+    error = lodepng::decode(image, *width, *height, filename);
     if (error)
     {
         error_callback(error, lodepng_error_text(error));
         exit(EXIT_FAILURE);
     }
+}
+
+// With GL_SRGB8_ALPHA8 the texture units convert the texels to linear light
+static GLuint upload_texture(uint32_t width, uint32_t height, const std::vector<uint8_t>& image,
+                             GLint internal_format = GL_RGBA8)
+{
+    GLuint texture;
 
     glGenTextures(1, &texture);
     glActiveTexture(GL_TEXTURE9); // loading stage
     glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.data());
+    glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.data());
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    return texture;
+}
+
+static GLuint load_texture(uint32_t* width, uint32_t* height, const char* filename, std::vector<uint8_t>& image)
+{
+    uint32_t w, h;
+    decode_image(&w, &h, filename, image);
 
     if (width) *width = w;
     if (height) *height = h;
+    return upload_texture(w, h, image);
+}
+
+// Loads the index map of an .hqxidx sidecar as an R16UI texture, the format is
+// described in cpu/hqx.h. Returns 0 when there is no valid sidecar for the image.
+static GLuint load_index(const char* filename, uint32_t width, uint32_t height, std::vector<char>& buffer)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+        return 0;
+
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    const uint8_t* data = (const uint8_t*)buffer.data();
+    const uint8_t* end = data + buffer.size();
+
+    // The thresholds are stored times 1000 and have to match yuv_threshold in
+    // the shaders, or the map was classified differently
+    auto get_u32 = [](const uint8_t* p) { return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24; };
+    if (buffer.size() < 28 || memcmp(data, "HQXIDX\1", 8) != 0 ||
+        get_u32(data + 8) != width || get_u32(data + 12) != height ||
+        get_u32(data + 16) != 48000 || get_u32(data + 20) != 7000 || get_u32(data + 24) != 6000)
+    {
+        std::cout << filename << " is not an index map of the image" << std::endl;
+        return 0;
+    }
+
+    // Varints of (run length - 1) << 12 | index, the runs have to cover the
+    // image exactly
+    const size_t entries = (size_t)width * height;
+    std::vector<uint16_t> index;
+    index.reserve(entries);
+    bool valid = true;
+    for (data += 28; valid && data < end;)
+    {
+        uint64_t token = 0;
+        for (int shift = 0; data < end && shift < 64; shift += 7)
+        {
+            token |= (uint64_t)(*data & 0x7F) << shift;
+            if (!(*data++ & 0x80))
+                break;
+        }
+        valid = !(data[-1] & 0x80) && (token >> 12) < entries - index.size();
+        if (valid)
+            index.insert(index.end(), (size_t)(token >> 12) + 1, (uint16_t)(token & 0xFFF));
+    }
+    if (!valid || index.size() != entries)
+    {
+        std::cout << filename << " is corrupt" << std::endl;
+        return 0;
+    }
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE9); // loading stage
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, index.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
     return texture;
 }
 
-static GLuint compile_shader(GLenum stage, const GLchar* source)
+static GLuint compile_shader(GLenum stage, const GLchar* source, const GLchar* defines = "")
 {
     GLchar* error_log;
     GLint compiled, length;
     GLuint shader;
-    const GLchar* sources[2] = { "#version 130\n", source };
+    const GLchar* sources[3] = { "#version 130\n", defines, source };
 
     // Both stages are present in the same file, use the pre-processor to separate them
     if (stage == GL_VERTEX_SHADER)
@@ -146,7 +331,7 @@ static GLuint compile_shader(GLenum stage, const GLchar* source)
         sources[0] = "#version 130\n#define FRAGMENT\n";
 
     shader = glCreateShader(stage);
-    glShaderSource(shader, 2, sources, NULL);
+    glShaderSource(shader, 3, sources, NULL);
     glCompileShader(shader);
 
     glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
@@ -213,6 +398,7 @@ int main(int argc, const char* argv[])
 
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 0);
+    glfwWindowHint(GLFW_SRGB_CAPABLE, GLFW_TRUE);
 
     GLFWwindow* window = glfwCreateWindow(640, 480, "HQx Sample", NULL, NULL);
     if (!window)
@@ -222,24 +408,49 @@ int main(int argc, const char* argv[])
     }
 
     glfwSetKeyCallback(window, key_callback);
+    glfwSetScrollCallback(window, scroll_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetCursorPosCallback(window, cursor_position_callback);
 
     glfwMakeContextCurrent(window);
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
     glfwSwapInterval(1);
 
-    // Load the image that we're going to upscale as a texture
-    GLuint texture = load_texture(&image_width, &image_height, image_path.c_str());
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    // Scratch buffers shared by all the files we load
+    std::vector<uint8_t> image;
+    std::vector<char> shader;
+
+    // Load the image that we're going to upscale, as a texture when it fits in one
+    std::vector<uint8_t> source;
+    decode_image(&image_width, &image_height, image_path.c_str(), source);
+
+    GLint max_texture_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    viewer_only = image_width > (uint32_t)max_texture_size || image_height > (uint32_t)max_texture_size;
+    GLuint texture = 0;
+    if (!viewer_only)
+    {
+        texture = upload_texture(image_width, image_height, source);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+
+    // Blending in linear light needs a window that encodes its output to sRGB
+    GLint encoding = GL_LINEAR;
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_BACK_LEFT, GL_FRAMEBUFFER_ATTACHMENT_COLOR_ENCODING,
+                                          &encoding);
+    GLuint linear_texture = 0;
+    if (!viewer_only && encoding == GL_SRGB)
+        linear_texture = upload_texture(image_width, image_height, source, GL_SRGB8_ALPHA8);
 
-    // Load the full-screen quad in the vertex buffer
+    // Load the full-screen quad in the vertex buffer, the viewer draws its tiles with it as well
     GLuint vertex_buffer;
     glGenBuffers(1, &vertex_buffer);
     glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_DYNAMIC_DRAW);
 
     // Initialise a vector to contain all our upscaling shaders, the index represents the scale
-    std::vector<GLuint> programs, lut_textures;
+    std::vector<GLuint> programs, lut_textures, linear_programs(4);
     programs.push_back(NULL);
     lut_textures.push_back(NULL);
 
@@ -268,48 +479,136 @@ int main(int argc, const char* argv[])
     for (int i = 0; i < 3; i++)
     {
         // Generate the path for the shader
-        std::vector<char> shader;
         std::string shader_path(base_path);
         shader_path.append(shader_files[i]);
 
-        // Load the shader
+        // Load the shader, and a variant that blends from the sRGB copy of
+        // the image in linear light
         read_file(shader_path.c_str(), shader);
         vertex_shader = compile_shader(GL_VERTEX_SHADER, shader.data());
         fragment_shader = compile_shader(GL_FRAGMENT_SHADER, shader.data());
         GLuint program = link_program(vertex_shader, fragment_shader);
+        if (linear_texture)
+        {
+            vertex_shader = compile_shader(GL_VERTEX_SHADER, shader.data(), "#define LINEAR_LIGHT\n");
+            fragment_shader = compile_shader(GL_FRAGMENT_SHADER, shader.data(), "#define LINEAR_LIGHT\n");
+            linear_programs[i + 2] = link_program(vertex_shader, fragment_shader);
+        }
 
         // Set up the uniforms
-        GLint mvp_location = glGetUniformLocation(program, "MVPMatrix");
-        GLint samp_location = glGetUniformLocation(program, "Texture");
-        GLint lut_location = glGetUniformLocation(program, "LUT");
-        GLint tsize_location = glGetUniformLocation(program, "TextureSize");
-
-        glUseProgram(program);
-        glUniformMatrix4fv(mvp_location, 1, GL_FALSE, (const GLfloat*)mvp);
-        glUniform1i(samp_location, 0);
-        glUniform1i(lut_location, 1);
-        glUniform2f(tsize_location, (float)image_width, (float)image_height);
+        for (GLuint p : { program, linear_programs[i + 2] })
+        {
+            if (!p)
+                continue;
+
+            glUseProgram(p);
+            glUniformMatrix4fv(glGetUniformLocation(p, "MVPMatrix"), 1, GL_FALSE, (const GLfloat*)mvp);
+            glUniform1i(glGetUniformLocation(p, "Texture"), 0);
+            glUniform1i(glGetUniformLocation(p, "LUT"), 1);
+            glUniform1i(glGetUniformLocation(p, "LinearTexture"), 3);
+            glUniform2f(glGetUniformLocation(p, "TextureSize"), (float)image_width, (float)image_height);
+        }
 
         // Load the Lookup Texture
         std::string lut_path(base_path);
         lut_path.append(lut_files[i]);
-        GLuint lut = load_texture(nullptr, nullptr, lut_path.c_str());
+        GLuint lut = load_texture(nullptr, nullptr, lut_path.c_str(), image);
 
         programs.push_back(program);
         lut_textures.push_back(lut);
     }
 
+    // Load the index map sidecar of the image, if there is one, to blend
+    // without classifying the pixels
+    std::string index_path = image_path.substr(0, image_path.rfind('.')) + ".hqxidx";
+    GLuint index_texture = viewer_only ? 0 : load_index(index_path.c_str(), image_width, image_height, shader);
+    GLuint indexed_program = 0;
+    if (index_texture)
+    {
+        vertex_shader = compile_shader(GL_VERTEX_SHADER, vertex_shader_text);
+        fragment_shader = compile_shader(GL_FRAGMENT_SHADER, indexed_fragment_shader_text);
+        indexed_program = link_program(vertex_shader, fragment_shader);
+
+        glUseProgram(indexed_program);
+        glUniform1i(glGetUniformLocation(indexed_program, "Texture"), 0);
+        glUniform1i(glGetUniformLocation(indexed_program, "LUT"), 1);
+        glUniform1i(glGetUniformLocation(indexed_program, "Index"), 2);
+        glUniform2f(glGetUniformLocation(indexed_program, "TextureSize"), (float)image_width, (float)image_height);
+
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, index_texture);
+        use_index = true;
+        std::cout << "Blending with " << index_path << ", press I to classify instead" << std::endl;
+    }
+
+    viewer = new tile_viewer(source.data(), image_width, image_height, viewer_budget, vertex_buffer);
+    if (viewer_only)
+    {
+        use_viewer = true;
+        std::cout << "The image is larger than " << max_texture_size << " pixels, showing it in tiles" << std::endl;
+    }
+    else
+    {
+        std::cout << "Press V to show the image in tiles" << std::endl;
+    }
+    if (linear_texture)
+        std::cout << "Press L to blend in linear light" << std::endl;
+
     // Resize the window to the default scale and enter the render loop
-    glfwSetWindowSize(window, image_width * image_scale, image_height * image_scale);
+    if (viewer_only)
+        glfwSetWindowSize(window, 1280, 720);
+    else
+        glfwSetWindowSize(window, image_width * image_scale, image_height * image_scale);
     while (!glfwWindowShouldClose(window))
     {
         int width, height;
         glfwGetFramebufferSize(window, &width, &height);
 
+        // The tile viewer and the passthrough shader always draw the encoded values
+        const bool linear = use_linear && linear_texture && !use_viewer && image_scale > 1;
+        if (linear)
+            glEnable(GL_FRAMEBUFFER_SRGB);
+        else
+            glDisable(GL_FRAMEBUFFER_SRGB);
+
+        if (use_viewer)
+        {
+            // Upscaling a few tiles per frame keeps the panning smooth
+            viewer->draw(programs, lut_textures, image_scale, width, height, 8);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+
+            char title[128];
+            snprintf(title, sizeof(title), "HQx Sample - %zu tiles cached, %llu upscaled, %llu ahead, %llu evicted",
+                     viewer->tiles.size(), (unsigned long long)viewer->upscaled,
+                     (unsigned long long)viewer->prefetched, (unsigned long long)viewer->evicted);
+            glfwSetWindowTitle(window, title);
+
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+            continue;
+        }
+
         glViewport(0, 0, width, height);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        glUseProgram(programs[image_scale]);
+        // The indexed shader doesn't compare the pixels, so it blends the
+        // sRGB copy in place of the image
+        const bool indexed = indexed_program && use_index && image_scale > 1;
+        if (indexed)
+        {
+            glUseProgram(indexed_program);
+            glUniform1f(glGetUniformLocation(indexed_program, "Scale"), (float)image_scale);
+        }
+        else
+        {
+            GLuint program = linear ? linear_programs[image_scale] : programs[image_scale];
+            glUseProgram(program);
+            glUniform2f(glGetUniformLocation(program, "TextureSize"), (float)image_width, (float)image_height);
+        }
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, linear_texture);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, linear && indexed ? linear_texture : texture);
         glActiveTexture(GL_TEXTURE1);
         glBindTexture(GL_TEXTURE_2D, lut_textures[image_scale]);
 
@@ -319,6 +618,7 @@ int main(int argc, const char* argv[])
         glfwPollEvents();
     }
 
+    delete viewer;
     glfwDestroyWindow(window);
 
     glfwTerminate();
@@ -0,0 +1,241 @@
+/* viewer.cpp
+*
+* Copyright (C) 2017 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the MIT license.  See the LICENSE file for details.
+*/
+
+#include "viewer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static uint64_t tile_key(int scale, uint32_t tx, uint32_t ty)
+{
+    return (uint64_t)scale << 56 | (uint64_t)ty << 28 | tx;
+}
+
+tile_viewer::tile_viewer(const uint8_t* pixels, uint32_t width, uint32_t height, size_t budget,
+                         GLuint vertex_buffer)
+    : pixels(pixels), width(width), height(height), budget(budget), vertex_buffer(vertex_buffer)
+{
+    center_x = last_x = width / 2.0;
+    center_y = last_y = height / 2.0;
+    staging.resize((tile_size + 2) * (tile_size + 2) * 4);
+
+    glGenTextures(1, &source_texture);
+    glGenFramebuffers(1, &framebuffer);
+}
+
+tile_viewer::~tile_viewer()
+{
+    for (const tile& t : tiles)
+        glDeleteTextures(1, &t.texture);
+    glDeleteTextures(1, &source_texture);
+    glDeleteFramebuffers(1, &framebuffer);
+}
+
+void tile_viewer::zoom_at(double factor, double x, double y, int fb_width, int fb_height)
+{
+    // Keep the source pixel under the cursor in place
+    const double sx = center_x + (x - fb_width / 2.0) / zoom;
+    const double sy = center_y + (y - fb_height / 2.0) / zoom;
+    zoom = std::min(std::max(zoom * factor, min_zoom), 64.0);
+    center_x = sx - (x - fb_width / 2.0) / zoom;
+    center_y = sy - (y - fb_height / 2.0) / zoom;
+}
+
+void tile_viewer::pan(double dx, double dy)
+{
+    center_x = std::min(std::max(center_x + dx / zoom, 0.0), (double)width);
+    center_y = std::min(std::max(center_y + dy / zoom, 0.0), (double)height);
+}
+
+// Tiles along one axis that are kept for a span of source pixels, the visible
+// ones and one on either side
+size_t tile_viewer::cached_tiles(double span, uint32_t tiles) const
+{
+    return (size_t)std::min(std::ceil(span / tile_size) + 1, (double)tiles) + 2;
+}
+
+const tile_viewer::tile* tile_viewer::find(uint64_t key)
+{
+    auto it = lookup.find(key);
+    if (it == lookup.end())
+        return nullptr;
+
+    // Move to the front
+    tiles.splice(tiles.begin(), tiles, it->second);
+    return &tiles.front();
+}
+
+void tile_viewer::draw_quad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1)
+{
+    const vertex quad[] =
+    {
+        { x0, y0, 0.f, 1.f, u0, v0, 0.f, 0.f },
+        { x0, y1, 0.f, 1.f, u0, v1, 0.f, 0.f },
+        { x1, y1, 0.f, 1.f, u1, v1, 0.f, 0.f },
+        { x1, y0, 0.f, 1.f, u1, v0, 0.f, 0.f }
+    };
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(quad), quad);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+}
+
+const tile_viewer::tile* tile_viewer::upscale(const std::vector<GLuint>& programs, const std::vector<GLuint>& luts,
+                                              int scale, uint32_t tx, uint32_t ty)
+{
+    // The tile and a halo of one pixel, the edges of the image are repeated
+    const uint32_t x0 = tx * tile_size, y0 = ty * tile_size;
+    const uint32_t w = std::min<uint32_t>(tile_size, width - x0), h = std::min<uint32_t>(tile_size, height - y0);
+    for (uint32_t y = 0; y < h + 2; y++)
+    {
+        const uint32_t sy = std::min(std::max(y0 + y, 1u) - 1, height - 1);
+        for (uint32_t x = 0; x < w + 2; x++)
+        {
+            const uint32_t sx = std::min(std::max(x0 + x, 1u) - 1, width - 1);
+            memcpy(&staging[(y * (w + 2) + x) * 4], pixels + ((size_t)sy * width + sx) * 4, 4);
+        }
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w + 2, h + 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, staging.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    tile t = { tile_key(scale, tx, ty), 0 };
+    glGenTextures(1, &t.texture);
+    glBindTexture(GL_TEXTURE_2D, t.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w * scale, h * scale, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    // Only the interior of the source is upscaled. The quad is upside down so
+    // the first row of the texture holds the top of the tile, like the source.
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t.texture, 0);
+    glViewport(0, 0, w * scale, h * scale);
+
+    glUseProgram(programs[scale]);
+    glUniform2f(glGetUniformLocation(programs[scale], "TextureSize"), (float)(w + 2), (float)(h + 2));
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, luts[scale]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, source_texture);
+    draw_quad(-1.f, -1.f, 1.f, 1.f, 1.f / (w + 2), 1.f / (h + 2), (w + 1.f) / (w + 2), (h + 1.f) / (h + 2));
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+
+    tiles.push_front(t);
+    lookup[t.key] = tiles.begin();
+    upscaled++;
+    return &tiles.front();
+}
+
+void tile_viewer::draw(const std::vector<GLuint>& programs, const std::vector<GLuint>& luts, int scale,
+                       int fb_width, int fb_height, int max_upscales)
+{
+    // The tiles are drawn into whatever framebuffer is bound
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &target);
+
+    // Follow the panning with some smoothing, in source pixels per frame
+    velocity_x = velocity_x * 0.75 + (center_x - last_x) * 0.25;
+    velocity_y = velocity_y * 0.75 + (center_y - last_y) * 0.25;
+    last_x = center_x;
+    last_y = center_y;
+
+    // Zoom in until the visible tiles fit in the budget at this scale and
+    // framebuffer size, so the cache never has to grow beyond it
+    const uint32_t tiles_x = (width + tile_size - 1) / tile_size, tiles_y = (height + tile_size - 1) / tile_size;
+    const size_t tile_texels = (size_t)tile_size * scale * tile_size * scale;
+    const size_t capacity = budget / tile_texels;
+    for (min_zoom = 1.0 / 64; min_zoom < 64.0; min_zoom *= 1.25)
+    {
+        if (cached_tiles(fb_width / min_zoom, tiles_x) * cached_tiles(fb_height / min_zoom, tiles_y) <= capacity)
+            break;
+    }
+    min_zoom = std::min(min_zoom, 64.0);
+    zoom = std::max(zoom, min_zoom);
+
+    // The visible tiles
+    const double left = center_x - fb_width / 2.0 / zoom, top = center_y - fb_height / 2.0 / zoom;
+    const int tx0 = std::max((int)std::floor(left / tile_size), 0);
+    const int ty0 = std::max((int)std::floor(top / tile_size), 0);
+    const int tx1 = std::min((int)std::floor((left + fb_width / zoom) / tile_size), (int)tiles_x - 1);
+    const int ty1 = std::min((int)std::floor((top + fb_height / zoom) / tile_size), (int)tiles_y - 1);
+
+    glClear(GL_COLOR_BUFFER_BIT);
+    for (int ty = ty0; ty <= ty1; ty++)
+    {
+        for (int tx = tx0; tx <= tx1; tx++)
+        {
+            const tile* t = find(tile_key(scale, tx, ty));
+            if (!t && max_upscales > 0)
+            {
+                t = upscale(programs, luts, scale, tx, ty);
+                max_upscales--;
+            }
+            if (!t)
+                continue;
+
+            // Pixel positions on the framebuffer to normalized device coordinates
+            const uint32_t w = std::min<uint32_t>(tile_size, width - tx * tile_size);
+            const uint32_t h = std::min<uint32_t>(tile_size, height - ty * tile_size);
+            const double x0 = (tx * tile_size - left) * zoom, y0 = (ty * tile_size - top) * zoom;
+            const double x1 = x0 + w * zoom, y1 = y0 + h * zoom;
+
+            glViewport(0, 0, fb_width, fb_height);
+            glUseProgram(programs[1]);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, t->texture);
+            draw_quad((float)(x0 / fb_width * 2 - 1), (float)(1 - y1 / fb_height * 2),
+                      (float)(x1 / fb_width * 2 - 1), (float)(1 - y0 / fb_height * 2), 0.f, 1.f, 1.f, 0.f);
+        }
+    }
+
+    // Upscale the next column or row in the direction of the panning ahead of
+    // time, with whatever is left of this frame's budget
+    const double threshold = 0.5 / zoom;
+    std::vector<std::pair<int, int>> ahead;
+    if (std::fabs(velocity_x) > threshold)
+    {
+        const int tx = velocity_x > 0 ? tx1 + 1 : tx0 - 1;
+        for (int ty = ty0; ty <= ty1; ty++)
+            ahead.emplace_back(tx, ty);
+    }
+    if (std::fabs(velocity_y) > threshold)
+    {
+        const int ty = velocity_y > 0 ? ty1 + 1 : ty0 - 1;
+        for (int tx = tx0; tx <= tx1; tx++)
+            ahead.emplace_back(tx, ty);
+    }
+    for (const std::pair<int, int>& p : ahead)
+    {
+        if (max_upscales <= 0)
+            break;
+        if (p.first < 0 || p.second < 0 || p.first >= (int)tiles_x || p.second >= (int)tiles_y ||
+            lookup.count(tile_key(scale, p.first, p.second)))
+            continue;
+
+        upscale(programs, luts, scale, p.first, p.second);
+        prefetched++;
+        max_upscales--;
+    }
+
+    // Evict the tiles that were drawn the longest ago
+    while (tiles.size() > capacity)
+    {
+        glDeleteTextures(1, &tiles.back().texture);
+        lookup.erase(tiles.back().key);
+        tiles.pop_back();
+        evicted++;
+    }
+
+    glViewport(0, 0, fb_width, fb_height);
+}
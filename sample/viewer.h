@@ -0,0 +1,84 @@
+/* viewer.h
+*
+* Copyright (C) 2017 Jules Blok
+*
+* This software may be modified and distributed under the terms
+* of the MIT license.  See the LICENSE file for details.
+*/
+
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+struct vertex
+{
+    float x, y, z, w;
+    float u, v, s, t;
+};
+
+// Shows images of any size, even beyond GL_MAX_TEXTURE_SIZE. The source is
+// split into tiles that are uploaded with a one pixel halo and upscaled on
+// their own, only when they become visible. The upscaled tiles are kept in a
+// cache of textures that evicts the least recently drawn ones, and the tiles
+// just outside the view are upscaled ahead of time in the direction of the
+// panning.
+struct tile_viewer
+{
+    enum { tile_size = 256 };
+
+    // Upscaled tiles, the most recently drawn first
+    struct tile
+    {
+        uint64_t key;
+        GLuint texture;
+    };
+
+    const uint8_t* pixels; // RGBA source, kept by the caller
+    uint32_t width, height;
+    size_t budget; // texels of upscaled tiles that are kept
+
+    // Screen pixels per source pixel and the source position in the middle of
+    // the screen. The view can't be zoomed out further than min_zoom, where the
+    // visible tiles and a ring around them still fit in the budget.
+    double zoom = 1.0, min_zoom = 1.0 / 64;
+    double center_x, center_y;
+    double velocity_x = 0.0, velocity_y = 0.0;
+    double last_x, last_y;
+
+    std::list<tile> tiles;
+    std::unordered_map<uint64_t, std::list<tile>::iterator> lookup;
+    std::vector<uint8_t> staging;
+    GLuint source_texture = 0, framebuffer = 0, vertex_buffer;
+    GLint target = 0; // framebuffer the tiles are drawn into
+
+    uint64_t upscaled = 0, prefetched = 0, evicted = 0;
+
+    tile_viewer(const uint8_t* pixels, uint32_t width, uint32_t height, size_t budget, GLuint vertex_buffer);
+    ~tile_viewer();
+
+    // Zooms in or out around a point of the framebuffer
+    void zoom_at(double factor, double x, double y, int fb_width, int fb_height);
+
+    // Moves the view by a number of framebuffer pixels
+    void pan(double dx, double dy);
+
+    // Draws the visible tiles with the shaders of programs[scale] and the
+    // passthrough shader in programs[1], upscaling up to max_upscales tiles
+    // that aren't cached yet. The quads are written into the vertex buffer,
+    // which has to be bound.
+    void draw(const std::vector<GLuint>& programs, const std::vector<GLuint>& luts, int scale,
+              int fb_width, int fb_height, int max_upscales);
+
+private:
+    size_t cached_tiles(double span, uint32_t tiles) const;
+    const tile* find(uint64_t key);
+    const tile* upscale(const std::vector<GLuint>& programs, const std::vector<GLuint>& luts, int scale,
+                        uint32_t tx, uint32_t ty);
+    void draw_quad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1);
+};